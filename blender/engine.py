@@ -51,11 +51,82 @@ def context_set_scene(libgideon, context, scene):
     set_scene.argtypes = [c_void_p, c_void_p]
     set_scene(context, scene)
 
-#Rebuild's the BVH for the context's current scene.
+#Returns the context's current scene (owned by the context), for editing it in place.
+def context_get_scene(libgideon, context):
+    get_scene = libgideon.gd_api_context_get_scene
+    get_scene.restype = c_void_p
+    get_scene.argtypes = [c_void_p]
+    return get_scene(context)
+
+#Builds the BVH for the context's current scene, returning False if the existing one already matched its geometry.
 def context_build_bvh(libgideon, context):
     build = libgideon.gd_api_context_build_bvh
+    build.restype = c_bool
     build.argtypes = [c_void_p]
-    build(context)
+    return build(context)
+
+#Moves the context's mesh data into a page file, keeping at most 'budget' bytes in memory.
+def context_enable_geometry_paging(libgideon, context, path, budget):
+    enable = libgideon.gd_api_context_enable_geometry_paging
+    enable.restype = c_bool
+    enable.argtypes = [c_void_p, c_char_p, c_ulonglong]
+    return enable(context, path.encode('ascii'), budget)
+
+#Mirrors gideon::memory_stats.
+class MemoryStats(Structure):
+    _fields_ = [("geometry", c_uint64),
+                ("primitives", c_uint64),
+                ("attributes", c_uint64),
+                ("bvh_nodes", c_uint64),
+                ("bvh_leaves", c_uint64),
+                ("textures", c_uint64),
+                ("shade_trees", c_uint64),
+                ("jit_code", c_uint64)]
+
+#Returns the number of bytes used by each part of the context.
+def context_memory_stats(libgideon, context):
+    get_stats = libgideon.gd_api_context_memory_stats
+    get_stats.restype = None
+    get_stats.argtypes = [c_void_p, POINTER(MemoryStats)]
+
+    stats = MemoryStats()
+    get_stats(context, byref(stats))
+    return stats
+
+#Prints the context's memory usage to the console.
+def print_memory_stats(libgideon, context):
+    stats = context_memory_stats(libgideon, context)
+    print("Memory Usage:")
+    for name, _ in MemoryStats._fields_:
+        print(str.format("  {0}: {1:.2f} MB", name, getattr(stats, name) / (1024.0 * 1024.0)))
+
+#Mirrors gideon::numa_stats.
+class NumaStats(Structure):
+    _fields_ = [("policy", c_int32),
+                ("num_nodes", c_int32),
+                ("pinned_threads", c_int32),
+                ("bvh_replicas", c_int32),
+                ("replicated_bytes", c_uint64),
+                ("interleaved_bytes", c_uint64)]
+
+#Returns how the last render placed threads and scene data on the machine's NUMA nodes.
+def context_numa_stats(libgideon, context):
+    get_stats = libgideon.gd_api_context_numa_stats
+    get_stats.restype = None
+    get_stats.argtypes = [c_void_p, POINTER(NumaStats)]
+
+    stats = NumaStats()
+    get_stats(context, byref(stats))
+    return stats
+
+#Prints the NUMA placement of the last render to the console.
+def print_numa_stats(libgideon, context):
+    stats = context_numa_stats(libgideon, context)
+    policy = [name for name, value in numa_policies.items() if value == stats.policy]
+    print(str.format("NUMA: {0} ({1} nodes, {2} pinned threads, {3} BVH copies using {4:.2f} MB, {5:.2f} MB interleaved)",
+                     policy[0] if policy else stats.policy, stats.num_nodes, stats.pinned_threads,
+                     stats.bvh_replicas, stats.replicated_bytes / (1024.0 * 1024.0),
+                     stats.interleaved_bytes / (1024.0 * 1024.0)))
 
 #-- Program Management --#
 
@@ -146,6 +217,23 @@ def destroy_scene(libgideon, scene):
     destroy.argtypes = [c_void_p]
     destroy(scene)
 
+#Mirrors raytrace::scene_hashes.
+class SceneHashes(Structure):
+    _fields_ = [("geometry", c_uint64),
+                ("camera", c_uint64),
+                ("lights", c_uint64),
+                ("materials", c_uint64)]
+
+#Returns content hashes of the scene's geometry, camera, lights and materials.
+def scene_hashes(libgideon, scene):
+    get_hashes = libgideon.gd_api_scene_hashes
+    get_hashes.restype = None
+    get_hashes.argtypes = [c_void_p, POINTER(SceneHashes)]
+
+    hashes = SceneHashes()
+    get_hashes(scene, byref(hashes))
+    return hashes
+
 #Creates a BVH for the given scene.
 def build_bvh(libgideon, scene):
     build = libgideon.gd_api_build_bvh
@@ -173,6 +261,31 @@ def scene_add_mesh(libgideon, scene, mesh):
                     len(mesh['triangles']), mesh['triangles'],
                     mesh['shaders'], mesh['volumes'])
 
+#Adds a strand (hair) object to a scene, returns its object ID.
+def scene_add_strands(libgideon, scene, strands):
+    add_strands = libgideon.gd_api_add_strands
+    add_strands.argtypes = [c_void_p,
+                            c_uint, POINTER(c_float),
+                            c_uint, POINTER(c_int), POINTER(c_void_p), POINTER(c_void_p)]
+    add_strands.restype = c_int
+
+    return add_strands(scene,
+                       len(strands['points']), strands['points'],
+                       len(strands['sizes']), strands['sizes'],
+                       strands['shaders'], strands['volumes'])
+
+#Adds a float attribute (1-4 components) to a strand object, with a value per point or per strand.
+def strands_add_attribute(libgideon, scene, object_id, attr_name,
+                          per_point, num_components, data):
+    add_attr = libgideon.gd_api_add_strand_attribute
+    add_attr.argtypes = [c_void_p, c_int,
+                         c_char_p, c_int, c_uint,
+                         POINTER(c_float), c_uint]
+
+    add_attr(scene, object_id, attr_name.encode('ascii'),
+             1 if per_point else 0, num_components,
+             data, len(data))
+
 #Adds texture coordinates (vec2 attributes) to a mesh object.
 def mesh_add_texcoord(libgideon, scene, object_id, attr_name,
                       tcoord_data):
@@ -219,6 +332,27 @@ def scene_add_lamp(libgideon, scene, lamp):
              lamp['location'])
              
 
+#Adds a light surrounding the scene from a lat-long image. Returns False if the image couldn't be loaded.
+def scene_add_environment_light(libgideon, scene, path, energy, color):
+    add_env = libgideon.gd_api_add_environment_light
+    add_env.restype = c_bool
+    add_env.argtypes = [c_void_p, c_char_p, c_float,
+                        c_float, c_float, c_float]
+    return add_env(scene, path.encode('ascii'), energy,
+                   color[0], color[1], color[2])
+
+#Removes all lamps from the scene.
+def scene_clear_lamps(libgideon, scene):
+    clear = libgideon.gd_api_clear_lamps
+    clear.argtypes = [c_void_p]
+    clear(scene)
+
+#Reassigns an object's shaders (one per triangle, as given to scene_add_mesh).
+def scene_set_object_materials(libgideon, scene, object_id, shaders, volumes):
+    set_materials = libgideon.gd_api_set_object_materials
+    set_materials.argtypes = [c_void_p, c_int, POINTER(c_void_p), POINTER(c_void_p)]
+    set_materials(scene, object_id, shaders, volumes)
+
 #Renders a tile.
 def render_tile(libgideon, context,
                 entry_name,
@@ -234,3 +368,143 @@ def render_tile(libgideon, context,
            tile_x, tile_y, tile_w, tile_h,
            output_buffer)
     
+
+#Sets the number of threads used by render_frame (0 uses one per core).
+def context_set_threads(libgideon, context, num_threads):
+    set_threads = libgideon.gd_api_context_set_threads
+    set_threads.argtypes = [c_void_p, c_uint]
+    set_threads(context, num_threads)
+
+#Enables adaptive sampling for render_frame: tiles are re-rendered for up to max_passes passes until
+#each pixel's relative error is below threshold (a threshold of 0 disables it).
+def context_set_adaptive_sampling(libgideon, context, threshold, min_samples, max_passes):
+    set_adaptive = libgideon.gd_api_context_set_adaptive_sampling
+    set_adaptive.argtypes = [c_void_p, c_float, c_uint, c_uint]
+    set_adaptive(context, threshold, min_samples, max_passes)
+
+tile_orders = {'ROW_MAJOR' : 0, 'HILBERT' : 1, 'SPIRAL' : 2}
+
+#Sets the order tiles are rendered in (one of the keys of tile_orders).
+def context_set_tile_order(libgideon, context, order):
+    set_order = libgideon.gd_api_context_set_tile_order
+    set_order.argtypes = [c_void_p, c_int]
+    set_order(context, tile_orders[order])
+
+numa_policies = {'OFF' : 0, 'PIN_THREADS' : 1, 'REPLICATE' : 2, 'INTERLEAVE' : 3}
+
+#Sets how render threads and scene data are placed on NUMA nodes (one of the keys of numa_policies).
+def context_set_numa_policy(libgideon, context, policy):
+    set_policy = libgideon.gd_api_context_set_numa_policy
+    set_policy.argtypes = [c_void_p, c_int]
+    set_policy(context, numa_policies[policy])
+
+#Limits renders to roughly the given number of seconds, spending the time on the noisiest tiles (0 removes the limit).
+def context_set_time_budget(libgideon, context, seconds):
+    set_budget = libgideon.gd_api_context_set_time_budget
+    set_budget.argtypes = [c_void_p, c_double]
+    set_budget(context, seconds)
+
+#Renders a full frame on gideon's own threads. progress(tiles_done, total_tiles) is called after
+#each tile (from a render thread) and may return False to cancel. Returns False if cancelled.
+def render_frame(libgideon, context,
+                 entry_name,
+                 width, height, tile_size,
+                 output_buffer, progress):
+    cb_func_type = CFUNCTYPE(c_int, c_int, c_int)
+    render = libgideon.gd_api_render_frame
+    render.restype = c_bool
+    render.argtypes = [c_void_p, c_char_p,
+                       c_int, c_int, c_int,
+                       POINTER(4*c_float), cb_func_type]
+
+    on_progress = lambda done, total : 1 if progress(done, total) else 0
+    return render(context, entry_name,
+                  width, height, tile_size,
+                  output_buffer, cb_func_type(on_progress))
+
+#Mirrors gideon::render_status.
+class RenderStatus(Structure):
+    _fields_ = [("tiles_done", c_int32),
+                ("total_tiles", c_int32),
+                ("progress", c_float),
+                ("finished", c_int32)]
+
+#Starts rendering a frame on gideon's own threads, returning right away (False if it couldn't start).
+#output_buffer must be kept alive until render_wait returns.
+def render_start(libgideon, context,
+                 entry_name,
+                 width, height, tile_size,
+                 output_buffer):
+    start = libgideon.gd_api_render_start
+    start.restype = c_bool
+    start.argtypes = [c_void_p, c_char_p,
+                      c_int, c_int, c_int,
+                      POINTER(4*c_float)]
+    return start(context, entry_name, width, height, tile_size, output_buffer)
+
+#Returns the RenderStatus of the render started with render_start (without blocking).
+def render_poll(libgideon, context):
+    poll = libgideon.gd_api_render_poll
+    poll.restype = None
+    poll.argtypes = [c_void_p, POINTER(RenderStatus)]
+
+    status = RenderStatus()
+    poll(context, byref(status))
+    return status
+
+#Asks the running render to stop as soon as possible.
+def render_cancel(libgideon, context):
+    cancel = libgideon.gd_api_render_cancel
+    cancel.restype = None
+    cancel.argtypes = [c_void_p]
+    cancel(context)
+
+#Waits for the render to stop, returning False if it was cancelled or failed.
+def render_wait(libgideon, context):
+    wait = libgideon.gd_api_render_wait
+    wait.restype = c_bool
+    wait.argtypes = [c_void_p]
+    return wait(context)
+
+#Renders a full frame on num_processes forked worker processes (0 uses one per core), for kernels that
+#aren't thread-safe or may crash. progress(tiles_done, total_tiles) is called from the calling thread and
+#may return False to cancel. Returns False if cancelled or if the workers failed.
+def render_frame_processes(libgideon, context,
+                           entry_name,
+                           width, height, tile_size, num_processes,
+                           output_buffer, progress):
+    cb_func_type = CFUNCTYPE(c_int, c_int, c_int)
+    render = libgideon.gd_api_render_frame_processes
+    render.restype = c_bool
+    render.argtypes = [c_void_p, c_char_p,
+                       c_int, c_int, c_int, c_uint,
+                       POINTER(4*c_float), cb_func_type]
+
+    on_progress = lambda done, total : 1 if progress(done, total) else 0
+    return render(context, entry_name,
+                  width, height, tile_size, num_processes,
+                  output_buffer, cb_func_type(on_progress))
+
+#Renders a frame progressively in up to num_passes passes. publish(passes_done) is called (from the calling
+#thread) whenever output_buffer holds a new image, at most every publish_interval seconds, and may return
+#False to stop. Returns the number of passes completed.
+def render_progressive(libgideon, context,
+                       entry_name,
+                       width, height, tile_size,
+                       num_passes, publish_interval,
+                       output_buffer, progress, publish):
+    progress_func_type = CFUNCTYPE(c_int, c_int, c_int)
+    publish_func_type = CFUNCTYPE(c_int, c_uint)
+    render = libgideon.gd_api_render_progressive
+    render.restype = c_uint
+    render.argtypes = [c_void_p, c_char_p,
+                       c_int, c_int, c_int,
+                       c_uint, c_double,
+                       POINTER(4*c_float), progress_func_type, publish_func_type]
+
+    on_progress = lambda done, total : 1 if progress(done, total) else 0
+    on_publish = lambda passes : 1 if publish(passes) else 0
+    return render(context, entry_name,
+                  width, height, tile_size,
+                  num_passes, publish_interval,
+                  output_buffer, progress_func_type(on_progress), publish_func_type(on_publish))
@@ -106,6 +106,132 @@ class GideonRenderSettings(bpy.types.PropertyGroup):
             description = "List of externally visible render entry point functions",
             type = GideonFunctionSettings
             )
+
+        cls.tile_order = EnumProperty(
+            name = "Tile Order",
+            description = "Order in which tiles are rendered",
+            items = [('HILBERT', "Hilbert Curve", "Follow a Hilbert curve, keeping consecutive tiles next to each other"),
+                     ('SPIRAL', "Spiral", "Spiral out from the center of the image"),
+                     ('ROW_MAJOR', "Row by Row", "Render tiles row by row")],
+            default = 'HILBERT'
+            )
+
+        cls.auto_tile_size = BoolProperty(
+            name = "Automatic Tile Size",
+            description = "Pick the tile size from the image size and number of threads",
+            default = True
+            )
+
+        cls.numa_policy = EnumProperty(
+            name = "NUMA Policy",
+            description = "How render threads and scene data are placed on multi-socket machines",
+            items = [('PIN_THREADS', "Pin Threads", "Spread render threads evenly over the NUMA nodes and keep them there"),
+                     ('REPLICATE', "Replicate BVH", "Pin threads and keep a copy of the BVH on every node"),
+                     ('INTERLEAVE', "Interleave", "Pin threads and spread the BVH and geometry over all nodes"),
+                     ('OFF', "Off", "Let the operating system place threads and memory")],
+            default = 'PIN_THREADS'
+            )
+
+        cls.page_geometry = BoolProperty(
+            name = "Page Geometry",
+            description = "Keep mesh data in a page file on disk, loading it on demand while rendering",
+            default = False
+            )
+
+        cls.page_file = StringProperty(
+            name = "Page File",
+            description = "File used to store paged geometry",
+            subtype = 'FILE_PATH',
+            default = "/tmp/gideon_geometry.pages"
+            )
+
+        cls.page_budget = IntProperty(
+            name = "Geometry Budget",
+            description = "Maximum amount of paged geometry kept in memory (MB)",
+            default = 4096,
+            min = 16
+            )
+
+        cls.environment_map = StringProperty(
+            name = "Environment Map",
+            description = "Lat-long image lighting the scene from every direction (empty for none)",
+            subtype = 'FILE_PATH',
+            default = ""
+            )
+
+        cls.environment_strength = FloatProperty(
+            name = "Environment Strength",
+            description = "Multiplier for the environment map's radiance",
+            default = 1.0,
+            min = 0.0
+            )
+
+        cls.use_processes = BoolProperty(
+            name = "Worker Processes",
+            description = "Render tiles in separate worker processes instead of threads (for kernels that aren't thread-safe)",
+            default = False
+            )
+
+        cls.num_processes = IntProperty(
+            name = "Processes",
+            description = "Number of worker processes (0 for one per core)",
+            default = 0,
+            min = 0
+            )
+
+        cls.progressive = BoolProperty(
+            name = "Progressive",
+            description = "Render the frame in several passes, updating the image after each of them",
+            default = False
+            )
+
+        cls.progressive_passes = IntProperty(
+            name = "Passes",
+            description = "Number of passes rendered over the frame",
+            default = 16,
+            min = 1
+            )
+
+        cls.progressive_interval = FloatProperty(
+            name = "Update Interval",
+            description = "Minimum time between image updates (seconds)",
+            default = 2.0,
+            min = 0.0
+            )
+
+        cls.time_budget = FloatProperty(
+            name = "Time Limit",
+            description = "Keep refining the image until this much time has passed (seconds, 0 for no limit)",
+            default = 0.0,
+            min = 0.0
+            )
+
+        cls.adaptive_sampling = BoolProperty(
+            name = "Adaptive Sampling",
+            description = "Keep rendering extra passes over pixels whose noise is above the threshold",
+            default = False
+            )
+
+        cls.adaptive_threshold = FloatProperty(
+            name = "Noise Threshold",
+            description = "Relative error at which a pixel stops receiving samples",
+            default = 0.05,
+            min = 0.001, max = 1.0
+            )
+
+        cls.adaptive_min_samples = IntProperty(
+            name = "Min Samples",
+            description = "Number of samples taken for every pixel before checking its error",
+            default = 4,
+            min = 2
+            )
+
+        cls.adaptive_max_passes = IntProperty(
+            name = "Max Passes",
+            description = "Maximum number of passes rendered over the frame",
+            default = 16,
+            min = 1
+            )
         
     @classmethod
     def unregister(cls):
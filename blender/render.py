@@ -1,4 +1,5 @@
 import os.path
+import time
 
 import bpy
 from math import *
@@ -14,33 +15,68 @@ class GideonRenderEngine(bpy.types.RenderEngine):
     bl_use_shading_nodes = True
     use_highlight_tiles = True
     libgideon = engine.load_gideon(os.path.join(os.path.dirname(__file__), "libgideon.so"))
+
+    #shared by all engine instances, so later renders can reuse the kernel, scene and BVH
+    context = None
+    kernel = None
+    gd_scene = None
+    source_hash = None
+    geometry_hash = None
     
     def __init__(self):
         self.gideon = GideonRenderEngine.libgideon
         self.loader = source.SourceLoader(self.gideon)
-        self.context = engine.create_context(self.gideon)
+        if GideonRenderEngine.context == None:
+            GideonRenderEngine.context = engine.create_context(self.gideon)
+        self.context = GideonRenderEngine.context
         self.ready = False
-
-    def __del__(self):
-        if hasattr(self, "context"):
-            engine.destroy_context(self.gideon, self.context)
             
     def update(self, data, scene):
         self.update_stats("", "Compiling render kernel")
+        cache = GideonRenderEngine
 
         try:
             self.ready = False
-            kernel = self.rebuild_kernel(scene)
 
-            #sync this scene with gideon
-            self.update_stats("", "Syncing scene data")
-            gd_scene = sync.GideonScene(self.gideon, kernel)
-            sync.convert_scene(scene, gd_scene)
-            engine.context_set_scene(self.gideon, self.context, gd_scene.scene)
+            #only recompile if a source file (or the list of sources) changed
+            source_hash = sync.source_hash(scene)
+            if cache.kernel == None or source_hash != cache.source_hash:
+                cache.source_hash = None
+                cache.kernel = self.rebuild_kernel(scene)
+                cache.source_hash = source_hash
+
+            geometry_hash = sync.geometry_hash(scene)
+            if cache.gd_scene == None or geometry_hash != cache.geometry_hash:
+                #sync this scene with gideon
+                self.update_stats("", "Syncing scene data")
+                cache.gd_scene = None
+                cache.geometry_hash = None
+                
+                gd_scene = sync.GideonScene(self.gideon, cache.kernel)
+                sync.convert_scene(scene, gd_scene)
+                engine.context_set_scene(self.gideon, self.context, gd_scene.scene)
+
+                #build the BVH (kept if the synced geometry turns out to be unchanged)
+                self.update_stats("", "Building BVH")
+                engine.context_build_bvh(self.gideon, self.context)
+
+                if scene.gideon.page_geometry:
+                    self.update_stats("", "Writing geometry pages")
+                    page_file = bpy.path.abspath(scene.gideon.page_file)
+                    budget = scene.gideon.page_budget * 1024 * 1024
+                    if not engine.context_enable_geometry_paging(self.gideon, self.context, page_file, budget):
+                        raise RuntimeError("Could not write geometry page file.")
 
-            #build the BVH
-            self.update_stats("", "Building BVH")
-            engine.context_build_bvh(self.gideon, self.context)
+                cache.gd_scene = gd_scene
+                cache.geometry_hash = geometry_hash
+            else:
+                #same geometry: edit the context's scene in place, keeping its BVH
+                self.update_stats("", "Updating camera, lamps and materials")
+                cache.gd_scene.set_camera(scene)
+                cache.gd_scene.set_lamps(scene)
+                cache.gd_scene.update_materials(scene, cache.kernel)
+                
+            engine.print_memory_stats(self.gideon, self.context)
 
             self.ready = True
         except RuntimeError:
@@ -103,16 +139,9 @@ class GideonRenderEngine(bpy.types.RenderEngine):
         x_pixels = floor(pixel_scale * scene.render.resolution_x)
         y_pixels = floor(pixel_scale * scene.render.resolution_y)
 
-        tile_x = scene.render.tile_x
-        tile_y = scene.render.tile_y
-
-        num_x_tiles = int(ceil(float(x_pixels) / tile_x))
-        num_y_tiles = int(ceil(float(y_pixels) / tile_y))
-        
-        start_px = 0
-        start_py = 0
-
-        print("Num Tiles: ", num_x_tiles, num_y_tiles)
+        tile_size = max(scene.render.tile_x, scene.render.tile_y)
+        if scene.gideon.auto_tile_size:
+            tile_size = 0
         print("Entry Point: ", scene.gideon.entry_point)
 
         try:
@@ -121,38 +150,85 @@ class GideonRenderEngine(bpy.types.RenderEngine):
             self.report({'ERROR'}, "Invalid choice of render entry function")
             return
 
-        total_tiles = num_x_tiles * num_y_tiles
-        completed_tiles = 0
-        
-        for ty in range(num_y_tiles):
-            end_py = min(start_py + tile_y, y_pixels)
-            th = end_py - start_py
+        #render every tile on gideon's thread pool
+        def on_progress(done, total):
+            self.update_stats("", str.format("Completed {0}/{1} tiles", done, total))
+            self.update_progress(float(done) / total)
+            return not self.test_break()
 
-            for tx in range(num_x_tiles):
-                end_px = min(start_px + tile_x, x_pixels)
-                tw = end_px - start_px
-                
-                r = self.begin_result(start_px, start_py, tw, th)
-                
-                float4_ty = 4 * ctypes.c_float
-                result = (tw * th * float4_ty)()
-                engine.render_tile(self.gideon, self.context,
-                                   entry_obj.intern_name.encode('ascii'),
-                                   start_px, start_py, tw, th,
-                                   result)
+        if scene.render.threads_mode == 'FIXED':
+            engine.context_set_threads(self.gideon, self.context, scene.render.threads)
+        else:
+            engine.context_set_threads(self.gideon, self.context, 0)
+
+        if scene.gideon.adaptive_sampling:
+            engine.context_set_adaptive_sampling(self.gideon, self.context,
+                                                 scene.gideon.adaptive_threshold,
+                                                 scene.gideon.adaptive_min_samples,
+                                                 scene.gideon.adaptive_max_passes)
+        else:
+            engine.context_set_adaptive_sampling(self.gideon, self.context, 0.0, 0, 1)
+
+        engine.context_set_time_budget(self.gideon, self.context, scene.gideon.time_budget)
+        engine.context_set_tile_order(self.gideon, self.context, scene.gideon.tile_order)
+        engine.context_set_numa_policy(self.gideon, self.context, scene.gideon.numa_policy)
+
+        float4_ty = 4 * ctypes.c_float
+        result = (x_pixels * y_pixels * float4_ty)()
+
+        if scene.gideon.use_processes:
+            #single-pass render on forked worker processes
+            if not engine.render_frame_processes(self.gideon, self.context,
+                                                 entry_obj.intern_name.encode('ascii'),
+                                                 x_pixels, y_pixels, tile_size, scene.gideon.num_processes,
+                                                 result, on_progress):
+                return
+            
+            r = self.begin_result(0, 0, x_pixels, y_pixels)
+            r.layers[0].rect = result
+            self.end_result(r)
+            return
+        
+        if scene.gideon.progressive:
+            #show the image after each published pass
+            def on_publish(passes):
+                r = self.begin_result(0, 0, x_pixels, y_pixels)
                 r.layers[0].rect = result
-                
                 self.end_result(r)
+                self.update_stats("", str.format("Pass {0}/{1}", passes, scene.gideon.progressive_passes))
+                return not self.test_break()
 
-                completed_tiles += 1
-                self.update_stats("", str.format("Completed {0}/{1} tiles", completed_tiles, total_tiles))
-                start_px += tile_x
+            engine.render_progressive(self.gideon, self.context,
+                                      entry_obj.intern_name.encode('ascii'),
+                                      x_pixels, y_pixels, tile_size,
+                                      scene.gideon.progressive_passes, scene.gideon.progressive_interval,
+                                      result, on_progress, on_publish)
+            engine.print_numa_stats(self.gideon, self.context)
+            return
+        
+        #render in the background, polling so the UI stays responsive and cancelling stops tiles midway
+        if not engine.render_start(self.gideon, self.context,
+                                   entry_obj.intern_name.encode('ascii'),
+                                   x_pixels, y_pixels, tile_size,
+                                   result):
+            return
 
-                if self.test_break():
-                    return
-                
-            start_px = 0
-            start_py += tile_y    
+        status = engine.render_poll(self.gideon, self.context)
+        while not status.finished:
+            self.update_stats("", str.format("Completed {0}/{1} tiles", status.tiles_done, status.total_tiles))
+            self.update_progress(status.progress)
+            if self.test_break():
+                engine.render_cancel(self.gideon, self.context)
+            time.sleep(0.1)
+            status = engine.render_poll(self.gideon, self.context)
+
+        if not engine.render_wait(self.gideon, self.context):
+            return
+
+        engine.print_numa_stats(self.gideon, self.context)
+        r = self.begin_result(0, 0, x_pixels, y_pixels)
+        r.layers[0].rect = result
+        self.end_result(r)
 
 class KERNEL_FUNCTION_LIST_update(bpy.types.Operator):
     bl_idname = "gideon.update_kernel_functions"
@@ -1,4 +1,4 @@
-import bpy, ctypes
+import bpy, ctypes, os, hashlib, array
 from . import scene, mesh, engine, camera, lamp
 
 #Converts all scene objects into a usable format for the renderer.
@@ -27,9 +27,37 @@ class GideonScene:
         self.gideon = libgideon
         self.scene = engine.create_scene(self.gideon)
         self.renderer = renderer
+        self.objects = {} #object name -> (object ID, material slot per triangle, material keys)
         
     def __del__(self):
         pass
+
+    #Maps a list of material slots to arrays of surface and volume shader handles.
+    def lookup_shaders(self, bl_scene, obj, slots):
+        shader_arr = (len(slots)*ctypes.c_void_p)()
+        volume_arr = (len(slots)*ctypes.c_void_p)()
+        funcs = {}
+
+        for idx in range(len(slots)):
+            material_slot = slots[idx]
+            if material_slot not in funcs:
+                mat = obj.material_slots[material_slot]
+                funcs[material_slot] = (self.lookup_function(bl_scene, mat.material.gideon.shader),
+                                        self.lookup_function(bl_scene, mat.material.gideon.volume))
+            
+            shader_arr[idx], volume_arr[idx] = funcs[material_slot]
+        
+        return shader_arr, volume_arr
+
+    #Returns the kernel's function for a shader list entry (or None).
+    def lookup_function(self, bl_scene, key):
+        if len(key) == 0:
+            return None
+        try:
+            func_obj = bl_scene.gideon.shader_list[key]
+            return engine.lookup_function(self.gideon, self.renderer, func_obj.intern_name)
+        except KeyError:
+            return None
     
     #Converts a mesh object to Gideon's format.
     def add_mesh(self, bl_scene, obj, is_preview = False):
@@ -37,39 +65,12 @@ class GideonScene:
         gd_mesh = mesh.LoadMeshObject(bl_scene, obj, is_preview)
 
         #map material indices to shader handles
-        shader_arr = (len(gd_mesh['shaders'])*ctypes.c_void_p)()
-        volume_arr = (len(gd_mesh['shaders'])*ctypes.c_void_p)()
-
-        for shader_idx in range(len(gd_mesh['shaders'])):
-            material_slot = gd_mesh['shaders'][shader_idx]
-            mat = obj.material_slots[material_slot]
-            
-            shader_key = mat.material.gideon.shader
-            shader_func = None
-            if len(shader_key) > 0:
-                try:
-                    shader_obj = bl_scene.gideon.shader_list[shader_key]
-                    shader_func = engine.lookup_function(self.gideon, self.renderer, shader_obj.intern_name)
-                except KeyError:
-                    pass
-
-            volume_key = mat.material.gideon.volume
-            volume_func = None
-            if len(volume_key) > 0:
-                try:
-                    volume_obj = bl_scene.gideon.shader_list[volume_key]
-                    volume_func = engine.lookup_function(self.gideon, self.renderer, volume_obj.intern_name)
-                except KeyError:
-                    pass
-                
-            shader_arr[shader_idx] = shader_func
-            volume_arr[shader_idx] = volume_func
-        
-        gd_mesh['shaders'] = shader_arr
-        gd_mesh['volumes'] = volume_arr
+        slots = list(gd_mesh['shaders'])
+        gd_mesh['shaders'], gd_mesh['volumes'] = self.lookup_shaders(bl_scene, obj, slots)
         
         #add the mesh to gideon
         obj_id = engine.scene_add_mesh(self.gideon, self.scene, gd_mesh)
+        self.objects[obj.name] = (obj_id, slots, material_keys(obj))
 
         #add all the mesh's attributes
         for texcoord in gd_mesh['texcoords'].keys():
@@ -87,6 +88,36 @@ class GideonScene:
         gd_lamp = lamp.convert(lamp_object)
         engine.scene_add_lamp(self.gideon, self.scene, gd_lamp)
 
+    #Replaces all of the scene's lamps.
+    def set_lamps(self, bl_scene):
+        engine.scene_clear_lamps(self.gideon, self.scene)
+        for obj in bl_scene.objects:
+            if obj.type == 'LAMP':
+                self.add_lamp(obj)
+
+        g_scene = bl_scene.gideon
+        if g_scene.environment_map != "":
+            path = bpy.path.abspath(g_scene.environment_map)
+            if not engine.scene_add_environment_light(self.gideon, self.scene, path,
+                                                      g_scene.environment_strength, (1.0, 1.0, 1.0)):
+                print("Unable to load environment map:", path)
+
+    #Reassigns the shaders of objects whose materials changed (or of every object, after the kernel changed).
+    def update_materials(self, bl_scene, renderer):
+        kernel_changed = (renderer != self.renderer)
+        self.renderer = renderer
+
+        for obj in bl_scene.objects:
+            if obj.name not in self.objects:
+                continue
+            
+            obj_id, slots, keys = self.objects[obj.name]
+            new_keys = material_keys(obj)
+            if kernel_changed or new_keys != keys:
+                shaders, volumes = self.lookup_shaders(bl_scene, obj, slots)
+                engine.scene_set_object_materials(self.gideon, self.scene, obj_id, shaders, volumes)
+                self.objects[obj.name] = (obj_id, slots, new_keys)
+
     #Sets the main camera of the Gideon scene.
     def set_camera(self, bl_scene):
         gd_cam = camera.convert(bl_scene.camera, bl_scene)
@@ -106,3 +137,81 @@ def convert_scene(bl_scene, gd_scene, is_preview = False):
             pass
     
     gd_scene.set_camera(bl_scene)
+
+#The shader and volume assigned to each of an object's material slots.
+def material_keys(obj):
+    return tuple((slot.material.gideon.shader, slot.material.gideon.volume) for slot in obj.material_slots)
+
+#Hashes the kernel's source files (by path, size and modification time) and the list of sources to compile.
+def source_hash(bl_scene):
+    h = hashlib.sha1()
+    for src in bl_scene.gideon.sources:
+        h.update(src.name.encode('utf-8'))
+
+    for path in [bpy.path.abspath(bl_scene.gideon.std_path), bpy.path.abspath(bl_scene.gideon.source_path)]:
+        for root, dirs, files in os.walk(path):
+            dirs.sort()
+            for name in sorted(files):
+                file_path = os.path.join(root, name)
+                try:
+                    st = os.stat(file_path)
+                except OSError:
+                    continue
+                h.update(str.format("{0}:{1}:{2}", file_path, st.st_size, st.st_mtime).encode('utf-8'))
+    
+    return h.hexdigest()
+
+#Hashes everything that feeds into the synced meshes: transforms, modifiers, vertices, normals and smoothing,
+#face materials, UV and vertex color layers, and hair.
+def geometry_hash(bl_scene):
+    h = hashlib.sha1()
+    for obj in bl_scene.objects:
+        if obj.type != 'MESH':
+            continue
+
+        h.update(obj.name.encode('utf-8'))
+        h.update(obj.data.name.encode('utf-8'))
+        h.update(array.array('f', [x for row in obj.matrix_world for x in row]).tobytes())
+        
+        for mod in obj.modifiers:
+            h.update(repr([(p.identifier, getattr(mod, p.identifier))
+                           for p in mod.bl_rna.properties
+                           if p.type in {'BOOLEAN', 'INT', 'FLOAT', 'STRING', 'ENUM'} and not p.is_array]).encode('utf-8'))
+
+        verts = obj.data.vertices
+        coords = array.array('f', [0.0]) * (3 * len(verts))
+        verts.foreach_get("co", coords)
+        h.update(coords.tobytes())
+        verts.foreach_get("normal", coords)
+        h.update(coords.tobytes())
+
+        faces = obj.data.polygons
+        face_materials = array.array('i', [0]) * len(faces)
+        faces.foreach_get("material_index", face_materials)
+        h.update(face_materials.tobytes())
+        faces.foreach_get("use_smooth", face_materials)
+        h.update(face_materials.tobytes())
+
+        #UV layers become texcoord attributes, vertex color layers color attributes
+        for uv_layer in obj.data.uv_layers:
+            h.update(uv_layer.name.encode('utf-8'))
+            uvs = array.array('f', [0.0]) * (2 * len(uv_layer.data))
+            uv_layer.data.foreach_get("uv", uvs)
+            h.update(uvs.tobytes())
+
+        for vcolor_layer in obj.data.vertex_colors:
+            h.update(vcolor_layer.name.encode('utf-8'))
+            colors = array.array('f', [0.0]) * (3 * len(vcolor_layer.data))
+            vcolor_layer.data.foreach_get("color", colors)
+            h.update(colors.tobytes())
+
+        #hair strands
+        for psys in obj.particle_systems:
+            if psys.settings.type != 'HAIR':
+                continue
+            h.update(psys.name.encode('utf-8'))
+            for particle in psys.particles:
+                for key in particle.hair_keys:
+                    h.update(array.array('f', key.co).tobytes())
+
+    return h.hexdigest()
@@ -43,8 +43,38 @@ class GideonRender_Entry_Panel(GideonButtonsPanel, bpy.types.Panel):
         g_scene = scene.gideon
         
         layout.prop_search(g_scene, "entry_point", g_scene, "entry_list", text = "Entry Point", icon = 'MATERIAL')
-        layout.prop(scene.render, "tile_x", text = "Tile Width")
-        layout.prop(scene.render, "tile_y", text = "Tile Height")
+        layout.prop(g_scene, "tile_order", text = "Tile Order")
+        layout.prop(g_scene, "auto_tile_size", text = "Automatic Tile Size")
+        if not g_scene.auto_tile_size:
+            layout.prop(scene.render, "tile_x", text = "Tile Width")
+            layout.prop(scene.render, "tile_y", text = "Tile Height")
+
+        layout.prop(g_scene, "numa_policy", text = "NUMA Policy")
+        layout.prop(g_scene, "page_geometry", text = "Page Geometry")
+        if g_scene.page_geometry:
+            layout.prop(g_scene, "page_file", text = "Page File")
+            layout.prop(g_scene, "page_budget", text = "Budget (MB)")
+
+        layout.prop(g_scene, "environment_map", text = "Environment")
+        if g_scene.environment_map != "":
+            layout.prop(g_scene, "environment_strength", text = "Strength")
+
+        layout.prop(g_scene, "use_processes", text = "Worker Processes")
+        if g_scene.use_processes:
+            layout.prop(g_scene, "num_processes", text = "Processes")
+            
+        layout.prop(g_scene, "progressive", text = "Progressive")
+        if g_scene.progressive:
+            layout.prop(g_scene, "progressive_passes", text = "Passes")
+            layout.prop(g_scene, "progressive_interval", text = "Update Interval")
+
+        layout.prop(g_scene, "time_budget", text = "Time Limit (s)")
+        layout.prop(g_scene, "adaptive_sampling", text = "Adaptive Sampling")
+        if g_scene.adaptive_sampling:
+            layout.prop(g_scene, "adaptive_threshold", text = "Noise Threshold")
+            layout.prop(g_scene, "adaptive_min_samples", text = "Min Samples")
+            if not g_scene.progressive:
+                layout.prop(g_scene, "adaptive_max_passes", text = "Max Passes")
 
 
 
@@ -27,6 +27,7 @@
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
 
 namespace raytrace {
 
@@ -63,21 +64,40 @@ namespace raytrace {
     
   };
 
+  /* Keeps a running total of the machine code emitted by the JIT. */
+  class code_size_listener : public llvm::JITEventListener {
+  public:
+
+    code_size_listener() : total_size(0) { }
+
+    virtual void NotifyFunctionEmitted(const llvm::Function &F, void *code, size_t size,
+				       const EmittedFunctionDetails &details) { total_size += size; }
+    virtual void NotifyFreeingMachineCode(void *old_ptr) { }
+
+    size_t total_size;
+
+  };
+
   /* Compiled form of a render_program. */
   class compiled_renderer {
   public:
 
     compiled_renderer(llvm::Module *module);
+    ~compiled_renderer();
 
     void *get_function_pointer(const std::string &func_name);
 
-    //The variable ".__gd_scene" must be mapped to a scene data structure before
-    //retrieving any function pointers.
+    //The variable ".__gd_scene" must be mapped to a scene data structure, and ".__gd_cancel" to an int
+    //(non-zero to make every loop exit at its next iteration), before retrieving any function pointers.
     void map_global(const std::string &name, void *location_ptr);
+
+    //Returns the number of bytes of machine code generated so far.
+    size_t code_size() const { return code_listener.total_size; }
     
   private:
     
     llvm::Module *module;
+    code_size_listener code_listener; //must outlive the engine
     std::unique_ptr<llvm::ExecutionEngine> engine;
     SceneDataMemoryManager *jmm;
     bool finalized;
@@ -24,28 +24,108 @@
 
 #include "scene/scene.hpp"
 #include "scene/bvh.hpp"
+#include "scene/light_tree.hpp"
+#include "scene/emitters.hpp"
 #include "math/sampling.hpp"
 
 #include "compiler/rendermodule.hpp"
+#include "engine/thread_pool.hpp"
+#include "engine/film.hpp"
+#include "engine/tile_order.hpp"
+#include "engine/wavefront.hpp"
+#include "engine/numa.hpp"
 
 #include <boost/function.hpp>
 #include <OpenImageIO/texture.h>
 
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <exception>
+
 namespace gideon {
 
+  /* Number of bytes used by each part of a render context (laid out for use from the C API). */
+  struct memory_stats {
+    uint64_t geometry; //vertices, normals and triangle indices
+    uint64_t primitives; //primitive, object and light tables
+    uint64_t attributes;
+    uint64_t bvh_nodes, bvh_leaves;
+    uint64_t textures; //memory used by the texture cache and environment maps
+    uint64_t shade_trees; //shade tree nodes currently allocated (across all contexts)
+    uint64_t jit_code;
+  };
+
+  /* How render threads and scene data were placed on the machine's NUMA nodes (laid out for use from the C API). */
+  struct numa_stats {
+    int32_t policy; //the numa_policy in use
+    int32_t num_nodes;
+    int32_t pinned_threads; //render threads kept on a single node
+    int32_t bvh_replicas; //per-node copies of the BVH
+    uint64_t replicated_bytes; //memory used by the BVH copies
+    uint64_t interleaved_bytes; //BVH and geometry memory spread over all nodes
+  };
+
+  /* Progress of a render started with render_context::start_render (laid out for use from the C API). */
+  struct render_status {
+    int32_t tiles_done, total_tiles; //in the current pass
+    float progress; //fraction of the current pass that's done
+    int32_t finished; //non-zero once the render has stopped (wait_render returns its result)
+  };
+
   /* Contains data relevant to the current rendering session (scene, bvh, programs, etc). */
   class render_context {
   public:
 
+    struct thread_state;
+
+    /* Scene state shared by all render threads (read-only while rendering). */
     struct scene_data {
       raytrace::scene *s;
       raytrace::bvh *accel;
-      raytrace::sampler samples;
-      boost::function<float ()> rng; //probably not threadsafe
+      raytrace::light_tree *lights; //hierarchy over the scene's lights (rebuilt when they change)
+      raytrace::emitter_table *emitters; //the scene's emissive triangles (reset when its geometry or shaders change)
 
       OpenImageIO::TextureSystem *textures;
+
+      //Accumulation buffer for adaptive sampling (NULL unless a frame is being rendered adaptively).
+      film *frame;
+
+      //Returns the render state of the calling thread.
+      thread_state *thread() const { return current_thread; }
+
+      //Returns the BVH the calling thread should trace against (its node's copy, if the BVH is replicated).
+      inline const raytrace::bvh *thread_accel() const;
     };
 
+    /* State owned by a single render thread. */
+    struct thread_state {
+      raytrace::sampler samples; //also provides gideon.random()
+      wavefront_queue paths; //paths of the current tile, for wavefront kernels
+      const raytrace::bvh *accel; //copy of the BVH on this thread's NUMA node (NULL to use the shared one)
+
+      //pixels of a tile in Morton order, for the last tile size asked for
+      std::vector<uint32_t> pixel_order;
+      int pixel_order_width, pixel_order_height;
+
+      thread_state(unsigned int seed);
+
+      //Returns the pixels of a width by height tile in Morton order (packed as (y << 16) | x).
+      const std::vector<uint32_t> &morton_pixels(int width, int height);
+    };
+
+    //Makes the given state the calling thread's render state.
+    static void bind_thread_state(thread_state *state) { current_thread = state; }
+
+    //Signature of a kernel's entry functions: (x, y, width, height, tile_buffer).
+    typedef void (*entry_func)(int, int, int, int, void*);
+
+    //Called after each tile is finished with (tiles_done, total_tiles) for the current pass, returning false to cancel the render.
+    typedef boost::function<bool (int, int)> progress_callback;
+
+    //Called with the number of passes completed whenever a progressive render publishes its image, returning false to stop rendering.
+    typedef boost::function<bool (unsigned int)> publish_callback;
+
     render_context();
     ~render_context();
 
@@ -55,22 +135,200 @@ namespace gideon {
     //Returns a pointer to the current kernel (for use in function lookups).
     raytrace::render_kernel *get_kernel() { return kernel.get(); }
     
-    //Sets the context's current scene.
+    //Sets the context's current scene. If its geometry is identical to the scene the current BVH was built
+    //for, the BVH is kept, so scenes that only differ in their camera, lights or shaders don't need a rebuild.
     void set_scene(std::unique_ptr<raytrace::scene> s);
 
-    //Rebuild's the scene's BVH.
-    void build_bvh();
+    //Returns the current scene (which may be edited in place between renders, except for its geometry).
+    raytrace::scene *get_scene() { return scn.get(); }
+
+    //Builds the scene's BVH, unless the current one was built for identical geometry. Returns true if a new BVH was built.
+    bool build_bvh();
+
+    //Moves the scene's mesh data out of memory into a page file at 'path', keeping at most
+    //'budget_bytes' of it resident (must be called after the BVH has been built).
+    void enable_geometry_paging(const std::string &path, size_t budget_bytes);
+
+    //Sets the number of threads used to render frames (0 uses one thread per core).
+    void set_num_threads(unsigned int num_threads);
+
+    //Sets how render threads and scene data are placed on the machine's NUMA nodes (has no effect on
+    //single-node machines). Threads are pinned to their nodes by default.
+    void set_numa_policy(numa_policy policy);
+
+    //Sets the order tiles are rendered in (row by row, along a Hilbert curve, or spiralling out from the center).
+    void set_tile_order(tile_order order) { tiles_order = order; }
+
+    //Enables adaptive sampling for render_frame: the frame is rendered in up to 'max_passes' passes, where each
+    //pass only re-renders tiles that still have pixels whose relative error is above 'threshold' (after at
+    //least 'min_samples' samples). A threshold of 0 disables adaptive sampling.
+    void set_adaptive_sampling(float threshold, unsigned int min_samples, unsigned int max_passes);
+
+    //Limits frame renders to roughly 'seconds' of wall-clock time (0 removes the limit). With a time budget,
+    //render_frame keeps rendering passes until the time runs out (or, with adaptive sampling, the frame converges).
+    //The first pass always covers the whole frame; later passes go to the noisiest tiles that can still finish
+    //before the deadline, based on how long each tile took to render before. Rendering stops once the noisiest
+    //remaining tile can't finish in time.
+    void set_time_budget(double seconds) { time_budget = seconds; }
+
+    //Renders a frame by splitting it into tiles and running the entry function on each of them in parallel.
+    //If 'tile_size' is 0, the tile size is picked from the frame size and number of threads. 'out' holds width*height RGBA pixels, stored row by row. Returns false if the render was cancelled.
+    //With adaptive sampling enabled, the entry function should skip pixels where gideon.sampler:converged is true.
+    bool render_frame(const std::string &entry_name,
+		      int width, int height, int tile_size,
+		      /* out */ float (*out)[4],
+		      const progress_callback &progress);
+
+    //Renders a frame progressively, running the entry function over the frame up to 'num_passes' times.
+    //Each pass is accumulated into the context's accumulation buffer, and 'out' always holds the current
+    //estimate of each pixel. Whenever a pass finishes at least 'publish_interval' seconds after the last
+    //publish (and once rendering stops), 'publish' is called so the host can display the image.
+    //Entry functions can tell passes apart with gideon.sampler:pass. Returns the number of passes completed.
+    unsigned int render_progressive(const std::string &entry_name,
+				    int width, int height, int tile_size,
+				    unsigned int num_passes, double publish_interval,
+				    /* out */ float (*out)[4],
+				    const progress_callback &progress, const publish_callback &publish);
+
+    //Renders a frame like render_frame, but on 'num_processes' forked worker processes (0 uses one per core)
+    //instead of threads, so kernels don't need to be thread-safe and a crashing kernel only takes down its worker.
+    //Workers share this process's scene, BVH and compiled kernel copy-on-write, take tiles from a queue in
+    //shared memory and write them straight into a shared framebuffer. Tiles lost to a crashed worker are retried
+    //once on fresh workers. Renders a single pass (without adaptive sampling or a time budget).
+    //Returns false if the render was cancelled.
+    bool render_frame_processes(const std::string &entry_name,
+				int width, int height, int tile_size,
+				unsigned int num_processes,
+				/* out */ float (*out)[4],
+				const progress_callback &progress);
+
+    //Starts rendering a frame (as render_frame would) on a background thread and returns right away.
+    //The caller polls the render with poll_render, may stop it with cancel_render, and must call wait_render
+    //before starting another. 'out' must stay valid until then.
+    void start_render(const std::string &entry_name,
+		      int width, int height, int tile_size,
+		      /* out */ float (*out)[4]);
+
+    //Returns the progress of the background render (without blocking).
+    render_status poll_render() const;
+
+    //Asks the background render to stop. Tiles in flight stop at their next loop iteration, since compiled
+    //kernels check a cancellation flag on every loop back-edge.
+    void cancel_render();
+
+    //Waits for the background render to stop, returning false if it was cancelled (or none was started).
+    //Rethrows any error raised by the render.
+    bool wait_render();
+
+    //Returns the accumulation buffer of the last frame rendered in several passes (NULL if there isn't one).
+    const film *accumulation_buffer() const { return accum.get(); }
+
+    //Renders a single tile on the calling thread, using the context's main-thread render state.
+    void render_tile(const std::string &entry_name,
+		     int x, int y, int width, int height,
+		     /* out */ float (*out)[4]);
+
+    //Binds the main-thread render state to the calling thread (needed to call entry functions directly).
+    void bind_main_thread() { bind_thread_state(main_state.get()); }
+
+    //Returns the memory currently used by each subsystem of this context.
+    memory_stats memory_usage() const;
+
+    //Returns the NUMA placement used by the last render.
+    numa_stats numa_usage() const;
 
   private:
 
+    struct tile {
+      int x, y, w, h;
+      int id; //index of the tile in the frame
+    };
+
+    //Splits a frame into tiles, in the context's tile order.
+    std::vector<tile> frame_tiles(int width, int height, int tile_size) const;
+
+    //Picks the tiles to render in the next pass so that it finishes within 'time_left' seconds,
+    //given each tile's most recent render time.
+    void select_budget_tiles(/* inout */ std::vector<tile> &tiles, const std::vector<double> &tile_seconds,
+			     double time_left) const;
+
+    //Renders the frame in up to 'num_passes' passes, accumulating them if 'accumulate' is set.
+    //Returns false if the render was cancelled or stopped by the publish callback.
+    bool render_passes(const std::string &entry_name,
+		       int width, int height, int tile_size,
+		       unsigned int num_passes, bool accumulate, double publish_interval,
+		       /* out */ float (*out)[4],
+		       const progress_callback &progress, const publish_callback &publish,
+		       /* out */ unsigned int &passes_done);
+
+    //Pins the workers to their NUMA nodes and replicates or interleaves the BVH and geometry, as set by
+    //the NUMA policy. Only does work when the workers, scene or policy have changed since the last render.
+    void place_numa_data();
+
+    //Rebuilds the light tree if the scene's lights have changed since it was built, and resets the emitter table
+    //(for the kernel to fill in again) if its geometry or shaders have.
+    void prepare_lights();
+
+    //Renders one pass over the given tiles, storing the time each tile took in tile_seconds[tile.id].
+    //Returns false if the render was cancelled.
+    bool render_tiles(entry_func entry, const std::vector<tile> &tiles, unsigned int pass,
+		      int width, int tile_size,
+		      /* out */ double *tile_seconds,
+		      /* out */ float (*out)[4],
+		      const progress_callback &progress);
+
+    //Paged geometry can't be read inside the kernel without an exception crossing its frames, so a failed read
+    //stops the render (its triangles are missed meanwhile) and check_geometry throws the error once the kernel returns.
+    bool geometry_failed() const;
+    void check_geometry() const;
+
     std::unique_ptr<raytrace::scene> scn;
     std::unique_ptr<raytrace::render_kernel> kernel;
     std::unique_ptr<raytrace::bvh> accel;
+    uint64_t bvh_geometry_hash; //geometry hash of the scene the BVH was built for
+    std::unique_ptr<raytrace::light_tree> light_hierarchy;
+    uint64_t light_tree_hash; //lights hash of the scene the light tree was built for
+    std::unique_ptr<raytrace::emitter_table> emitter_lights;
+    uint64_t emitters_hash; //geometry and materials hash of the scene the emitter table was set up for
+    std::unique_ptr<thread_pool> workers;
+    std::unique_ptr<film> accum;
+    unsigned int num_threads;
+    tile_order tiles_order;
+
+    float adaptive_threshold;
+    unsigned int adaptive_min_samples, adaptive_max_passes;
+    double time_budget;
+
+    numa_topology topology;
+    numa_policy numa_mode;
+    bool numa_placed;
+    std::vector<std::unique_ptr<raytrace::bvh>> bvh_replicas; //one per node, if replicating
+    unsigned int pinned_threads;
+    uint64_t interleaved_bytes;
 
     scene_data *sd;
+    std::unique_ptr<thread_state> main_state;
+    std::vector<std::unique_ptr<thread_state>> worker_states;
+
+    //mapped to the kernel's __gd_cancel variable, set to stop every loop in the kernel
+    std::atomic<int> cancel_flag;
+
+    //state of the background render started by start_render
+    std::thread render_thread;
+    std::atomic<int> async_tiles_done, async_total_tiles;
+    std::atomic<bool> async_finished, async_cancelled;
+    bool async_result;
+    std::exception_ptr async_error;
+
+    static __thread thread_state *current_thread;
     
   };
 
+  inline const raytrace::bvh *render_context::scene_data::thread_accel() const {
+    if (current_thread && current_thread->accel) return current_thread->accel;
+    return accel;
+  }
+
 };
 
 #endif
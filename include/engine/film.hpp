@@ -0,0 +1,101 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef GD_FILM_HPP
+#define GD_FILM_HPP
+
+#include "math/vector.hpp"
+
+#include <vector>
+
+namespace gideon {
+
+  /*
+    Accumulates the samples taken for each pixel of a frame, tracking the running mean and
+    the variance of each pixel's luminance (using Welford's method) so the renderer can tell
+    which pixels still need more samples.
+    Samples come either from the kernel (through gideon.write_sample) or, for kernels that don't report
+    their samples, from the color each pass writes to the pixel.
+    Each pixel must only be updated by one thread at a time.
+  */
+  class film {
+  public:
+
+    //A pixel is converged once the standard error of its mean luminance is below threshold * (mean + offset).
+    //The offset keeps very dark pixels from using up the whole sample budget.
+    static constexpr float error_offset = 0.01f;
+
+    film(int width, int height,
+	 float threshold, unsigned int min_samples);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    void add_sample(int x, int y, const raytrace::float4 &color);
+
+    //Sets the index of the pass currently being rendered.
+    void set_pass(unsigned int pass) { current_pass = pass; }
+
+    //Adds the colors written to a tile buffer (w*h RGBA pixels) as one sample of each pixel in the region,
+    //skipping pixels that already have samples from the current pass or that have converged.
+    void accumulate(int x0, int y0, int w, int h, const float *tile_buffer);
+
+    //Returns true if pixel (x, y) has enough samples to meet the error threshold (always false if the threshold is 0).
+    bool converged(int x, int y) const;
+
+    //Returns true if every pixel in the given region has converged.
+    bool converged(int x0, int y0, int w, int h) const;
+
+    //Relative standard error of the pixel's mean luminance.
+    float error(int x, int y) const;
+
+    //Average relative error of the pixels in the given region (pixels with fewer than two samples count as 'max_error').
+    float error(int x0, int y0, int w, int h, float max_error = 1.0f) const;
+
+    unsigned int num_samples(int x, int y) const { return pixels[y*width + x].n; }
+    unsigned long long total_samples() const;
+
+    //Writes the current mean of each pixel in the given region to the frame buffer 'out' (pixels without
+    //any samples are left unchanged).
+    void resolve(int x0, int y0, int w, int h,
+		 /* out */ float (*out)[4]) const;
+
+  private:
+
+    struct pixel {
+      raytrace::float4 mean;
+      float lum_mean, lum_m2;
+      unsigned int n;
+      unsigned int last_pass; //last pass that added a sample to this pixel
+    };
+
+    int width, height;
+    float threshold;
+    unsigned int min_samples;
+    unsigned int current_pass;
+
+    std::vector<pixel> pixels;
+
+  };
+
+};
+
+#endif
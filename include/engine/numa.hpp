@@ -0,0 +1,70 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef GD_NUMA_HPP
+#define GD_NUMA_HPP
+
+#include <vector>
+#include <thread>
+#include <cstddef>
+
+namespace gideon {
+
+  /* How render threads and scene data are placed on machines with several NUMA nodes (sockets). */
+  enum numa_policy {
+    NUMA_OFF, //threads may run anywhere, memory stays where it was first touched
+    NUMA_PIN_THREADS, //render threads are spread evenly over the nodes and kept there
+    NUMA_REPLICATE, //pinned threads, plus a copy of the BVH on every node (geometry is interleaved)
+    NUMA_INTERLEAVE //pinned threads, with the BVH and geometry pages spread round-robin over all nodes
+  };
+  
+  /* The NUMA nodes of this machine and the CPUs on each of them. */
+  class numa_topology {
+  public:
+
+    //Reads the topology from sysfs. Machines without NUMA information are treated as a single node.
+    static numa_topology detect();
+
+    unsigned int num_nodes() const { return static_cast<unsigned int>(node_cpus.size()); }
+
+    //CPUs belonging to the given node (indexed from 0, regardless of the system's node numbering).
+    const std::vector<unsigned int> &cpus(unsigned int node) const { return node_cpus[node]; }
+
+    //The node worker 'worker' of 'num_workers' should run on, giving each node a contiguous block of workers.
+    unsigned int worker_node(unsigned int worker, unsigned int num_workers) const;
+
+    //Spreads the pages overlapping [data, data + bytes) round-robin over all nodes.
+    //Returns false if the memory policy couldn't be changed (or there's only one node).
+    bool interleave(const void *data, size_t bytes) const;
+    
+  private:
+
+    std::vector<std::vector<unsigned int>> node_cpus;
+    std::vector<unsigned int> node_ids; //system node number of each node
+
+  };
+
+  //Restricts a thread to the given set of CPUs. Returns false if the affinity couldn't be set.
+  bool set_thread_affinity(std::thread::native_handle_type thread, const std::vector<unsigned int> &cpus);
+  
+};
+
+#endif
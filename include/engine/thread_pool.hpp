@@ -0,0 +1,83 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef GD_THREAD_POOL_HPP
+#define GD_THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+
+#include <boost/function.hpp>
+
+namespace gideon {
+
+  /* 
+     A fixed set of worker threads that run batches of tasks.
+     Each worker has its own queue; once it runs dry, it steals from the back of the other queues.
+  */
+  class thread_pool {
+  public:
+
+    //tasks are given the index of the worker running them
+    typedef boost::function<void (unsigned int)> task;
+
+    //Starts the given number of threads (or one per hardware thread if 0).
+    thread_pool(unsigned int num_threads = 0);
+    ~thread_pool();
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+    //Keeps a worker on the given CPUs. Returns false if its affinity couldn't be set.
+    bool pin_worker(unsigned int worker_id, const std::vector<unsigned int> &cpus);
+
+    //Runs all the given tasks, returning once they've finished. Tasks are queued in order, so earlier
+    //tasks tend to start first. If a task throws, the first exception is rethrown here.
+    void run(const std::vector<task> &tasks);
+
+  private:
+
+    struct worker_queue {
+      std::mutex lock;
+      std::deque<task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<worker_queue>> queues;
+
+    std::mutex batch_lock;
+    std::condition_variable batch_start, batch_done;
+    unsigned int batch_id, num_pending;
+    bool shutdown;
+    std::exception_ptr error;
+
+    void worker_loop(unsigned int worker_id);
+    bool next_task(unsigned int worker_id, /* out */ task &t);
+    
+  };
+
+};
+
+#endif
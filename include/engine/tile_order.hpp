@@ -0,0 +1,53 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef GD_TILE_ORDER_HPP
+#define GD_TILE_ORDER_HPP
+
+#include <vector>
+#include <cstdint>
+
+namespace gideon {
+
+  /* Orders in which the tiles of a frame can be rendered. */
+  enum tile_order { TILES_ROW_MAJOR, TILES_HILBERT, TILES_SPIRAL };
+
+  //Returns the indices (y*num_x + x) of a num_x by num_y grid of tiles, in the order they should be rendered.
+  //Hilbert and spiral orders keep consecutive tiles next to each other, so tiles rendered at the same time
+  //tend to touch the same BVH nodes, geometry and textures.
+  std::vector<int> tile_sequence(tile_order order, int num_x, int num_y);
+
+  //Position of (x, y) along a Hilbert curve filling an n by n grid (n must be a power of two).
+  uint32_t hilbert_index(uint32_t n, uint32_t x, uint32_t y);
+
+  //Position of (x, y) along a Morton (Z-order) curve.
+  uint32_t morton_index(uint32_t x, uint32_t y);
+
+  //Fills 'pixels' with the pixels of a width by height tile in Morton order, each packed as (y << 16) | x.
+  void morton_pixel_order(int width, int height, /* out */ std::vector<uint32_t> &pixels);
+
+  //Picks a square tile size for rendering a width by height frame on the given number of threads,
+  //keeping tiles small enough that each thread gets several of them.
+  int auto_tile_size(int width, int height, unsigned int num_threads);
+
+};
+
+#endif
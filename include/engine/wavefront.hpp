@@ -0,0 +1,114 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef GD_WAVEFRONT_HPP
+#define GD_WAVEFRONT_HPP
+
+#include "geometry/ray.hpp"
+#include "scene/scene.hpp"
+#include "scene/bvh.hpp"
+
+#include <vector>
+
+namespace gideon {
+
+  /*
+    A batch of paths for wavefront (breadth-first) path tracing.
+    Rather than following each path to its end before starting the next, a kernel adds a whole batch of
+    paths, then runs each stage of its integrator over all of them: tracing every path's ray, shading the
+    hits (sorted so paths hitting the same material are shaded together), and tracing the shadow rays
+    queued by the shading stage as a separate any-hit stream.
+  */
+  class wavefront_queue {
+  public:
+
+    struct path {
+      raytrace::ray r;
+      raytrace::intersection hit;
+      raytrace::float4 throughput, radiance;
+      float bsdf_pdf; //set by the kernel for weighting emission the next ray hits (zero for camera rays)
+      raytrace::float3 light_normal; //normal lights were picked with at the vertex the current ray left from
+      int x, y; //pixel in the current tile
+      int sample; //which of its pixel's samples (counted across passes) this path is, for keying random numbers
+      int depth; //number of bounces so far
+      bool active;
+    };
+
+    //Removes all paths and shadow rays.
+    void clear();
+
+    //Adds a new path starting with the given ray, for the given sample of a pixel. Returns the path's ID.
+    int add_path(const raytrace::ray &r, int x, int y, int sample);
+
+    //Traces the ray of every active path, ending the paths that don't hit anything.
+    //Returns the number of paths still active.
+    int trace(const raytrace::bvh &accel);
+
+    //Paths ended by the last call to trace, e.g. for adding the light from the environment.
+    int num_missed() const { return static_cast<int>(missed.size()); }
+    int missed_path(int i) const { return missed[i]; }
+
+    //Orders the active paths by the shader of the surface they hit.
+    void sort_by_shader(const raytrace::scene &s);
+
+    int num_paths() const { return static_cast<int>(paths.size()); }
+    int num_active() const { return static_cast<int>(active.size()); }
+
+    //ID of the i'th active path (in shading order).
+    int active_path(int i) const { return active[i]; }
+
+    path &get(int id) { return paths[id]; }
+
+    //Continues a path with a new ray (traced on the next call to trace).
+    void continue_path(int id, const raytrace::ray &r);
+
+    //Ends a path, keeping the radiance it has gathered so far.
+    void end_path(int id) { paths[id].active = false; }
+
+    //Queues a shadow ray for a path, whose radiance is increased by L if the ray isn't blocked.
+    void add_shadow_ray(int id, const raytrace::ray &r, const raytrace::float4 &L);
+
+    //Traces all queued shadow rays as one batch of any-hit queries (reordered like the paths' rays), then clears the queue.
+    void trace_shadows(const raytrace::bvh &accel);
+
+  private:
+
+    struct shadow_ray {
+      raytrace::ray r;
+      raytrace::float4 L;
+      int path;
+    };
+
+    std::vector<path> paths;
+    std::vector<int> active; //IDs of the active paths, in the order they should be shaded
+    std::vector<int> missed;
+    std::vector<shadow_ray> shadow_rays;
+
+    //scratch space for tracing the active paths as one batch
+    std::vector<raytrace::ray> batch_rays;
+    std::vector<raytrace::intersection> batch_hits;
+    std::vector<char> batch_occluded;
+
+  };
+
+};
+
+#endif
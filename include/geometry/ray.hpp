@@ -38,6 +38,7 @@ namespace raytrace {
   struct intersection {
     float t, u, v;
     int prim_idx;
+    float3 N; //geometric normal, only set for primitives whose normal depends on the ray (strands)
   };
   
 };
@@ -0,0 +1,59 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RT_STRAND_HPP
+#define RT_STRAND_HPP
+
+#include "math/vector.hpp"
+#include "geometry/ray.hpp"
+#include "geometry/aabb.hpp"
+
+namespace raytrace {
+
+  /*
+    Strand segments run between two control points, each storing its radius in the w component.
+    Long segments may be split into pieces, each covering the segment parameter range [t0, t1].
+  */
+
+  /* Ray Intersection */
+
+  //Intersects a ray with a piece of a strand segment, treated as a ribbon facing the ray.
+  //On a hit, u is the parameter along the segment, v runs across the ribbon (0 to 1) and N is the
+  //normal of the equivalent round tube at the hit point.
+  bool ray_strand_intersection(const float4 &p0, const float4 &p1, float t0, float t1,
+			       const ray &r, /* out */ intersection &isect);
+
+  /* Bounding Box */
+
+  aabb compute_strand_bbox(const float4 &p0, const float4 &p1, float t0, float t1);
+
+  //Returns the number of pieces a segment should be split into to keep its bounding boxes tight.
+  int strand_split_count(const float4 &p0, const float4 &p1);
+
+  /* Strand Differential Geometry */
+
+  //Computes the derivatives along the segment (u) and across the ribbon (v), given the shading normal.
+  void compute_strand_dP(const float4 &p0, const float4 &p1, float u, const float3 &N,
+			 /* out */ float3 &dPdu, /* out */ float3 &dPdv);
+  
+};
+
+#endif
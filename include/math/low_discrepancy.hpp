@@ -0,0 +1,68 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RT_LOW_DISCREPANCY_HPP
+#define RT_LOW_DISCREPANCY_HPP
+
+#include <cstdint>
+
+namespace raytrace {
+
+  /* 
+     Low-discrepancy sequences with Owen scrambling. Scrambling is keyed by a seed (e.g. a hash of the pixel
+     and dimension), so each pixel sees an independent, but still well-stratified, set of points.
+  */
+
+  //Dimensions with their own Sobol direction numbers (Joe & Kuo). Higher dimensions reuse them with a different scramble.
+  const unsigned int sobol_dimensions = 53;
+
+  //Dimensions with their own Halton base (the first primes). Higher dimensions reuse them with a different scramble.
+  const unsigned int halton_dimensions = 64;
+
+  //Returns the unscrambled 32-bit fixed-point value of a point of the Sobol sequence.
+  uint32_t sobol_bits(uint32_t index, unsigned int dim);
+
+  //Nested uniform (Owen) scramble of the binary digits of v, using the Laine-Karras style hash from
+  //"Practical Hash-based Owen Scrambling" (Burley 2020).
+  uint32_t owen_scramble(uint32_t v, uint32_t seed);
+
+  float sobol_owen(uint32_t index, unsigned int dim, uint32_t seed);
+
+  //Scrambles a value returned by sobol_bits (for callers that combine unscrambled points themselves).
+  float sobol_owen_bits(uint32_t bits, unsigned int dim, uint32_t seed);
+
+  //Radical inverse of the index in the dimension's prime base, with each digit permuted based on the digits
+  //before it (a hashed random digit shift per node of the Owen tree).
+  float halton_owen(uint32_t index, unsigned int dim, uint32_t seed);
+
+  /* Blue noise and rank-1 lattices, for spreading error as blue noise across the image. */
+
+  const unsigned int blue_noise_size = 64;
+
+  //Returns the 32-bit fixed-point value of a texel of a tileable blue-noise mask (built by void-and-cluster on first use).
+  uint32_t blue_noise_bits(unsigned int x, unsigned int y);
+
+  //Step of dimension j of the 'dims'-dimensional R_d lattice (the generalized golden ratio), in 32-bit fixed point.
+  uint32_t lattice_step_bits(unsigned int dims, unsigned int j);
+  
+};
+
+#endif
@@ -24,9 +24,43 @@
 
 #include <random>
 #include <functional>
+#include <cstdint>
 
 namespace raytrace {
 
+  /* 
+     Counter-based random numbers. Each value is a pure function of its key (e.g. pixel, sample index
+     and dimension), so results don't depend on call order or on which thread computed them.
+  */
+
+  //PCG-based integer hash (from "Hash Functions for GPU Rendering", Jarzynski & Olano 2020).
+  inline uint32_t pcg_hash(uint32_t v) {
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+  }
+
+  inline uint32_t random_key(uint32_t x, uint32_t y, uint32_t sample, uint32_t dim) {
+    return pcg_hash(dim + pcg_hash(sample + pcg_hash(y + pcg_hash(x))));
+  }
+
+  //Maps 32 random bits to a float in [0, 1).
+  inline float random_unit_float(uint32_t bits) { return (bits >> 8) * (1.0f / 16777216.0f); }
+
+  inline float counter_random(uint32_t x, uint32_t y, uint32_t sample, uint32_t dim) {
+    return random_unit_float(random_key(x, y, sample, dim));
+  }
+
+  /* A stream of counter-based random numbers, starting from a given key. */
+  struct counter_rng {
+    uint32_t key, counter;
+
+    void seed(uint32_t k) { key = k; counter = 0; }
+
+    uint32_t next_uint() { return pcg_hash(key ^ pcg_hash(counter++)); }
+    float next() { return random_unit_float(next_uint()); }
+  };
+
   /* Class that generates a uniform random number in [0, 1). */
   class random_number_gen {
   public:
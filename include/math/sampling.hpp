@@ -23,9 +23,10 @@
 #define RT_SAMPLING_HPP
 
 #include "math/vector.hpp"
+#include "math/random.hpp"
 
 #include <vector>
-#include <boost/function.hpp>
+#include <string>
 
 namespace raytrace {
 
@@ -40,55 +41,119 @@ namespace raytrace {
 
   float3 uniform_sample_sphere(float rand_u, float rand_v);
 
-  /* A container for a generated sequence of samples. */
+  //Returns barycentric coordinates (of the second and third vertex) distributed uniformly over a triangle.
+  float2 uniform_sample_triangle(float rand_u, float rand_v);
+
+  /* 
+     Walker's alias method (as built by Vose): picks one of N items in proportion to their weights in constant time.
+     Item i is kept with probability 'prob[i]' and otherwise replaced with 'alias[i]'.
+  */
+  class alias_table {
+  public:
+
+    alias_table() : total_weight(0.0f) { }
+    alias_table(const std::vector<float> &weights);
+
+    //Returns the picked item (-1 if there are none, or all weights are zero) and its probability.
+    int sample(float rand_u, /* out */ float &pmf) const;
+    float pmf(int i) const { return (total_weight > 0.0f) ? weights[i] / total_weight : 0.0f; }
+
+    size_t size() const { return weights.size(); }
+    size_t memory() const { return (prob.capacity() + weights.capacity())*sizeof(float) + alias.capacity()*sizeof(int); }
+
+  private:
+
+    std::vector<float> prob, weights;
+    std::vector<int> alias;
+    float total_weight;
+  };
+
+  /* 
+     A container for a generated sequence of samples. The values of every sample set, for every sample of
+     the tile's pixels, are generated in one batch into a table, so reading a sample is a plain load.
+  */
   class sampler {
   public:
 
-    sampler();
+    sampler(unsigned int seed = 0);
     
     typedef unsigned int sample_id;
-    typedef boost::function<void (unsigned int, unsigned int, unsigned int, unsigned int, float *)> sample_generator;
+
+    /*
+      Sample generation strategies. A set of N points of 'dim' dimensions uses numbers index*N to
+      index*N + N-1 of the pixel's sequence, in the set's own dimensions. Image samples use dimensions
+      0 and 1 (with the pass as the index) and each added sample set gets the next dimensions (with the
+      pixel's sample number as the index).
+    */
+    enum sample_generator {
+      GENERATOR_UNIFORM,
+      GENERATOR_LHS,
+      GENERATOR_SOBOL, //Owen-scrambled per pixel
+      GENERATOR_HALTON, //Owen-scrambled per pixel
+      GENERATOR_BLUENOISE //R_d lattice, shifted by a blue-noise mask (offset per dimension)
+    };
     
-    sample_id add(unsigned int dim, unsigned int N, const sample_generator &generator);
+    sample_id add(unsigned int dim, unsigned int N, sample_generator generator);
     
-    void setup(unsigned int width, unsigned int height, unsigned int samples_per_pixel,
-	       const sample_generator &generator);
+    //Sets up the tile starting at (x0, y0). Random numbers are keyed by the pixel's position
+    //in the frame, so they don't depend on how the frame was split into tiles.
+    void setup(unsigned int x0, unsigned int y0,
+	       unsigned int width, unsigned int height, unsigned int samples_per_pixel,
+	       sample_generator generator);
     
     void next_sample(unsigned int x, unsigned int y,
 		     /* out */ float2 *image_sample);
 
+    //Sets the index of the current render pass. Each pass draws a different set of samples for every pixel,
+    //so a pixel can be refined over several passes (the pass is kept across calls to setup).
+    void set_pass(unsigned int pass) {
+      if (pass != current_pass) table_pixels = 0;
+      current_pass = pass;
+    }
+    unsigned int get_pass() const { return current_pass; }
+
+    //Position of the current tile in the frame.
+    unsigned int tile_x() const { return x0; }
+    unsigned int tile_y() const { return y0; }
+
     unsigned int get_offset(sample_id s) const;
 
-    float access_1d(unsigned int idx) const;
-    float2 access_2d(unsigned int idx) const;
+    float access_1d(unsigned int idx) const { return current_values[idx]; }
+    float2 access_2d(unsigned int idx) const { return float2{current_values[idx], current_values[idx+1]}; }
 
     float random();
     unsigned int random_uint();
 
-    //Sample Generation Strategies
-    
-    sample_generator uniform();
-    sample_generator latin_hypercube();
-    
+    //random() and random_uint() draw from a stream that's re-keyed by (pixel, sample index) on each call
+    //to next_sample, so any numbers drawn while rendering a sample are reproducible.
+
     sample_generator select_generator(const std::string &name);
 
+    //Largest table (in floats) generated for a whole tile at once. Bigger tiles are generated a pixel at a time.
+    static const size_t max_table_size = 1 << 20;
+
   private:
 
-    boost::function<float ()> rng;
+    counter_rng stream;
+    unsigned int x0, y0;
     unsigned int width, height, samples_per_pixel;
 
     unsigned int current_x, current_y;
     unsigned int current_pixel_sample;
-    
-    std::vector<unsigned int> sample_offset, sample_dimensions;
+    unsigned int current_pass;
 
-    std::vector<float> sample_values;
-    std::vector<float> image_samples;
-    
+    //each sample's values are laid out as the image sample followed by every set, 'sample_stride' floats in all
+    std::vector<unsigned int> sample_offset, sample_dimensions, sample_count, sample_first_dim;
     std::vector<sample_generator> sample_generators;
     sample_generator image_sample_generator;
+    unsigned int sample_stride, next_dim;
+
+    //values for pixels [table_first_pixel, table_first_pixel + table_pixels) of the tile (row-major)
+    std::vector<float> table;
+    unsigned int table_first_pixel, table_pixels;
+    const float *current_values;
     
-    void prepare_samples(unsigned int x, unsigned int y);
+    void fill_table(unsigned int first_pixel, unsigned int num_pixels);
   };
 
 };
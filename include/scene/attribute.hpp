@@ -62,6 +62,9 @@ namespace raytrace {
     template<typename T>
     T *data(int i) { return reinterpret_cast<T*>(&buffer[i*items_per_element()*type.size()]); }
 
+    //Returns the number of bytes used by this attribute.
+    size_t memory_usage() const { return sizeof(attribute) + buffer.capacity(); }
+
   private:
     
     std::vector<char> buffer;
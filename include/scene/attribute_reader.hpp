@@ -29,19 +29,19 @@ namespace raytrace {
   /* Reads a per-vertex attribute over the surface of a triangle. */
   template<typename T>
   T triangle_get_attribute(attribute *attr,
-			   const primitive &prim, const object_ptr &obj,
+			   const primitive &prim, const object &obj,
 			   const scene &active_scene,
 			   const float4 &coords) {
     T *c0, *c1, *c2;
 
     if (attr->element == attribute::PER_VERTEX) {
-      const int3 &verts = active_scene.triangle_verts[prim.data_id];
-      c0 = attr->data<T>(verts.x - obj->vert_range.x);
-      c1 = attr->data<T>(verts.y - obj->vert_range.x);
-      c2 = attr->data<T>(verts.z - obj->vert_range.x);
+      int3 verts = active_scene.triangle_vertex_ids(prim.data_id);
+      c0 = attr->data<T>(verts.x - obj.vert_range.x);
+      c1 = attr->data<T>(verts.y - obj.vert_range.x);
+      c2 = attr->data<T>(verts.z - obj.vert_range.x);
     }
     else {
-      T *val = attr->data<T>(prim.data_id - obj->tri_range.x);
+      T *val = attr->data<T>(prim.data_id - obj.tri_range.x);
       c0 = val;
       c1 = val + 1;
       c2 = val + 2;
@@ -54,20 +54,20 @@ namespace raytrace {
   /* Same as normal get_attribute, except this includes derivatives. */
   template<typename T>
   T triangle_get_attribute_deriv(attribute *attr,
-				 const primitive &prim, const object_ptr &obj,
+				 const primitive &prim, const object &obj,
 				 const scene &active_scene,
 				 const float4 &coords,
 				 /* out */ T &du, /* out */ T &dv) {
     T *c0, *c1, *c2;
 
     if (attr->element == attribute::PER_VERTEX) {
-      const int3 &verts = active_scene.triangle_verts[prim.data_id];
-      c0 = attr->data<T>(verts.x - obj->vert_range.x);
-      c1 = attr->data<T>(verts.y - obj->vert_range.x);
-      c2 = attr->data<T>(verts.z - obj->vert_range.x);
+      int3 verts = active_scene.triangle_vertex_ids(prim.data_id);
+      c0 = attr->data<T>(verts.x - obj.vert_range.x);
+      c1 = attr->data<T>(verts.y - obj.vert_range.x);
+      c2 = attr->data<T>(verts.z - obj.vert_range.x);
     }
     else {
-      T *val = attr->data<T>(prim.data_id - obj->tri_range.x);
+      T *val = attr->data<T>(prim.data_id - obj.tri_range.x);
       c0 = val;
       c1 = val + 1;
       c2 = val + 2;
@@ -80,45 +80,87 @@ namespace raytrace {
     return coords[0]*(*c1) + coords[1]*(*c2) + inv*(*c0);
   }
   
+  /* Reads a per-vertex attribute along a strand segment (coords[0] is the position along the segment). */
+  template<typename T>
+  T strand_get_attribute_deriv(attribute *attr,
+			       const primitive &prim, const object &obj,
+			       const scene &active_scene,
+			       const float4 &coords,
+			       /* out */ T &du, /* out */ T &dv) {
+    int point = active_scene.strand_segments[prim.data_id].point - obj.vert_range.x;
+    T *c0 = attr->data<T>(point);
+    T *c1 = attr->data<T>(point + 1);
+
+    du = *c1 - *c0;
+    dv = *c0 - *c0; //attributes don't vary across the ribbon
+    return (1.0f - coords[0])*(*c0) + coords[0]*(*c1);
+  }
+
+  /* Index of a primitive's value in a per-primitive attribute (strands have one value per strand). */
+  inline int primitive_attribute_index(const primitive &prim, const object &obj, const scene &active_scene) {
+    if (prim.type == primitive::PRIM_STRAND) return active_scene.strand_segments[prim.data_id].strand;
+    return prim.id - obj.prim_range.x;
+  }
+  
   /* Reads an attribute from a primitive. Returns false is no valid attribute can be found. */
   template<typename T>
   bool primitive_get_attribute(const primitive &prim, const scene &active_scene,
-			       const std::string &attr_name, const float4 &coords,
+			       int attr_handle, const float4 &coords,
 			       /* out */ T &result) {
-    object_ptr obj = active_scene.objects[prim.object_id];
+    const object &obj = active_scene.get_object(prim.object_id);
 
-    auto attr_it = obj->attributes.find(attr_name);
-    if (attr_it == obj->attributes.end()) return false; //no attribute with this name
-    
-    attribute *attr = attr_it->second;
+    attribute *attr = obj.get_attribute(attr_handle);
+    if (!attr) return false; //no attribute with this handle
     if (get_attribute_type<T>() != attr->type) return false; //type mismatch
 
     if (attr->element == attribute::PER_OBJECT) result = *(attr->data<T>(0));
-    else if (attr->element == attribute::PER_PRIMITIVE) result = *(attr->data<T>(prim.id - obj->prim_range.x));
+    else if (attr->element == attribute::PER_PRIMITIVE) result = *(attr->data<T>(primitive_attribute_index(prim, obj, active_scene)));
     else if (prim.type == primitive::PRIM_TRIANGLE) result = triangle_get_attribute<T>(attr, prim, obj, active_scene, coords);
+    else if (prim.type == primitive::PRIM_STRAND && attr->element == attribute::PER_VERTEX) {
+      T du, dv;
+      result = strand_get_attribute_deriv<T>(attr, prim, obj, active_scene, coords, du, dv);
+    }
+    else return false; //strands have no per-corner data
     
     return true;
   }
 
+  template<typename T>
+  bool primitive_get_attribute(const primitive &prim, const scene &active_scene,
+			       const char *attr_name, const float4 &coords,
+			       /* out */ T &result) {
+    return primitive_get_attribute<T>(prim, active_scene, active_scene.find_attribute_handle(attr_name), coords, result);
+  }
+
   template<typename T>
   bool primitive_get_attribute_deriv(const primitive &prim, const scene &active_scene,
-				     const std::string &attr_name, const float4 &coords,
+				     int attr_handle, const float4 &coords,
 				     /* out */ T &result, /* out */ T &du, /* out */ T &dv) {
-    object_ptr obj = active_scene.objects[prim.object_id];
+    const object &obj = active_scene.get_object(prim.object_id);
     
-    auto attr_it = obj->attributes.find(attr_name);
-    if (attr_it == obj->attributes.end()) return false; //no attribute with this name
-    
-    attribute *attr = attr_it->second;
+    attribute *attr = obj.get_attribute(attr_handle);
+    if (!attr) return false; //no attribute with this handle
     if (get_attribute_type<T>() != attr->type) return false; //type mismatch
 
     if (attr->element == attribute::PER_OBJECT) result = *(attr->data<T>(0));
-    else if (attr->element == attribute::PER_PRIMITIVE) result = *(attr->data<T>(prim.id - obj->prim_range.x));
+    else if (attr->element == attribute::PER_PRIMITIVE) result = *(attr->data<T>(primitive_attribute_index(prim, obj, active_scene)));
     else if (prim.type == primitive::PRIM_TRIANGLE) result = triangle_get_attribute_deriv<T>(attr, prim, obj, active_scene, coords, du, dv);
+    else if (prim.type == primitive::PRIM_STRAND && attr->element == attribute::PER_VERTEX) {
+      result = strand_get_attribute_deriv<T>(attr, prim, obj, active_scene, coords, du, dv);
+    }
+    else return false; //strands have no per-corner data
     
     return true;
   }
 
+  template<typename T>
+  bool primitive_get_attribute_deriv(const primitive &prim, const scene &active_scene,
+				     const char *attr_name, const float4 &coords,
+				     /* out */ T &result, /* out */ T &du, /* out */ T &dv) {
+    return primitive_get_attribute_deriv<T>(prim, active_scene, active_scene.find_attribute_handle(attr_name), coords,
+					    result, du, dv);
+  }
+
 };
 
 #endif
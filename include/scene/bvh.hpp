@@ -27,6 +27,7 @@
 #include "scene/scene.hpp"
 
 #include <vector>
+#include <boost/function.hpp>
 
 namespace raytrace {  
 
@@ -44,34 +45,81 @@ namespace raytrace {
 	const std::vector<node> &node_list,
 	const std::vector<int> &leaf_prim_list);
     
+    //Makes a separate copy of the tree (its memory is placed near the thread doing the copying).
+    bvh(const bvh &other);
     ~bvh();
+
+    bvh &operator=(const bvh &) = delete;
+
+    //Points the tree at another scene with identical geometry (e.g. after only its camera, lights or shaders changed).
+    void set_scene(const scene &s) { active_scene = &s; }
     
     bool trace(const ray &r,
 	       /* out */ intersection &isect,
 	       /* out */ unsigned int &aabb_checked,
 	       /* out */ unsigned int &prim_checked) const;
 
+    //Returns true if the ray hits anything between its min and max distance (stopping at the first hit found).
+    bool trace_any(const ray &r) const;
+
+    //Traces n rays, writing each ray's closest hit to the matching entry of 'hits' (with prim_idx = -1 if it missed).
+    //The rays are traced ordered by direction octant and origin, so incoherent rays (like diffuse bounces)
+    //that travel through the same part of the tree are traced one after another. Returns the number of hits.
+    int trace_batch(const ray *rays, int n, /* out */ intersection *hits) const;
+
+    //Any-hit counterpart of trace_batch: sets occluded[i] to 1 if the i'th ray hits anything (0 otherwise), tracing
+    //the rays in the same order. Returns the number of occluded rays.
+    int trace_any_batch(const ray *rays, int n, /* out */ char *occluded) const;
+
     void debug_print() const;
+
+    //Calls the given function with the primitive list of each leaf, in depth-first order.
+    void foreach_leaf(const boost::function<void (const int *, int)> &on_leaf) const;
+
+    //Memory usage (in bytes) of the node array and the leaf primitive list.
+    size_t node_memory() const { return num_nodes * sizeof(node); }
+    size_t leaf_memory() const { return num_leaf_entries * sizeof(int); }
+
+    //Raw node and leaf arrays (for controlling their memory placement).
+    const node *node_data() const { return nodes; }
+    const int *leaf_data() const { return leaf_array; }
     
   private:
 
     const scene *active_scene; //for accessing primitives
 
-    unsigned int num_nodes;
+    unsigned int num_nodes, num_leaf_entries;
     node *nodes; //array of nodes, root node is at 0
     int *leaf_array; //array containing the contents of each leaf
     
+    void batch_order(const ray *rays, int n, /* out */ std::vector<uint64_t> &order) const;
+
     void check_node(const node &n, int n_idx,
 		    const ray &r,
 		    /* inout */ float &closest_t, /* inout */ intersection &isect,
 		    /* inout */ unsigned int &prim_checked,
 		    /* inout */ bool &hit_prim,
-		    /* inout */ size_t &stack_size) const;
+		    /* inout */ size_t &stack_size,
+		    /* inout */ geometry_pager::page_ptr &page) const;
 
+    //Recursive fallbacks for subtrees deeper than the traversal stack can hold.
+    void trace_subtree(int n_idx, const ray &r,
+		       /* inout */ float &closest_t, /* inout */ intersection &isect,
+		       /* inout */ unsigned int &prim_checked,
+		       /* inout */ bool &hit_prim,
+		       /* inout */ geometry_pager::page_ptr &page) const;
+    bool occluded_by_subtree(int n_idx, const ray &r,
+			     /* inout */ geometry_pager::page_ptr &page) const;
+
+    //'page' holds the last geometry page used by this ray (only used if the scene's geometry is paged)
     bool intersect_leaf(const node &leaf,
 			const ray &r,
 			/* inout */ float &closest_t, /* out */ intersection &isect,
-			/* inout */ unsigned int &prim_checked) const;
+			/* inout */ unsigned int &prim_checked,
+			/* inout */ geometry_pager::page_ptr &page) const;
+    
+    bool occluded_by_leaf(const node &leaf, const ray &r,
+			  /* inout */ geometry_pager::page_ptr &page) const;
     
     //use thread-local traversal stack so we can use this bvh in multiple threads
     static const size_t max_stack_depth = 256;
@@ -0,0 +1,105 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RT_EMITTERS_HPP
+#define RT_EMITTERS_HPP
+
+#include "scene/scene.hpp"
+#include "math/sampling.hpp"
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+
+namespace raytrace {
+
+  /* 
+     Area lights made of the scene's emissive triangles, picked in proportion to their power (area times the
+     brightness of their shader's emission) with an alias table.
+     Only running a shader tells whether it emits light, so the table starts out as a list of the scene's distinct
+     surface shaders: the kernel evaluates each one on a triangle using it, reports its emission, then builds the table.
+  */
+  class emitter_table {
+  public:
+
+    emitter_table(const scene &s);
+
+    //Distinct surface shaders of the scene's triangles, with a triangle (primitive ID) that uses each.
+    int num_shaders() const { return static_cast<int>(shaders.size()); }
+    void *shader(int i) const { return shaders[i]; }
+    int shader_primitive(int i) const { return shader_prims[i]; }
+
+    //Records the emitted color of a shader (zero if it doesn't emit).
+    void set_shader_emission(int i, const float4 &Le);
+
+    //Claims the job of finding the emissive shaders: returns true for exactly one caller, who must then report each
+    //shader's emission and call build. Other callers wait until the table is built and return false (or take over
+    //the claim, if the probe was given up). A scene without shaders is built right away.
+    bool begin_build(const scene &s);
+
+    //Collects the triangles of the shaders that emit light. Several threads may call this, only the first builds the table.
+    //If some shader's emission wasn't reported (the probe was cancelled), nothing is built and the claim is given back,
+    //so the next render probes the shaders again.
+    void build(const scene &s);
+    bool is_built() const { return built.load(std::memory_order_acquire); }
+
+    //Picks an emissive triangle (using rand_u) and a uniformly distributed point on it. Returns the triangle's primitive
+    //ID with the point, its geometric normal and its pdf with respect to area, or -1 if there are no emitters.
+    int sample(float rand_u, float rand_v, float rand_w,
+	       /* out */ float3 &P, /* out */ float3 &N, /* out */ float &pdf) const;
+
+    //Area pdf of sample() picking a point on the given primitive (zero if it doesn't emit).
+    float pdf(int prim_id) const;
+
+    int num_emitters() const { return static_cast<int>(emitters.size()); }
+    size_t memory() const;
+    
+  private:
+
+    struct emitter {
+      float3 P[3];
+      int prim_id;
+      float area;
+    };
+
+    std::vector<void*> shaders;
+    std::vector<int> shader_prims;
+    std::vector<float> shader_power; //brightness of each shader's emission
+    std::vector<char> shader_reported; //whether each shader's emission has been set
+
+    std::vector<emitter> emitters;
+    std::vector<int> prim_emitters; //emitter index of each primitive (-1 for those that don't emit)
+    alias_table table;
+
+    std::mutex build_lock;
+    std::condition_variable build_done;
+    bool building; //a thread has claimed the build (guarded by build_lock)
+    std::atomic<bool> built;
+
+    void build_locked(const scene &s);
+    
+  };
+
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RT_ENVIRONMENT_HPP
+#define RT_ENVIRONMENT_HPP
+
+#include "math/vector.hpp"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstddef>
+
+namespace raytrace {
+
+  /*
+    Light arriving from infinitely far away, stored as a lat-long image: the top row looks along +z and the
+    columns run around z, starting at +x. Directions are importance sampled in proportion to the image's
+    brightness (times the solid angle of each texel), using a 2D CDF built when the map is created.
+  */
+  class environment_map {
+  public:
+
+    //Takes the map's pixels (row-major, from the top row down). The CDF rows are built by several threads.
+    environment_map(int width, int height, std::vector<float3> &&pixels, const std::string &path = "");
+
+    //Loads a map with OpenImageIO, throwing a runtime_error if the image can't be read.
+    static std::shared_ptr<environment_map> load(const std::string &path);
+
+    //Radiance arriving from direction D (a unit vector).
+    float3 eval(const float3 &D) const;
+
+    //Picks a direction. Returns it with its pdf per unit solid angle (zero if the map is black).
+    float3 sample(float rand_u, float rand_v, /* out */ float &pdf) const;
+
+    //Pdf of sample() picking D.
+    float pdf(const float3 &D) const;
+
+    const std::string &source_path() const { return path; }
+    size_t memory() const;
+
+  private:
+
+    int width, height;
+    std::vector<float3> pixels;
+    std::string path;
+
+    //row_cdf holds each row's CDF over its columns (width + 1 entries per row), row_sums the total of each row
+    //and marginal_cdf the CDF over the rows
+    std::vector<float> row_cdf, row_sums, marginal_cdf;
+    float total;
+
+    void direction_texel(const float3 &D, /* out */ int &x, /* out */ int &y) const;
+    
+  };
+  
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RT_GEOMETRY_PAGER_HPP
+#define RT_GEOMETRY_PAGER_HPP
+
+#include "math/vector.hpp"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+namespace raytrace {
+
+  struct scene;
+  class bvh;
+
+  /* All per-vertex data needed to intersect and shade a single triangle. */
+  struct triangle_geometry {
+    int3 verts; //vertex indices (for reading per-vertex attributes)
+    float3 P[3];
+    float3 N[3];
+  };
+
+  /* 
+     Out-of-core storage for triangle geometry.
+     Triangles are written to a file in BVH leaf order, split into pages that never split a leaf,
+     so a ray visiting one subtree mostly touches a single page. Pages are read on demand and ones that
+     haven't been used lately are dropped once the resident size goes over budget.
+     Each page stores the vertices its triangles use once, with the triangles indexing into them.
+     The file is written a page at a time, but from a scene whose mesh is still in memory (the scene
+     releases it once paging is enabled), so the mesh must fit in memory while the pager is built.
+  */
+  class geometry_pager {
+  public:
+
+    struct page {
+      int id;
+      std::vector<int3> verts; //scene vertex indices of each triangle
+      std::vector<int3> local_verts; //indices into P and N of each triangle
+      std::vector<float3> P, N;
+
+      size_t bytes() const;
+    };
+    typedef std::shared_ptr<const page> page_ptr;
+
+    //Writes the scene's triangles (in the leaf order of the given BVH) to the file at 'path'.
+    static std::shared_ptr<geometry_pager> build(const scene &s, const bvh &accel,
+						 const std::string &path,
+						 size_t budget_bytes, size_t page_bytes = 256*1024);
+
+    ~geometry_pager();
+
+    //Returns the given triangle, loading its page if needed. 'pinned' keeps the page alive
+    //and is reused if the triangle is on the same page as the last lookup.
+    triangle_geometry get(int tri_id, /* inout */ page_ptr &pinned) const;
+
+    //Copies out a single triangle. Each thread keeps the last page it read pinned, so lookups for the same
+    //few triangles (like a hit's normal and attributes) don't go back to the page cache.
+    void read(int tri_id, /* out */ triangle_geometry &tri) const;
+
+    //Number of bytes held in memory (resident pages plus the page tables).
+    size_t memory_usage() const;
+
+    //Number of pages read from disk so far.
+    uint64_t page_faults() const;
+
+    //Pages are read from inside the kernel, where exceptions can't be thrown, so a page that can't be read
+    //is returned with all of its triangles collapsed to a point (which rays can't hit) and the error is kept here.
+    //Renders check this once the kernel returns.
+    bool failed() const { return read_failed.load(std::memory_order_acquire); }
+    std::string error() const;
+
+  private:
+
+    struct page_info {
+      int64_t offset;
+      int count, num_vertices;
+    };
+
+    geometry_pager(const std::string &path, size_t budget_bytes);
+
+    page_ptr acquire(int page_id) const;
+    bool read_page(const page_info &info, /* out */ page &p) const;
+    void evict() const;
+
+    std::string path;
+    int fd;
+    size_t budget;
+
+    std::vector<page_info> pages;
+    std::vector<int2> locations; //(page, slot) for each triangle
+
+    uint64_t serial; //tells pagers apart for each thread's pinned page
+
+    //Resident pages, one slot per page. Each slot is guarded by one of a few locks (picked by page ID), so threads
+    //looking up different pages rarely contend. Pages are evicted in CLOCK order: a lookup only marks its page
+    //as used, and the eviction sweep unmarks marked pages and drops the ones it finds still unmarked.
+    struct page_slot {
+      page_ptr resident;
+      bool referenced;
+
+      page_slot() : referenced(false) { }
+    };
+
+    static const int num_slot_locks = 64;
+    std::mutex &slot_lock(int page_id) const { return slot_locks[page_id % num_slot_locks]; }
+    
+    mutable std::vector<page_slot> slots;
+    mutable std::mutex slot_locks[num_slot_locks];
+
+    mutable std::mutex evict_lock; //held by the thread running an eviction sweep
+    mutable size_t clock_hand; //guarded by evict_lock
+    
+    mutable std::atomic<size_t> resident_bytes;
+    mutable std::atomic<int> resident_pages;
+    mutable std::atomic<uint64_t> num_faults;
+
+    mutable std::atomic<bool> read_failed;
+    mutable std::mutex error_lock;
+    mutable std::string read_error; //guarded by error_lock
+
+  };
+
+};
+
+#endif
@@ -26,15 +26,22 @@
 
 namespace raytrace {
   
+  class environment_map;
+  
   struct point_light_data {
     float3 position;
     float radius;
   };
 
+  struct environment_light_data {
+    const environment_map *map; //owned by the scene
+  };
+
   struct light {
-    enum { POINT } type;
+    enum { POINT, ENVIRONMENT } type;
     union {
       point_light_data point;
+      environment_light_data environment;
     };
   
     float energy;
@@ -0,0 +1,95 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RT_LIGHT_TREE_HPP
+#define RT_LIGHT_TREE_HPP
+
+#include "scene/light.hpp"
+#include "geometry/aabb.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace raytrace {
+
+  /* 
+     A hierarchy over a scene's lights, for picking one light out of many in proportion to its estimated
+     contribution to a shading point ("Importance Sampling of Many Lights with Adaptive Tree Splitting",
+     Conty Estevez & Kulla 2018). Each node bounds its lights' positions, total power and emission directions.
+     Infinite lights (environment maps) have no position to bound, so they're kept outside the tree and each picked
+     with the same probability as the whole tree.
+  */
+  class light_tree {
+  public:
+
+    /* Bounds the directions light is emitted in: a cone around 'axis', widened by theta_e (e.g. 90 degrees for area lights). */
+    struct direction_cone {
+      float3 axis;
+      float cos_theta_o, cos_theta_e;
+
+      static direction_cone sphere();
+      direction_cone merge(const direction_cone &rhs) const;
+    };
+    
+    struct node {
+      aabb bounds;
+      float3 center; //of the bounds, with the squared radius of their bounding sphere
+      float radius2;
+      direction_cone cone;
+      float power;
+      int parent;
+      int light_id; //light of a leaf, -1 for inner nodes (whose children are the next node and 'right')
+      int right;
+    };
+
+    light_tree(const std::vector<light> &lights);
+
+    //Picks a light for the shading point P with normal N (a zero normal if light may arrive from any side), using the
+    //uniform random number u. Returns the light's index and the probability of picking it, or -1 if no light can contribute.
+    int sample(const float3 &P, const float3 &N, float u,
+	       /* out */ float &pdf) const;
+
+    //Returns the probability that sample() picks the given light.
+    float pdf(const float3 &P, const float3 &N, int light_id) const;
+
+    //Indices of the lights outside the tree.
+    const std::vector<int> &infinite() const { return infinite_lights; }
+
+    size_t memory() const { return nodes.capacity()*sizeof(node) + (light_leaves.capacity() + infinite_lights.capacity())*sizeof(int); }
+    
+  private:
+
+    std::vector<node> nodes;
+    std::vector<int> light_leaves; //leaf node of each light, -1 for infinite lights
+    std::vector<int> infinite_lights;
+
+    float tree_probability(const float3 &P, const float3 &N) const; //of picking a light from the tree rather than an infinite light
+
+    int build(std::vector<int> &light_ids, int begin, int end, int parent,
+	      const std::vector<node> &leaves);
+    void set_bounds(node &n, const aabb &bounds);
+    float importance(const node &n, const float3 &P, const float3 &N) const; //expects a unit (or zero) normal
+    
+  };
+  
+};
+
+#endif
@@ -39,6 +39,18 @@ namespace raytrace {
     
     int2 vert_range, prim_range, tri_range;
     std::map<std::string, attribute*> attributes;
+
+    //flat table of this object's attributes, indexed by the scene's attribute handles
+    std::vector<attribute*> attribute_table;
+
+    //Adds an attribute (taking ownership), replacing any existing attribute with the same name.
+    void set_attribute(const std::string &name, int handle, attribute *attr);
+
+    //Returns the attribute with the given handle, or NULL if this object doesn't have one.
+    attribute *get_attribute(int handle) const {
+      if (handle < 0 || handle >= static_cast<int>(attribute_table.size())) return NULL;
+      return attribute_table[handle];
+    }
   };
 
   typedef std::shared_ptr<object> object_ptr;
@@ -55,6 +55,7 @@ namespace raytrace {
 
   aabb primitive_bbox(const primitive &prim, const scene &active_scene);
 
+  //Strands return a zero vector (their normal depends on the ray, and is stored in the intersection).
   float3 primitive_geometry_normal(const primitive &prim, const scene &active_scene);
 
   int3 primitive_get_attribute_id_per_vertex(const primitive &prim, const scene &active_scene);
@@ -23,22 +23,101 @@
 #define RT_SCENE_HPP
 
 #include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include <boost/unordered_map.hpp>
 
 #include "math/vector.hpp"
 #include "scene/primitive.hpp"
 #include "scene/object.hpp"
 #include "scene/camera.hpp"
 #include "scene/light.hpp"
+#include "scene/environment.hpp"
+#include "scene/geometry_pager.hpp"
 
 #include "shading/distribution.hpp"
 
 namespace raytrace {
 
+  /* Hash/equality functions for attribute names, allowing lookups with a plain C string. */
+  struct attribute_name_hash {
+    size_t operator()(const char *name) const;
+    size_t operator()(const std::string &name) const { return (*this)(name.c_str()); }
+  };
+
+  struct attribute_name_equal {
+    bool operator()(const std::string &lhs, const std::string &rhs) const { return lhs == rhs; }
+    bool operator()(const char *lhs, const std::string &rhs) const { return rhs.compare(lhs) == 0; }
+    bool operator()(const std::string &lhs, const char *rhs) const { return lhs.compare(rhs) == 0; }
+  };
+
+  /* A piece of a strand segment, running between control points 'point' and 'point'+1. */
+  struct strand_segment {
+    int point;
+    int strand; //index of the strand within its object
+    float t0, t1; //part of the segment covered by this piece
+  };
+
+  /* Content hashes of the parts of a scene, for telling what changed between two versions of it (laid out for use from the C API). */
+  struct scene_hashes {
+    uint64_t geometry; //everything the BVH depends on: mesh and strand data and the primitive list (not shaders)
+    uint64_t camera;
+    uint64_t lights;
+    uint64_t materials; //the surface and volume shader of each primitive
+  };
+
   /* Holds all geometry data for a scene. */
   struct scene {
+    typedef boost::unordered_map<std::string, int,
+				 attribute_name_hash, attribute_name_equal> attribute_handle_table;
+
     //clears all primitives, objects and lights in this scene
     void clear();
 
+    //Returns the integer handle for an attribute name, creating a new one if needed.
+    int get_attribute_handle(const std::string &name);
+
+    //Returns the handle of an existing attribute name, or -1 if no object has used it.
+    int find_attribute_handle(const char *name) const;
+
+    //Adds an attribute to an object (taking ownership of it).
+    void add_attribute(int object_id, const std::string &name, attribute *attr);
+
+    //Adds the segments of a strand whose control points are already in strand_points, splitting long
+    //segments so their bounding boxes stay tight.
+    void add_strand_segments(int object_id, int strand, int first_point, int num_points,
+			     void *shader_id, void *volume_id, bool split = true);
+
+    //Memory usage (in bytes) of the scene's mesh data, primitive/object lists and attributes.
+    size_t geometry_memory() const;
+    size_t primitive_memory() const;
+    size_t attribute_memory() const;
+
+    //Hashes the contents of each part of the scene. Paged geometry is only hashed by its pager's identity.
+    scene_hashes content_hashes() const;
+    uint64_t geometry_hash() const;
+    uint64_t lights_hash() const;
+    uint64_t materials_hash() const;
+
+    //Non-owning access to an object, for use on read paths (avoids copying the shared pointer).
+    const object &get_object(int object_id) const { return *objects[object_id]; }
+
+    //Moves the mesh data into the given pager, freeing the in-memory copies (no more meshes may be added).
+    void set_geometry_pager(const std::shared_ptr<geometry_pager> &p);
+
+    //Accessors for triangle data that work whether or not the geometry is paged.
+    int3 triangle_vertex_ids(int tri_id) const {
+      if (!pager) return triangle_verts[tri_id];
+
+      triangle_geometry tri;
+      pager->read(tri_id, tri);
+      return tri.verts;
+    }
+    
+    void get_triangle(int tri_id, /* out */ triangle_geometry &tri) const;
+
     //camera
     camera main_camera;
     int2 resolution;
@@ -46,6 +125,13 @@ namespace raytrace {
     //mesh geometry data
     std::vector<float3> vertices, vertex_normals;
     std::vector<int3> triangle_verts;
+
+    //out-of-core storage for the mesh data (if set, the arrays above are empty)
+    std::shared_ptr<geometry_pager> pager;
+
+    //strand geometry data (control points store their radius in w)
+    std::vector<float4> strand_points;
+    std::vector<strand_segment> strand_segments;
     
     //primitive list
     std::vector<primitive> primitives;
@@ -53,6 +139,10 @@ namespace raytrace {
 
     //lights
     std::vector<light> lights;
+    std::vector<std::shared_ptr<environment_map>> environment_maps; //images used by the environment lights
+
+    //maps attribute names to their handles (shared by all objects)
+    attribute_handle_table attribute_handles;
   };
 
 };
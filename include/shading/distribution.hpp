@@ -26,17 +26,83 @@
 
 #include <boost/unordered_map.hpp>
 #include <boost/variant.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cassert>
 
 namespace raytrace {
   
   namespace shade_tree {
 
     typedef uint64_t shader_flags;
+
+    /*
+      Shade trees are built and thrown away at every shading point, so their nodes come from a bump allocator
+      owned by the thread building them rather than the heap. Nodes count their references without atomics (a tree
+      belongs to the thread that built it), and the arena starts over from its first chunk as soon as all of its
+      nodes are gone, which in a kernel's sample loop happens after every sample. A kernel that keeps a tree
+      alive for longer stops the arena from starting over, so past a size limit nodes go back to the heap.
+    */
+    struct local_arena_holder;
     
-    struct leaf {
+    class arena {
+    public:
+
+      //Returns the calling thread's arena.
+      static arena &local();
+
+      //Returns 16-byte aligned memory, valid until it's given back with release (or NULL if the arena is full).
+      void *allocate(size_t bytes);
+
+      //Gives back one allocation. Once there are none left, the arena's memory is reused from the start
+      //(or freed, if its thread has already exited).
+      void release() {
+	if (--live > 0) return;
+	if (orphaned) delete this;
+	else current = offset = 0;
+      }
+
+      size_t capacity() const;
+
+      //True if the calling thread may release this arena's nodes: it's the thread's own arena, or its thread has exited.
+      bool releasable_here() const;
+      
+    private:
+
+      static const size_t chunk_size = 64 * 1024;
+      static const size_t max_capacity = 16 * 1024 * 1024;
+
+      struct chunk {
+	std::unique_ptr<char[]> data;
+	size_t size;
+      };
+      
+      std::vector<chunk> chunks;
+      size_t current, offset; //bump position in chunks[current]
+      int live; //allocations not released yet
+      bool orphaned; //set when the owning thread exits with allocations still live
+
+      arena() : current(0), offset(0), live(0), orphaned(false) { }
+      bool next_chunk(size_t bytes);
+
+      friend struct local_arena_holder;
+      
+    };
+
+    //Reference count and owner shared by every kind of node.
+    struct node_base {
+      int refs;
+      arena *owner; //NULL for nodes allocated on the heap
+
+      node_base() : refs(0), owner(nullptr) { }
+    };
+    
+    struct leaf : public node_base {
     public:
       
       typedef void (*eval_func_type)(const void*,
@@ -54,7 +120,8 @@ namespace raytrace {
 
       typedef void (*dtor_func_type)(void*);
 
-      leaf(char *p, shader_flags flags,
+      //Leaves are created by make_leaf, which leaves room for the parameters right after the node.
+      leaf(size_t param_size, shader_flags flags,
 	   eval_func_type eval, sample_func_type sample,
 	   pdf_func_type pdf, emission_func_type emit,
 	   dtor_func_type dtor);
@@ -74,10 +141,12 @@ namespace raytrace {
       void emission(float3 *P_out, float3 *w_out, /* out */ float4 *Le) const;
 
       shader_flags get_flags() const { return flags; }
+      char *param_data() const { return params; }
 
     private: 
       
       char *params;
+      size_t param_size;
       eval_func_type evaluate_fn;
       sample_func_type sample_fn;
       pdf_func_type pdf_fn;
@@ -91,9 +160,9 @@ namespace raytrace {
     struct scale;
     struct sum;
     
-    typedef std::shared_ptr<leaf> leaf_ptr;
-    typedef std::shared_ptr<scale> scale_ptr;
-    typedef std::shared_ptr<sum> sum_ptr;
+    typedef boost::intrusive_ptr<leaf> leaf_ptr;
+    typedef boost::intrusive_ptr<scale> scale_ptr;
+    typedef boost::intrusive_ptr<sum> sum_ptr;
 
     typedef boost::variant<leaf_ptr,
 			   scale_ptr,
@@ -103,7 +172,7 @@ namespace raytrace {
     float get_weight(shader_flags flags, const node_ptr &node);
     shader_flags get_flags(const node_ptr &node);
     
-    struct scale {
+    struct scale : public node_base {
       float4 k;
       node_ptr node;
 
@@ -111,17 +180,31 @@ namespace raytrace {
       shader_flags flags;
 
       scale(const float4 &k, const node_ptr &node);
+      ~scale();
     };
     
-    struct sum {
+    struct sum : public node_base {
       node_ptr lhs, rhs;
 
       float weight;
       shader_flags flags;
 
       sum(const node_ptr &lhs, const node_ptr &rhs);
+      ~sum();
     };
 
+    //Create nodes in the calling thread's arena. make_leaf also returns the memory for the leaf's parameters.
+    leaf_ptr make_leaf(size_t param_size, shader_flags flags,
+		       leaf::eval_func_type eval, leaf::sample_func_type sample,
+		       leaf::pdf_func_type pdf, leaf::emission_func_type emit,
+		       leaf::dtor_func_type dtor,
+		       /* out */ char *&params);
+    scale_ptr make_scale(const float4 &k, const node_ptr &node);
+    sum_ptr make_sum(const node_ptr &lhs, const node_ptr &rhs);
+
+    //Returns the number of bytes currently allocated for shade tree nodes, summed over all threads.
+    int64_t allocated_bytes();
+
     void evaluate(node_ptr &node, shader_flags mask,
 		  float3 *P_in, float3 *w_in,
 		  float3 *P_out, float3 *w_out,
@@ -139,6 +222,23 @@ namespace raytrace {
     void emission(node_ptr &node, shader_flags mask,
 		  float3 *P_out, float3 *w_out,
 		  /* out */ float4 *Le);
+
+    /* Reference Counting (for boost::intrusive_ptr) */
+
+    template<typename T>
+    inline void release_node(T *n) {
+      if (--n->refs > 0) return;
+      arena *owner = n->owner;
+      assert(!owner || owner->releasable_here());
+      n->~T();
+      if (owner) owner->release();
+      else ::operator delete(n);
+    }
+    
+    inline void intrusive_ptr_add_ref(node_base *n) { ++n->refs; }
+    inline void intrusive_ptr_release(leaf *n) { release_node(n); }
+    inline void intrusive_ptr_release(scale *n) { release_node(n); }
+    inline void intrusive_ptr_release(sum *n) { release_node(n); }
     
   };
 };
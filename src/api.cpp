@@ -163,19 +163,14 @@ extern "C" float gde_scene_trace(ray *r, void *sptr) {
 extern "C" bool gde_isect_get_attribute3(intersection *i,
 					 sdata *name, scene_data *sdata,
 					 /* out */ float3 *color) {
-  string attr_name(name->data);
   scene *s = sdata->s;
-
   primitive &prim = s->primitives[i->prim_idx];
-  int3 &tri = s->triangle_verts[prim.data_id];
-  vector<float3> &verts = s->vertices;
 
-  int object_id = prim.object_id;
-  object_ptr obj = s->objects[object_id];
-  if (obj->attributes.find(attr_name) == obj->attributes.end()) return false;
+  const object &obj = s->get_object(prim.object_id);
+  attribute *attr = obj.get_attribute(s->find_attribute_handle(name->data));
+  if (!attr) return false;
 
-  int attr_id = prim.data_id - obj->tri_range.x;
-  attribute *attr = obj->attributes[attr_name];
+  int attr_id = prim.data_id - obj.tri_range.x;
   float3 *val = attr->data<float3>(attr_id);
 
   float inv = 1.0f - i->u - i->v;
@@ -186,19 +181,14 @@ extern "C" bool gde_isect_get_attribute3(intersection *i,
 extern "C" bool gde_isect_get_attribute2(intersection *i,
 					 sdata *name, scene_data *sdata,
 					 /* out */ float2 *color) {
-  string attr_name(name->data);
   scene *s = sdata->s;
-
   primitive &prim = s->primitives[i->prim_idx];
-  int3 &tri = s->triangle_verts[prim.data_id];
-  vector<float3> &verts = s->vertices;
 
-  int object_id = prim.object_id;
-  object_ptr obj = s->objects[object_id];
-  if (obj->attributes.find(attr_name) == obj->attributes.end()) return false;
+  const object &obj = s->get_object(prim.object_id);
+  attribute *attr = obj.get_attribute(s->find_attribute_handle(name->data));
+  if (!attr) return false;
 
-  int attr_id = prim.data_id - obj->tri_range.x;
-  attribute *attr = obj->attributes[attr_name];
+  int attr_id = prim.data_id - obj.tri_range.x;
   float2 *val = attr->data<float2>(attr_id);
 
   float inv = 1.0f - i->u - i->v;
@@ -253,9 +243,38 @@ extern "C" {
     ctx->set_scene(unique_ptr<scene>(reinterpret_cast<scene*>(scene_ptr)));
   }
 
-  void gd_api_context_build_bvh(void *ctx_ptr) {
+  //Returns a pointer to the context's scene, for editing it in place between renders (geometry may not be changed).
+  void *gd_api_context_get_scene(void *ctx_ptr) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    return reinterpret_cast<void*>(ctx->get_scene());
+  }
+
+  //Returns true if a new BVH was built (false if the current one matches the scene's geometry).
+  bool gd_api_context_build_bvh(void *ctx_ptr) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    return ctx->build_bvh();
+  }
+
+  bool gd_api_context_enable_geometry_paging(void *ctx_ptr, const char *path, unsigned long long budget_bytes) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    try {
+      ctx->enable_geometry_paging(path, static_cast<size_t>(budget_bytes));
+    }
+    catch (exception &e) {
+      cerr << "Geometry Paging Error: " << e.what() << endl;
+      return false;
+    }
+    return true;
+  }
+
+  void gd_api_context_memory_stats(void *ctx_ptr, /* out */ memory_stats *stats) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    *stats = ctx->memory_usage();
+  }
+
+  void gd_api_context_numa_stats(void *ctx_ptr, /* out */ numa_stats *stats) {
     render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
-    ctx->build_bvh();
+    *stats = ctx->numa_usage();
   }
 
   /* String Allocation */
@@ -425,6 +444,62 @@ extern "C" {
     return object_id;
   }
 
+  //Adds a set of strands to the scene. Control points are given as (x, y, z, radius), and
+  //strand_sizes lists the number of control points in each strand. Returns the object ID.
+  int gd_api_add_strands(void *sptr,
+			 unsigned int num_points, float *p_data,
+			 unsigned int num_strands, int *strand_sizes,
+			 void **mat_data, void **volume_data) {
+    scene *s = reinterpret_cast<scene*>(sptr);
+
+    int point_offset = s->strand_points.size();
+    int prim_offset = s->primitives.size();
+    int object_id = s->objects.size();
+
+    //load all control points
+    for (unsigned int i = 0; i < num_points; i += 4) {
+      s->strand_points.push_back(float4{p_data[i], p_data[i+1], p_data[i+2], p_data[i+3]});
+    }
+
+    //add a primitive for each segment
+    int strand_start = point_offset;
+    for (unsigned int strand = 0; strand < num_strands; ++strand) {
+      s->add_strand_segments(object_id, static_cast<int>(strand), strand_start, strand_sizes[strand],
+			     mat_data[strand], volume_data[strand]);
+      strand_start += strand_sizes[strand];
+    }
+
+    //add the object (strand objects have no triangles)
+    int tri_offset = s->triangle_verts.size();
+    object_ptr o = object_ptr(new object);
+    o->vert_range = int2{point_offset, static_cast<int>(s->strand_points.size())};
+    o->prim_range = int2{prim_offset, static_cast<int>(s->primitives.size())};
+    o->tri_range = int2{tri_offset, tri_offset};
+    
+    s->objects.push_back(o);
+    return object_id;
+  }
+
+  //Adds a float attribute with 1-4 components to a strand object, with a value per control point or per strand.
+  void gd_api_add_strand_attribute(void *sptr, int object_id,
+				   const char *name, int per_point, unsigned int num_components,
+				   float *data, unsigned int N) {
+    scene *s = reinterpret_cast<scene*>(sptr);
+
+    attribute_type type{attribute_type::FLOAT, static_cast<decltype(attribute_type::aggregate_type)>(num_components)};
+    attribute *attr = new attribute(per_point ? attribute::PER_VERTEX : attribute::PER_PRIMITIVE, type);
+
+    unsigned int num_elements = N / num_components;
+    attr->resize(num_elements);
+    
+    for (unsigned int i = 0; i < num_elements; ++i) {
+      float *value = attr->data<float>(i);
+      for (unsigned int c = 0; c < num_components; ++c) value[c] = data[i*num_components + c];
+    }
+
+    s->add_attribute(object_id, name, attr);
+  }
+
   void gd_api_add_texcoord(void *sptr, int object_id,
 			   const char *name, float *uv_data, unsigned int N) {
     scene *s = reinterpret_cast<scene*>(sptr);
@@ -442,7 +517,7 @@ extern "C" {
       coord[2] = float2{uv_data[i+4], uv_data[i+5]};
     }
 
-    s->objects[object_id]->attributes[name] = attr;
+    s->add_attribute(object_id, name, attr);
   }
 
   void gd_api_add_vertex_color(void *sptr, int object_id,
@@ -462,7 +537,7 @@ extern "C" {
       color[2] = float3{c_data[i+6], c_data[i+7], c_data[i+8]};
     }
 
-    s->objects[object_id]->attributes[name] = attr;
+    s->add_attribute(object_id, name, attr);
   }
 
   void gd_api_set_camera(void *sptr,
@@ -506,6 +581,61 @@ extern "C" {
     s->lights.push_back(lamp);
   }
 
+  //Adds a light surrounding the scene, given by a lat-long image (loaded through OpenImageIO). Maps already loaded
+  //into the scene are reused, so lamps can be cleared and re-added without reading the image again.
+  //Returns false if the image couldn't be loaded.
+  bool gd_api_add_environment_light(void *sptr, const char *path, float energy, float r, float g, float b) {
+    scene *s = reinterpret_cast<scene*>(sptr);
+
+    shared_ptr<environment_map> map;
+    for (auto it = s->environment_maps.begin(); it != s->environment_maps.end(); ++it) {
+      if ((*it)->source_path() == path) map = *it;
+    }
+
+    if (!map) {
+      try {
+	map = environment_map::load(path);
+      }
+      catch (exception &e) {
+	cerr << "Scene Error: " << e.what() << endl;
+	return false;
+      }
+      s->environment_maps.push_back(map);
+    }
+
+    light lamp;
+    lamp.type = light::ENVIRONMENT;
+    lamp.environment.map = map.get();
+    lamp.energy = energy;
+    lamp.color = float3{r, g, b};
+    s->lights.push_back(lamp);
+    return true;
+  }
+
+  //Removes every light (keeping the loaded environment maps for reuse).
+  void gd_api_clear_lamps(void *sptr) {
+    scene *s = reinterpret_cast<scene*>(sptr);
+    s->lights.clear();
+  }
+
+  //Reassigns an object's shaders, with one entry per triangle (for meshes) or per strand, as when it was added.
+  void gd_api_set_object_materials(void *sptr, int object_id, void **mat_data, void **volume_data) {
+    scene *s = reinterpret_cast<scene*>(sptr);
+    const object &o = s->get_object(object_id);
+    
+    for (int i = o.prim_range.x; i < o.prim_range.y; ++i) {
+      primitive &prim = s->primitives[i];
+      int idx = (prim.type == primitive::PRIM_STRAND ? s->strand_segments[prim.data_id].strand : i - o.prim_range.x);
+      prim.shader_id = mat_data[idx];
+      prim.volume_id = volume_data[idx];
+    }
+  }
+
+  void gd_api_scene_hashes(void *sptr, /* out */ scene_hashes *hashes) {
+    scene *s = reinterpret_cast<scene*>(sptr);
+    *hashes = s->content_hashes();
+  }
+
   void *gd_api_build_bvh(void *s) {
     scene *scn = reinterpret_cast<scene*>(s);
     cout << "Building Scene BVH..." << endl;
@@ -523,13 +653,154 @@ extern "C" {
 
   /* Rendering */
 
+  void gd_api_context_set_threads(void *ctx_ptr, unsigned int num_threads) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    ctx->set_num_threads(num_threads);
+  }
+
+  //Enables adaptive sampling for gd_api_render_frame (a threshold of 0 disables it).
+  void gd_api_context_set_adaptive_sampling(void *ctx_ptr, float threshold,
+					    unsigned int min_samples, unsigned int max_passes) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    ctx->set_adaptive_sampling(threshold, min_samples, max_passes);
+  }
+
+  //Sets the order tiles are rendered in (0: row by row, 1: Hilbert curve, 2: spiral from the center).
+  void gd_api_context_set_tile_order(void *ctx_ptr, int order) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    ctx->set_tile_order(static_cast<tile_order>(order));
+  }
+
+  //Sets how render threads and scene data are placed on NUMA nodes (0: off, 1: pin threads, 2: replicate BVH, 3: interleave).
+  void gd_api_context_set_numa_policy(void *ctx_ptr, int policy) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    ctx->set_numa_policy(static_cast<numa_policy>(policy));
+  }
+
+  //Limits frame renders to the given number of seconds (0 removes the limit).
+  void gd_api_context_set_time_budget(void *ctx_ptr, double seconds) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    ctx->set_time_budget(seconds);
+  }
+
+  //Renders the whole frame on the context's thread pool. The callback (which may be NULL) is called
+  //after each tile and can return 0 to cancel. Returns false if the render was cancelled or failed.
+  bool gd_api_render_frame(void *ctx_ptr, const char *entry_name,
+			   int width, int height, int tile_size,
+			   float (*output_buffer)[4],
+			   int (*progress_cb)(int, int)) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+
+    render_context::progress_callback progress;
+    if (progress_cb) progress = [progress_cb] (int done, int total) { return progress_cb(done, total) != 0; };
+    
+    try {
+      return ctx->render_frame(entry_name, width, height, tile_size, output_buffer, progress);
+    }
+    catch (exception &e) {
+      cerr << "Render Error: " << e.what() << endl;
+      return false;
+    }
+  }
+
+  //Renders the frame progressively in up to num_passes passes. The publish callback (which may be NULL) is called
+  //with the number of passes completed whenever output_buffer holds a new image to display, and can return 0 to
+  //stop rendering. Returns the number of passes completed.
+  unsigned int gd_api_render_progressive(void *ctx_ptr, const char *entry_name,
+					 int width, int height, int tile_size,
+					 unsigned int num_passes, double publish_interval,
+					 float (*output_buffer)[4],
+					 int (*progress_cb)(int, int), int (*publish_cb)(unsigned int)) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+
+    render_context::progress_callback progress;
+    if (progress_cb) progress = [progress_cb] (int done, int total) { return progress_cb(done, total) != 0; };
+
+    render_context::publish_callback publish;
+    if (publish_cb) publish = [publish_cb] (unsigned int passes) { return publish_cb(passes) != 0; };
+
+    try {
+      return ctx->render_progressive(entry_name, width, height, tile_size,
+				     num_passes, publish_interval,
+				     output_buffer, progress, publish);
+    }
+    catch (exception &e) {
+      cerr << "Render Error: " << e.what() << endl;
+      return 0;
+    }
+  }
+
+  //Starts rendering the frame on the context's own threads and returns right away. output_buffer must stay valid
+  //until gd_api_render_wait returns. Returns false if the render couldn't be started.
+  bool gd_api_render_start(void *ctx_ptr, const char *entry_name,
+			   int width, int height, int tile_size,
+			   float (*output_buffer)[4]) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    try {
+      ctx->start_render(entry_name, width, height, tile_size, output_buffer);
+    }
+    catch (exception &e) {
+      cerr << "Render Error: " << e.what() << endl;
+      return false;
+    }
+    return true;
+  }
+
+  //Fills in the progress of the render started by gd_api_render_start, without blocking.
+  void gd_api_render_poll(void *ctx_ptr, /* out */ render_status *status) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    *status = ctx->poll_render();
+  }
+
+  //Asks the running render to stop as soon as possible.
+  void gd_api_render_cancel(void *ctx_ptr) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    ctx->cancel_render();
+  }
+
+  //Waits for the render to stop. Returns false if it was cancelled or failed.
+  bool gd_api_render_wait(void *ctx_ptr) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+    try {
+      return ctx->wait_render();
+    }
+    catch (exception &e) {
+      cerr << "Render Error: " << e.what() << endl;
+      return false;
+    }
+  }
+
+  //Renders the whole frame on num_processes forked worker processes (0 uses one per core). The callback (which may
+  //be NULL) is called from the calling thread as tiles finish and can return 0 to cancel. Returns false if the
+  //render was cancelled or failed.
+  bool gd_api_render_frame_processes(void *ctx_ptr, const char *entry_name,
+				     int width, int height, int tile_size,
+				     unsigned int num_processes,
+				     float (*output_buffer)[4],
+				     int (*progress_cb)(int, int)) {
+    render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
+
+    render_context::progress_callback progress;
+    if (progress_cb) progress = [progress_cb] (int done, int total) { return progress_cb(done, total) != 0; };
+
+    try {
+      return ctx->render_frame_processes(entry_name, width, height, tile_size, num_processes, output_buffer, progress);
+    }
+    catch (exception &e) {
+      cerr << "Render Error: " << e.what() << endl;
+      return false;
+    }
+  }
+
   void gd_api_render_tile(void *ctx_ptr, const char *entry_name,
 			  int x, int y, int w, int h,
 			  float (*output_buffer)[4]) {
     render_context *ctx = reinterpret_cast<render_context*>(ctx_ptr);
-
-    void *entry_ptr = ctx->get_kernel()->get_function_pointer(entry_name);    
-    void (*entry)(int, int, int, int, void*) = (void (*)(int, int, int, int, void*))(entry_ptr);
-    entry(x, y, w, h, reinterpret_cast<void*>(output_buffer));
+    try {
+      ctx->render_tile(entry_name, x, y, w, h, output_buffer);
+    }
+    catch (exception &e) {
+      cerr << "Render Error: " << e.what() << endl;
+    }
   }
 };
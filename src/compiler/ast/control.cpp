@@ -145,8 +145,21 @@ codegen_void raytrace::ast::for_loop_statement::codegen(Module *module, IRBuilde
 
   typed_value_container after_val = (after ? after->codegen(module, builder) : typed_value(nullptr, state->types["void"]));
   if (after && !after->bound()) ast::expression::destroy_unbound(after_val, module, builder);
-  
-  builder.CreateBr(cond_bb);
+
+  //leave the loop early once the render has been cancelled, so long-running entry functions stop promptly
+  GlobalVariable *cancel_flag = module->getNamedGlobal(".__gd_cancel");
+  if (cancel_flag) {
+    BasicBlock *cancel_bb = BasicBlock::Create(getGlobalContext(), "cancel_bb");
+    Value *flag = builder.CreateLoad(cancel_flag, true, "cancel_flag");
+    Value *cancelled = builder.CreateICmpNE(flag, ConstantInt::get(flag->getType(), 0), "cancelled");
+    builder.CreateCondBr(cancelled, cancel_bb, cond_bb);
+
+    func->getBasicBlockList().push_back(cancel_bb);
+    builder.SetInsertPoint(cancel_bb);
+    state->control.set_jump_target(builder, 0);
+    builder.CreateBr(loop_cleanup_bb);
+  }
+  else builder.CreateBr(cond_bb);
 
   //exit the loop
   pop_scope(module, builder);
@@ -153,6 +153,11 @@ typed_value_container ast::func_call::codegen(Module *module, IRBuilder<> &build
       type_spec arg_ts = arg.get<1>();
 
       if (entry->arguments[arg_idx].output) arg_vals.push_back(arg.get<0>().extract_value());
+      else if (check_for_array_reference_cast(entry->arguments[arg_idx]) &&
+	       arg_ts == entry->arguments[arg_idx].type) {
+	//already an array reference, pass it along as-is
+	arg_vals.push_back(builder.CreateLoad(arg.get<0>().extract_value()));
+      }
       else if (check_for_array_reference_cast(entry->arguments[arg_idx])) {
 	code_value array_ref = conversion_llvm::array_to_array_ref(arg.get<0>().extract_value(), arg_ts->llvm_type(),
 								   entry->arguments[arg_idx].type,
@@ -171,8 +171,8 @@ extern "C" void *gd_builtin_alloc_dfunc(void *,
 					shade_tree::leaf::emission_func_type emit,
 					shade_tree::leaf::dtor_func_type dtor,
 					/* out */ void *out) {
-  char *params = new char[param_size];
-  new (out) shade_tree::node_ptr(shade_tree::leaf_ptr(new shade_tree::leaf(params, flags, eval, sample, pdf, emit, dtor)));
+  char *params;
+  new (out) shade_tree::node_ptr(shade_tree::make_leaf(param_size, flags, eval, sample, pdf, emit, dtor, params));
   return params;
 }
 
@@ -192,12 +192,12 @@ extern "C" void gd_builtin_dfunc_add(void *lhs, void *rhs, /* out */ void *out)
   shade_tree::node_ptr *left = reinterpret_cast<shade_tree::node_ptr*>(lhs);
   shade_tree::node_ptr *right = reinterpret_cast<shade_tree::node_ptr*>(rhs);
   
-  new (out) shade_tree::node_ptr(shade_tree::sum_ptr(new shade_tree::sum(*left, *right)));
+  new (out) shade_tree::node_ptr(shade_tree::make_sum(*left, *right));
 }
 
 extern "C" void gd_builtin_dfunc_scale(float4 *k, void *d, /* out */ void *out) {
   shade_tree::node_ptr *node = reinterpret_cast<shade_tree::node_ptr*>(d);
-  new (out) shade_tree::node_ptr(shade_tree::scale_ptr(new shade_tree::scale(*k, *node)));
+  new (out) shade_tree::node_ptr(shade_tree::make_scale(*k, *node));
 }
 
 typedef struct { bool is_const; char *data; } gd_error_string_type;
@@ -24,13 +24,17 @@
 #include "scene/attribute_reader.hpp"
 
 #include "geometry/triangle.hpp"
+#include "geometry/strand.hpp"
 #include "math/sampling.hpp"
+#include "math/random.hpp"
 #include "math/differential.hpp"
 
 #include "engine/context.hpp"
 
 #include <random>
 #include <functional>
+#include <cstdint>
+#include <cstring>
 
 using namespace gideon;
 using namespace gideon::rl;
@@ -50,13 +54,27 @@ scene_data::scene_data(scene *s, bvh *accel) :
 extern "C" bool gde_trace(ray *r, intersection *i,
 			  int *aabb_count, int *prim_count, render_context::scene_data *s) {
   unsigned int aabb_checked, prim_checked;
-  bool hit = s->accel->trace(*r, *i, aabb_checked, prim_checked);
+  bool hit = s->thread_accel()->trace(*r, *i, aabb_checked, prim_checked);
   *aabb_count = static_cast<int>(aabb_checked);
   *prim_count = static_cast<int>(prim_checked);
 
   return hit;
 }
 
+extern "C" bool gde_trace_any(ray *r, render_context::scene_data *s) {
+  return s->thread_accel()->trace_any(*r);
+}
+
+//layout of a Gideon array reference (T[])
+template<typename T>
+struct gd_array_ref { int size; T *data; };
+
+extern "C" int gde_trace_batch(gd_array_ref<ray> rays, int n, gd_array_ref<intersection> hits,
+			       render_context::scene_data *s) {
+  n = min(n, min(rays.size, hits.size));
+  return s->thread_accel()->trace_batch(rays.data, n, hits.data);
+}
+
 extern "C" void gde_camera_shoot_ray(int x, int y, render_context::scene_data *sdata, ray *r) {
   *r = camera_shoot_ray(sdata->s->main_camera, x, y);
 }
@@ -139,6 +157,57 @@ extern "C" bool gde_primitive_get_attribute_v4(render_context::scene_data *sdata
   return primitive_get_attribute<float4>(prim, *s, attr_name->data, *coords, *result);
 }
 
+extern "C" int gde_primitive_get_attribute_handle(render_context::scene_data *sdata,
+						  gd_string_type *attr_name) {
+  return sdata->s->find_attribute_handle(attr_name->data);
+}
+
+extern "C" bool gde_primitive_get_attribute_handle_f(render_context::scene_data *sdata, int prim_id,
+						     int attr_handle, float4 *coords,
+						     /* out */ float *result) {
+  scene *s = sdata->s;
+  primitive &prim = s->primitives[prim_id];
+
+  return primitive_get_attribute<float>(prim, *s, attr_handle, *coords, *result);
+}
+
+extern "C" bool gde_primitive_get_attribute_handle_v2(render_context::scene_data *sdata, int prim_id,
+						      int attr_handle, float4 *coords,
+						      /* out */ float2 *result) {
+  scene *s = sdata->s;
+  primitive &prim = s->primitives[prim_id];
+
+  return primitive_get_attribute<float2>(prim, *s, attr_handle, *coords, *result);
+}
+
+extern "C" bool gde_primitive_get_attribute_handle_v2_deriv(render_context::scene_data *sdata, int prim_id,
+							    int attr_handle, float4 *coords,
+							    /* out */ float2 *result,
+							    /* out */ float2 *du, /* out */ float2 *dv) {
+  scene *s = sdata->s;
+  primitive &prim = s->primitives[prim_id];
+
+  return primitive_get_attribute_deriv<float2>(prim, *s, attr_handle, *coords, *result, *du, *dv);
+}
+
+extern "C" bool gde_primitive_get_attribute_handle_v3(render_context::scene_data *sdata, int prim_id,
+						      int attr_handle, float4 *coords,
+						      /* out */ float3 *result) {
+  scene *s = sdata->s;
+  primitive &prim = s->primitives[prim_id];
+
+  return primitive_get_attribute<float3>(prim, *s, attr_handle, *coords, *result);
+}
+
+extern "C" bool gde_primitive_get_attribute_handle_v4(render_context::scene_data *sdata, int prim_id,
+						      int attr_handle, float4 *coords,
+						      /* out */ float4 *result) {
+  scene *s = sdata->s;
+  primitive &prim = s->primitives[prim_id];
+
+  return primitive_get_attribute<float4>(prim, *s, attr_handle, *coords, *result);
+}
+
 
 
 //Intersection Functions
@@ -148,20 +217,30 @@ extern "C" float gde_isect_dist(intersection *i) { return i->t; }
 extern "C" void gde_isect_normal(intersection *i, render_context::scene_data *sdata, float3 *N) {
   scene *s = sdata->s;
   primitive &prim = s->primitives[i->prim_idx];
-  int3 &tri = s->triangle_verts[prim.data_id];
-  vector<float3> &verts = s->vertices;
+  if (prim.type == primitive::PRIM_STRAND) {
+    *N = i->N;
+    return;
+  }
+  
+  triangle_geometry tri;
+  s->get_triangle(prim.data_id, tri);
 
-  *N = compute_triangle_normal(verts[tri.x], verts[tri.y], verts[tri.z]);
+  *N = compute_triangle_normal(tri.P[0], tri.P[1], tri.P[2]);
 }
 
 extern "C" void gde_isect_smooth_normal(intersection *i, render_context::scene_data *sdata, float3 *N) {
   scene *s = sdata->s;
   primitive &prim = s->primitives[i->prim_idx];
-  int3 &tri = s->triangle_verts[prim.data_id];
-  vector<float3> &vnorms = s->vertex_normals;
+  if (prim.type == primitive::PRIM_STRAND) {
+    *N = i->N; //strands are shaded as round tubes
+    return;
+  }
+  
+  triangle_geometry tri;
+  s->get_triangle(prim.data_id, tri);
 
   float inv = 1.0f - i->u - i->v;
-  *N = normalize(inv*vnorms[tri.x] + i->u*vnorms[tri.y] + i->v*vnorms[tri.z]);
+  *N = normalize(inv*tri.N[0] + i->u*tri.N[1] + i->v*tri.N[2]);
 }
 
 extern "C" int gde_isect_primitive_id(intersection *i) {
@@ -172,10 +251,16 @@ extern "C" void gde_isect_dP(intersection *i, render_context::scene_data *sdata,
 			     /* out */ float3 *dPdu, /* out */ float3 *dPdv) {
   scene *s = sdata->s;
   primitive &prim = s->primitives[i->prim_idx];
-  int3 &tri = s->triangle_verts[prim.data_id];
-  vector<float3> &verts = s->vertices;
+  if (prim.type == primitive::PRIM_STRAND) {
+    const strand_segment &seg = s->strand_segments[prim.data_id];
+    compute_strand_dP(s->strand_points[seg.point], s->strand_points[seg.point + 1], i->u, i->N, *dPdu, *dPdv);
+    return;
+  }
+  
+  triangle_geometry tri;
+  s->get_triangle(prim.data_id, tri);
 
-  compute_triangle_dP(verts[tri.x], verts[tri.y], verts[tri.z], *dPdu, *dPdv);
+  compute_triangle_dP(tri.P[0], tri.P[1], tri.P[2], *dPdu, *dPdv);
 }
 
 /* Ray */
@@ -203,7 +288,12 @@ extern "C" float gde_pow_f(float x, float y) { return powf(x, y); }
 
 extern "C" float gde_random(void *s) { 
   render_context::scene_data *scn = reinterpret_cast<render_context::scene_data*>(s);
-  return scn->rng();
+  return scn->thread()->samples.random();
+}
+
+extern "C" float gde_random_key(int x, int y, int sample, int dim) {
+  return counter_random(static_cast<uint32_t>(x), static_cast<uint32_t>(y),
+			static_cast<uint32_t>(sample), static_cast<uint32_t>(dim));
 }
 
 extern "C" void gde_cosine_sample_hemisphere(float3 *N,
@@ -278,6 +368,119 @@ extern "C" void gde_scene_get_light(render_context::scene_data *sdata, int id, l
   *light_id = &sdata->s->lights[id];
 }
 
+extern "C" int gde_scene_sample_light(render_context::scene_data *sdata, float3 *P, float3 *N, float u,
+				      /* out */ float *pdf) {
+  if (sdata->lights) return sdata->lights->sample(*P, *N, u, *pdf);
+
+  //no light tree (e.g. outside a render): pick uniformly
+  int num_lights = static_cast<int>(sdata->s->lights.size());
+  if (num_lights == 0) {
+    *pdf = 0.0f;
+    return -1;
+  }
+  *pdf = 1.0f / num_lights;
+  return min(static_cast<int>(u * num_lights), num_lights - 1);
+}
+
+extern "C" float gde_scene_light_pdf(render_context::scene_data *sdata, float3 *P, float3 *N, int id) {
+  if (sdata->lights) return sdata->lights->pdf(*P, *N, id);
+  return sdata->s->lights.empty() ? 0.0f : 1.0f / sdata->s->lights.size();
+}
+
+//Returns the radiance arriving from the environment lights along D (at a point P with normal N, for computing the
+//probability that light sampling would have picked this direction).
+extern "C" void gde_scene_environment(render_context::scene_data *sdata, float3 *D, float3 *P, float3 *N,
+				      /* out */ float4 *L, /* out */ float *pdf) {
+  *L = float4{0.0f, 0.0f, 0.0f, 0.0f};
+  *pdf = 0.0f;
+  
+  const vector<light> &lights = sdata->s->lights;
+  auto add_light = [&] (int i) {
+    const light &lt = lights[i];
+    if (lt.type != light::ENVIRONMENT) return;
+    
+    *L = *L + lt.eval_radiance(*P, *D);
+    *pdf += gde_scene_light_pdf(sdata, P, N, i) * lt.environment.map->pdf(*D);
+  };
+
+  if (sdata->lights) {
+    for (int i : sdata->lights->infinite()) add_light(i);
+  }
+  else {
+    for (int i = 0; i < static_cast<int>(lights.size()); ++i) add_light(i);
+  }
+}
+
+//Emissive Triangles
+
+//Returns the number of shaders to probe to the one thread that gets to build the emitter table, and zero to the others
+//(which wait for it to finish).
+extern "C" int gde_scene_emitter_shaders(render_context::scene_data *sdata) {
+  if (!sdata->emitters || sdata->emitters->is_built()) return 0;
+  if (!sdata->emitters->begin_build(*sdata->s)) return 0;
+  return sdata->emitters->num_shaders();
+}
+
+//Sets up a ray hitting the middle of a triangle that uses the i'th shader head-on, for evaluating the shader there.
+extern "C" void *gde_scene_emitter_probe(render_context::scene_data *sdata, int i,
+					 /* out */ ray *r, /* out */ intersection *hit) {
+  int prim_id = sdata->emitters->shader_primitive(i);
+  const primitive &prim = sdata->s->primitives[prim_id];
+  
+  triangle_geometry tri;
+  sdata->s->get_triangle(prim.data_id, tri);
+  float3 center = (1.0f / 3.0f) * (tri.P[0] + tri.P[1] + tri.P[2]);
+  float3 N = primitive_geometry_normal(prim, *sdata->s);
+
+  r->o = center + N;
+  r->d = -1.0f * N;
+  r->min_t = 0.0f;
+  r->max_t = 2.0f;
+
+  hit->t = 1.0f;
+  hit->u = hit->v = 1.0f / 3.0f;
+  hit->prim_idx = prim_id;
+  hit->N = N;
+  return sdata->emitters->shader(i);
+}
+
+extern "C" void gde_scene_set_emitter_shader(render_context::scene_data *sdata, int i, float4 *Le) {
+  sdata->emitters->set_shader_emission(i, *Le);
+}
+
+extern "C" void gde_scene_build_emitters(render_context::scene_data *sdata) {
+  sdata->emitters->build(*sdata->s);
+}
+
+extern "C" int gde_scene_sample_emitter(render_context::scene_data *sdata, float u, float2 *uv,
+					/* out */ float3 *P, /* out */ float3 *N, /* out */ float *pdf) {
+  if (!sdata->emitters) {
+    *pdf = 0.0f;
+    return -1;
+  }
+  return sdata->emitters->sample(u, uv->x, uv->y, *P, *N, *pdf);
+}
+
+extern "C" float gde_scene_emitter_pdf(render_context::scene_data *sdata, int prim_id) {
+  return sdata->emitters ? sdata->emitters->pdf(prim_id) : 0.0f;
+}
+
+extern "C" bool gde_scene_emitter_hit(render_context::scene_data *sdata, int prim_id, float3 *P, float3 *P_lt,
+				      /* out */ ray *r, /* out */ intersection *hit) {
+  float3 D = *P_lt - *P;
+  float dist = length(D);
+  if (dist <= 0.0f) return false;
+
+  r->o = *P;
+  r->d = (1.0f / dist) * D;
+  r->min_t = 0.0f;
+  r->max_t = 1.001f * dist;
+  if (!ray_primitive_intersection(sdata->s->primitives[prim_id], *sdata->s, *r, *hit)) return false;
+  
+  hit->prim_idx = prim_id;
+  return true;
+}
+
 //Lights
 
 extern "C" void gde_light_sample_position(light *lt, float3 *P, float rand_u, float rand_v,
@@ -291,39 +494,195 @@ extern "C" void gde_light_eval_radiance(light *lt, float3 *P, float3 *I, /* out
 
 //Sampling
 
-extern "C" void gde_setup_sampler(render_context::scene_data *sdata,
-				  int width, int height, int samples_per_pixel,
-				  gd_string_type *type) {
-  sdata->samples.setup(width, height, samples_per_pixel, sdata->samples.select_generator(type->data));
+extern "C" void gde_setup_sampler_tile(render_context::scene_data *sdata,
+				       int x0, int y0, int width, int height, int samples_per_pixel,
+				       gd_string_type *type) {
+  sampler &samples = sdata->thread()->samples;
+  samples.setup(x0, y0, width, height, samples_per_pixel, samples.select_generator(type->data));
 }
 
 extern "C" int gde_add_sample(render_context::scene_data *sdata,
 			      gd_string_type *type,
 			      int dim, int N) {
-  return static_cast<int>(sdata->samples.add(dim, N, sdata->samples.select_generator(type->data)));
+  sampler &samples = sdata->thread()->samples;
+  return static_cast<int>(samples.add(dim, N, samples.select_generator(type->data)));
 }
 
 extern "C" void gde_next_sample(render_context::scene_data *sdata, int x, int y,
 				/* out */ float2 *sample) {
-  sdata->samples.next_sample(static_cast<unsigned int>(x), static_cast<unsigned int>(y), sample);
+  sdata->thread()->samples.next_sample(static_cast<unsigned int>(x), static_cast<unsigned int>(y), sample);
 }
 
 extern "C" int gde_sample_offset(render_context::scene_data *sdata, int id) {
-  return static_cast<int>(sdata->samples.get_offset(static_cast<sampler::sample_id>(id)));
+  return static_cast<int>(sdata->thread()->samples.get_offset(static_cast<sampler::sample_id>(id)));
 }
 
 extern "C" float gde_sample_get_1d(render_context::scene_data *sdata,
 				   int idx) {
-  return sdata->samples.access_1d(static_cast<unsigned int>(idx));
+  return sdata->thread()->samples.access_1d(static_cast<unsigned int>(idx));
 }
 
 extern "C" void gde_sample_get_2d(render_context::scene_data *sdata,
 				  int idx, /* out */ float2 *sample) {
-  *sample = sdata->samples.access_2d(static_cast<unsigned int>(idx));
+  *sample = sdata->thread()->samples.access_2d(static_cast<unsigned int>(idx));
+}
+
+//Multi-Pass Rendering
+
+extern "C" int gde_sampler_pass(render_context::scene_data *sdata) {
+  return static_cast<int>(sdata->thread()->samples.get_pass());
+}
+
+extern "C" bool gde_sampler_converged(render_context::scene_data *sdata, int x, int y) {
+  if (!sdata->frame) return false;
+
+  sampler &samples = sdata->thread()->samples;
+  return sdata->frame->converged(samples.tile_x() + x, samples.tile_y() + y);
+}
+
+extern "C" void gde_write_sample(render_context::scene_data *sdata, int x, int y, float4 *color) {
+  if (!sdata->frame) return;
+
+  sampler &samples = sdata->thread()->samples;
+  sdata->frame->add_sample(samples.tile_x() + x, samples.tile_y() + y, *color);
+}
+
+//Wavefront Path Tracing
+
+extern "C" void gde_wavefront_clear(render_context::scene_data *sdata) {
+  sdata->thread()->paths.clear();
+}
+
+extern "C" int gde_wavefront_add_path(render_context::scene_data *sdata, ray *r, int x, int y, int sample) {
+  return sdata->thread()->paths.add_path(*r, x, y, sample);
+}
+
+extern "C" int gde_wavefront_trace(render_context::scene_data *sdata) {
+  return sdata->thread()->paths.trace(*sdata->thread_accel());
+}
+
+extern "C" int gde_wavefront_num_missed(render_context::scene_data *sdata) {
+  return sdata->thread()->paths.num_missed();
+}
+
+extern "C" int gde_wavefront_missed_path(render_context::scene_data *sdata, int i) {
+  return sdata->thread()->paths.missed_path(i);
+}
+
+extern "C" void gde_wavefront_sort(render_context::scene_data *sdata) {
+  sdata->thread()->paths.sort_by_shader(*sdata->s);
+}
+
+extern "C" int gde_wavefront_num_paths(render_context::scene_data *sdata) {
+  return sdata->thread()->paths.num_paths();
+}
+
+extern "C" int gde_wavefront_num_active(render_context::scene_data *sdata) {
+  return sdata->thread()->paths.num_active();
+}
+
+extern "C" int gde_wavefront_active_path(render_context::scene_data *sdata, int i) {
+  return sdata->thread()->paths.active_path(i);
+}
+
+extern "C" void gde_wavefront_path_ray(render_context::scene_data *sdata, int id, /* out */ ray *r) {
+  *r = sdata->thread()->paths.get(id).r;
+}
+
+extern "C" void gde_wavefront_path_hit(render_context::scene_data *sdata, int id, /* out */ intersection *hit) {
+  *hit = sdata->thread()->paths.get(id).hit;
+}
+
+extern "C" int gde_wavefront_path_sample(render_context::scene_data *sdata, int id) {
+  return sdata->thread()->paths.get(id).sample;
+}
+
+extern "C" int gde_wavefront_path_depth(render_context::scene_data *sdata, int id) {
+  return sdata->thread()->paths.get(id).depth;
+}
+
+extern "C" void gde_wavefront_path_pixel(render_context::scene_data *sdata, int id,
+					 /* out */ int *x, /* out */ int *y) {
+  const wavefront_queue::path &p = sdata->thread()->paths.get(id);
+  *x = p.x;
+  *y = p.y;
+}
+
+extern "C" void gde_wavefront_path_throughput(render_context::scene_data *sdata, int id, /* out */ float4 *T) {
+  *T = sdata->thread()->paths.get(id).throughput;
+}
+
+extern "C" void gde_wavefront_set_throughput(render_context::scene_data *sdata, int id, float4 *T) {
+  sdata->thread()->paths.get(id).throughput = *T;
+}
+
+extern "C" float gde_wavefront_path_bsdf_pdf(render_context::scene_data *sdata, int id) {
+  return sdata->thread()->paths.get(id).bsdf_pdf;
+}
+
+extern "C" void gde_wavefront_set_bsdf_pdf(render_context::scene_data *sdata, int id, float pdf) {
+  sdata->thread()->paths.get(id).bsdf_pdf = pdf;
+}
+
+extern "C" void gde_wavefront_path_light_normal(render_context::scene_data *sdata, int id, /* out */ float3 *N) {
+  *N = sdata->thread()->paths.get(id).light_normal;
+}
+
+extern "C" void gde_wavefront_set_light_normal(render_context::scene_data *sdata, int id, float3 *N) {
+  sdata->thread()->paths.get(id).light_normal = *N;
+}
+
+extern "C" void gde_wavefront_path_radiance(render_context::scene_data *sdata, int id, /* out */ float4 *L) {
+  *L = sdata->thread()->paths.get(id).radiance;
+}
+
+extern "C" void gde_wavefront_add_radiance(render_context::scene_data *sdata, int id, float4 *L) {
+  wavefront_queue::path &p = sdata->thread()->paths.get(id);
+  p.radiance = p.radiance + *L;
+}
+
+extern "C" void gde_wavefront_continue_path(render_context::scene_data *sdata, int id, ray *r) {
+  sdata->thread()->paths.continue_path(id, *r);
+}
+
+extern "C" void gde_wavefront_end_path(render_context::scene_data *sdata, int id) {
+  sdata->thread()->paths.end_path(id);
+}
+
+extern "C" void gde_wavefront_add_shadow_ray(render_context::scene_data *sdata, int id, ray *r, float4 *L) {
+  sdata->thread()->paths.add_shadow_ray(id, *r, *L);
+}
+
+extern "C" void gde_wavefront_trace_shadows(render_context::scene_data *sdata) {
+  sdata->thread()->paths.trace_shadows(*sdata->thread_accel());
 }
 
 //Texturing
 
+//Creating a ustring locks OIIO's global string table, so constant texture names are cached per-thread.
+//Entries are found by the constant's address but only used if the contents still match, since a replaced
+//kernel can put a different name at the same address.
+struct texture_name_cache_entry {
+  const char *key;
+  const char *name;
+};
+
+static const unsigned int texture_name_cache_size = 16;
+static __thread texture_name_cache_entry texture_name_cache[texture_name_cache_size];
+
+static OpenImageIO::ustring texture_name(gd_string_type *name) {
+  if (!name->is_const) return OpenImageIO::ustring(name->data);
+
+  unsigned int slot = (reinterpret_cast<uintptr_t>(name->data) >> 3) % texture_name_cache_size;
+  texture_name_cache_entry &entry = texture_name_cache[slot];
+  if (entry.key == name->data && strcmp(entry.name, name->data) == 0) return OpenImageIO::ustring::from_unique(entry.name);
+
+  OpenImageIO::ustring result(name->data);
+  entry.key = name->data;
+  entry.name = result.c_str();
+  return result;
+}
+
 extern "C" bool gde_texture_2d(render_context::scene_data *sdata,
 			       gd_string_type *name, float2 *coords,
 			       /* out */ float4 *color) {
@@ -333,7 +692,7 @@ extern "C" bool gde_texture_2d(render_context::scene_data *sdata,
   options.twrap = OpenImageIO::TextureOptions::WrapPeriodic;
   
   float result[4];  
-  bool status = sdata->textures->texture(OpenImageIO::ustring(name->data), options,
+  bool status = sdata->textures->texture(texture_name(name), options,
 					 coords->x, coords->y,
 					 0.0f, 0.0f, 0.0f, 0.0f,
 					 result);
@@ -351,7 +710,7 @@ extern "C" bool gde_texture_2d_deriv(render_context::scene_data *sdata,
   options.twrap = OpenImageIO::TextureOptions::WrapPeriodic;
   
   float result[4];  
-  bool status = sdata->textures->texture(OpenImageIO::ustring(name->data), options,
+  bool status = sdata->textures->texture(texture_name(name), options,
 					 coords->x, coords->y,
 					 dx->x, dx->y, dy->x, dy->y,
 					 result);
@@ -380,3 +739,10 @@ extern "C" void gde_write_pixel(int x, int y, int width, int height, float4 *col
   pix[2] = color->z;
   pix[3] = color->w;
 }
+
+extern "C" void gde_tile_pixel(render_context::scene_data *sdata, int idx, int width, int height,
+			       /* out */ int *x, /* out */ int *y) {
+  uint32_t pixel = sdata->thread()->morton_pixels(width, height)[idx];
+  *x = static_cast<int>(pixel & 0xffff);
+  *y = static_cast<int>(pixel >> 16);
+}
@@ -132,6 +132,10 @@ codegen_void render_object::parse(ast::parser_state *parser,
   //add a global scene pointer declaration
   ast::type_expr_ptr scene_type = ast::type_expr_ptr(new ast::typename_expression(parser, "scene_ptr", 0, 0));
   syntax_tree.insert(syntax_tree.begin(), ast::global_declaration_ptr(new ast::global_variable_decl(parser, "__gd_scene", scene_type, nullptr, 0, 0)));
+
+  //and the cancellation flag checked by every loop
+  ast::type_expr_ptr cancel_type = ast::type_expr_ptr(new ast::typename_expression(parser, "int", 0, 0));
+  syntax_tree.insert(syntax_tree.begin(), ast::global_declaration_ptr(new ast::global_variable_decl(parser, "__gd_cancel", cancel_type, nullptr, 0, 0)));
   return result;
 }
 
@@ -182,6 +186,11 @@ compiled_renderer::compiled_renderer(Module *module) :
   engine.reset(builder.create());
 
   if (error_str.size() > 0) throw runtime_error(error_str);
+  engine->RegisterJITEventListener(&code_listener);
+}
+
+compiled_renderer::~compiled_renderer() {
+  if (engine) engine->UnregisterJITEventListener(&code_listener);
 }
 
 void *compiled_renderer::get_function_pointer(const string &func_name) {
@@ -21,21 +21,78 @@
 
 #include "engine/context.hpp"
 #include "scene/bvh_builder.hpp"
+#include "shading/distribution.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <new>
+
+#ifdef __unix__
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace gideon;
 
 OIIO_NAMESPACE_USING
 
+__thread render_context::thread_state *render_context::current_thread = NULL;
+
+render_context::thread_state::thread_state(unsigned int seed) :
+  samples(seed),
+  accel(NULL),
+  pixel_order_width(0), pixel_order_height(0)
+{
+  
+}
+
+const vector<uint32_t> &render_context::thread_state::morton_pixels(int width, int height) {
+  if (width != pixel_order_width || height != pixel_order_height) {
+    morton_pixel_order(width, height, pixel_order);
+    pixel_order_width = width;
+    pixel_order_height = height;
+  }
+  return pixel_order;
+}
+
+//the kernel's __gd_cancel global is an int mapped onto cancel_flag
+static_assert(sizeof(atomic<int>) == sizeof(int), "The cancellation flag must have the layout of an int.");
+
 render_context::render_context() :
-  sd(new scene_data)
+  bvh_geometry_hash(0), light_tree_hash(0), emitters_hash(0),
+  num_threads(0), tiles_order(TILES_HILBERT),
+  adaptive_threshold(0.0f), adaptive_min_samples(0), adaptive_max_passes(1),
+  time_budget(0.0),
+  topology(numa_topology::detect()), numa_mode(NUMA_PIN_THREADS), numa_placed(false),
+  pinned_threads(0), interleaved_bytes(0),
+  sd(new scene_data),
+  main_state(new thread_state(0)),
+  cancel_flag(0),
+  async_tiles_done(0), async_total_tiles(0),
+  async_finished(true), async_cancelled(false), async_result(false)
 {
-  sd->rng = bind(uniform_real_distribution<float>(0.0f, 1.0f),
-		 mt19937());
+  sd->s = NULL;
+  sd->accel = NULL;
+  sd->lights = NULL;
+  sd->emitters = NULL;
+  sd->frame = NULL;
   sd->textures = TextureSystem::create();
 }
 
 render_context::~render_context() {
+  if (render_thread.joinable()) {
+    cancel_render();
+    render_thread.join();
+  }
+  
   if (sd) {
     TextureSystem::destroy(sd->textures);
     delete sd;
@@ -47,14 +104,606 @@ void render_context::set_kernel(unique_ptr<raytrace::render_kernel> k) {
   
   //map the kernel's global scene variable to this context
   kernel->map_global(".__gd_scene", reinterpret_cast<void*>(&sd));
+  kernel->map_global(".__gd_cancel", reinterpret_cast<void*>(&cancel_flag));
+
+  //the emitters were found by running the old kernel's shaders
+  emitter_lights.reset();
+  sd->emitters = NULL;
 }
 
 void render_context::set_scene(unique_ptr<raytrace::scene> s) {
+  bool same_geometry = (accel && s->geometry_hash() == bvh_geometry_hash);
+  
   scn = move(s);
   sd->s = scn.get();
+  numa_placed = false;
+
+  if (same_geometry) accel->set_scene(*scn);
+  else {
+    accel.reset();
+    sd->accel = NULL;
+  }
 }
 
-void render_context::build_bvh() {
+bool render_context::build_bvh() {
+  //paged scenes have already had their BVH built (their geometry is no longer in memory)
+  if (accel && (scn->pager || scn->geometry_hash() == bvh_geometry_hash)) return false;
+  
   accel.reset(new raytrace::bvh(raytrace::build_bvh_centroid_sah(scn.get())));
+  bvh_geometry_hash = scn->geometry_hash();
   sd->accel = accel.get();
+  numa_placed = false;
+  return true;
+}
+
+void render_context::enable_geometry_paging(const string &path, size_t budget_bytes) {
+  if (!accel) throw runtime_error("Geometry paging requires the scene's BVH to be built first.");
+
+  scn->set_geometry_pager(raytrace::geometry_pager::build(*scn, *accel, path, budget_bytes));
+  numa_placed = false;
+}
+
+void render_context::set_num_threads(unsigned int n) {
+  if (workers && n == num_threads) return;
+
+  num_threads = n;
+  workers.reset();
+  worker_states.clear();
+  numa_placed = false;
+}
+
+void render_context::set_numa_policy(numa_policy policy) {
+  if (policy == numa_mode) return;
+
+  //start over with fresh workers, since pinned threads can't be unpinned reliably
+  numa_mode = policy;
+  workers.reset();
+  worker_states.clear();
+  numa_placed = false;
+}
+
+void render_context::place_numa_data() {
+  if (numa_placed) return;
+  numa_placed = true;
+
+  bvh_replicas.clear();
+  pinned_threads = 0;
+  interleaved_bytes = 0;
+  for (auto it = worker_states.begin(); it != worker_states.end(); ++it) (*it)->accel = NULL;
+  
+  if (numa_mode == NUMA_OFF || topology.num_nodes() < 2) return;
+
+  unsigned int num_workers = workers->size();
+  for (unsigned int i = 0; i < num_workers; ++i) {
+    if (workers->pin_worker(i, topology.cpus(topology.worker_node(i, num_workers)))) pinned_threads++;
+  }
+
+  if (numa_mode == NUMA_REPLICATE && accel) {
+    //copy the BVH from a thread running on each node, so the copy's pages are allocated there
+    bvh_replicas.resize(topology.num_nodes());
+    for (unsigned int node = 0; node < topology.num_nodes(); ++node) {
+      thread copier([this, node] () {
+	  set_thread_affinity(pthread_self(), topology.cpus(node));
+	  bvh_replicas[node].reset(new raytrace::bvh(*accel));
+	});
+      copier.join();
+    }
+
+    for (unsigned int i = 0; i < num_workers; ++i) worker_states[i]->accel = bvh_replicas[topology.worker_node(i, num_workers)].get();
+  }
+
+  if (numa_mode == NUMA_REPLICATE || numa_mode == NUMA_INTERLEAVE) {
+    auto interleave = [this] (const void *data, size_t bytes) {
+      if (topology.interleave(data, bytes)) interleaved_bytes += bytes;
+    };
+
+    if (numa_mode == NUMA_INTERLEAVE && accel) {
+      interleave(accel->node_data(), accel->node_memory());
+      interleave(accel->leaf_data(), accel->leaf_memory());
+    }
+
+    //geometry is too big to copy per node, so spread it evenly instead
+    if (scn) {
+      interleave(scn->vertices.data(), scn->vertices.size() * sizeof(raytrace::float3));
+      interleave(scn->vertex_normals.data(), scn->vertex_normals.size() * sizeof(raytrace::float3));
+      interleave(scn->triangle_verts.data(), scn->triangle_verts.size() * sizeof(raytrace::int3));
+      interleave(scn->primitives.data(), scn->primitives.size() * sizeof(raytrace::primitive));
+    }
+  }
+}
+
+void render_context::prepare_lights() {
+  if (!scn) return;
+  
+  uint64_t lights_hash = scn->lights_hash();
+  if (!light_hierarchy || lights_hash != light_tree_hash) {
+    light_hierarchy.reset(new raytrace::light_tree(scn->lights));
+    light_tree_hash = lights_hash;
+    sd->lights = light_hierarchy.get();
+  }
+
+  //the BVH is always current for the scene being rendered, so its hash stands in for the geometry's
+  uint64_t geometry_hash = accel ? bvh_geometry_hash : scn->geometry_hash();
+  uint64_t shading_hash = geometry_hash ^ (scn->materials_hash() * 1099511628211ULL);
+  if (!emitter_lights || shading_hash != emitters_hash) {
+    emitter_lights.reset(new raytrace::emitter_table(*scn));
+    emitters_hash = shading_hash;
+    sd->emitters = emitter_lights.get();
+  }
+}
+
+void render_context::set_adaptive_sampling(float threshold, unsigned int min_samples, unsigned int max_passes) {
+  adaptive_threshold = threshold;
+  adaptive_min_samples = min_samples;
+  adaptive_max_passes = max(max_passes, 1u);
+}
+
+bool render_context::render_frame(const string &entry_name,
+				  int width, int height, int tile_size,
+				  /* out */ float (*out)[4],
+				  const progress_callback &progress) {
+  bool adaptive = (adaptive_threshold > 0.0f);
+  bool budgeted = (time_budget > 0.0);
+  unsigned int num_passes = 1;
+  if (adaptive) num_passes = adaptive_max_passes;
+  else if (budgeted) num_passes = numeric_limits<unsigned int>::max();
+  
+  unsigned int passes_done;
+  return render_passes(entry_name, width, height, tile_size,
+		       num_passes, adaptive || budgeted, 0.0,
+		       out, progress, publish_callback(), passes_done);
+}
+
+unsigned int render_context::render_progressive(const string &entry_name,
+						 int width, int height, int tile_size,
+						 unsigned int num_passes, double publish_interval,
+						 /* out */ float (*out)[4],
+						 const progress_callback &progress, const publish_callback &publish) {
+  unsigned int passes_done;
+  render_passes(entry_name, width, height, tile_size,
+		max(num_passes, 1u), true, publish_interval,
+		out, progress, publish, passes_done);
+  return passes_done;
+}
+
+void render_context::start_render(const string &entry_name,
+				  int width, int height, int tile_size,
+				  /* out */ float (*out)[4]) {
+  if (render_thread.joinable()) throw runtime_error("A render is already running on this context.");
+
+  //compile the entry point now, so compile errors are reported to the caller
+  kernel->get_function_pointer(entry_name);
+
+  async_tiles_done = 0;
+  async_total_tiles = 0;
+  async_cancelled = false;
+  async_finished = false;
+  async_error = nullptr;
+
+  render_thread = thread([this, entry_name, width, height, tile_size, out] () {
+      //a cancel that arrives before the render resets the flag is picked up after the next tile
+      progress_callback progress = [this] (int done, int total) {
+	async_tiles_done = done;
+	async_total_tiles = total;
+	return !async_cancelled;
+      };
+      
+      try {
+	async_result = render_frame(entry_name, width, height, tile_size, out, progress);
+      }
+      catch (...) {
+	async_result = false;
+	async_error = current_exception();
+      }
+      async_finished = true;
+    });
+}
+
+render_status render_context::poll_render() const {
+  render_status status;
+  status.tiles_done = async_tiles_done;
+  status.total_tiles = async_total_tiles;
+  status.progress = (status.total_tiles > 0 ? static_cast<float>(status.tiles_done) / status.total_tiles : 0.0f);
+  status.finished = (async_finished ? 1 : 0);
+  return status;
+}
+
+void render_context::cancel_render() {
+  async_cancelled = true;
+  cancel_flag = 1;
+}
+
+bool render_context::wait_render() {
+  if (!render_thread.joinable()) return false;
+  
+  render_thread.join();
+  if (async_error) rethrow_exception(async_error);
+  return async_result;
+}
+
+#ifdef __unix__
+
+namespace {
+
+  /*
+    Memory shared by a multi-process render's coordinator and its workers: a header,
+    the queue of tiles to render, whether each tile has finished, and the framebuffer.
+  */
+  class shared_frame {
+  public:
+
+    struct header {
+      atomic<int> next_tile; //position in the queue of the next tile to hand out
+      atomic<int> cancelled;
+      int queue_size;
+    };
+
+    header *head;
+    int *queue; //tile indices
+    atomic<int> *finished; //per tile, the only record of which tiles are done (a worker can die right after setting it)
+    float (*pixels)[4];
+
+    shared_frame(int num_tiles, int num_pixels) :
+      bytes(sizeof(header) + num_tiles*(sizeof(int) + sizeof(atomic<int>)) + num_pixels*4*sizeof(float))
+    {
+      //anonymous shared mappings start zeroed and stay shared with forked children
+      void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED) throw runtime_error("Could not allocate the shared framebuffer.");
+
+      char *ptr = reinterpret_cast<char*>(mem);
+      head = new (ptr) header();
+      queue = reinterpret_cast<int*>(ptr + sizeof(header));
+      finished = new (queue + num_tiles) atomic<int>[num_tiles]();
+      pixels = reinterpret_cast<float (*)[4]>(finished + num_tiles);
+    }
+
+    ~shared_frame() { munmap(head, bytes); }
+
+    int tiles_finished(int num_tiles) const {
+      int count = 0;
+      for (int i = 0; i < num_tiles; ++i) count += (finished[i] ? 1 : 0);
+      return count;
+    }
+
+  private:
+
+    size_t bytes;
+
+  };
+
+  //workers in different processes only share the atomics' memory, so they must not rely on a lock
+  static_assert(ATOMIC_INT_LOCK_FREE == 2, "Multi-process rendering needs lock-free atomic ints.");
+  
+}
+
+#endif
+
+bool render_context::render_frame_processes(const string &entry_name,
+					    int width, int height, int tile_size,
+					    unsigned int num_processes,
+					    /* out */ float (*out)[4],
+					    const progress_callback &progress) {
+#ifdef __unix__
+  //compile the entry point before forking, so every worker shares the same code
+  entry_func entry = reinterpret_cast<entry_func>(kernel->get_function_pointer(entry_name));
+  
+  if (num_processes == 0) num_processes = max(1u, thread::hardware_concurrency());
+  if (tile_size <= 0) tile_size = auto_tile_size(width, height, num_processes);
+  
+  vector<tile> tiles = frame_tiles(width, height, tile_size);
+  int num_tiles = static_cast<int>(tiles.size());
+  shared_frame frame(num_tiles, width*height);
+  sd->frame = NULL;
+  prepare_lights();
+  cancel_flag = 0; //workers get their own copy of the flag, so they're cancelled through the shared frame
+
+  //runs in a worker process: renders tiles from the queue straight into the shared framebuffer
+  auto render_worker = [&] (unsigned int worker_id) -> int {
+    try {
+      thread_state state(worker_id + 1);
+      bind_thread_state(&state);
+      vector<float> buffer(4*tile_size*tile_size);
+      
+      while (!frame.head->cancelled) {
+	int q = frame.head->next_tile++;
+	if (q >= frame.head->queue_size) break;
+
+	const tile &t = tiles[frame.queue[q]];
+	entry(t.x, t.y, t.w, t.h, buffer.data());
+	if (geometry_failed()) return 1; //leave the tile unfinished
+	for (int y = 0; y < t.h; ++y) {
+	  memcpy(frame.pixels[(t.y + y)*width + t.x], buffer.data() + 4*y*t.w, 4*t.w*sizeof(float));
+	}
+
+	frame.finished[frame.queue[q]] = 1;
+      }
+    }
+    catch (...) {
+      return 1;
+    }
+    return 0;
+  };
+
+  //a worker that crashes loses the tile it was working on, so those get one more try on fresh workers
+  const int max_attempts = 2;
+  for (int attempt = 0; attempt < max_attempts && !frame.head->cancelled; ++attempt) {
+    int queue_size = 0;
+    for (int i = 0; i < num_tiles; ++i) {
+      if (!frame.finished[i]) frame.queue[queue_size++] = i;
+    }
+    if (queue_size == 0) break;
+
+    frame.head->queue_size = queue_size;
+    frame.head->next_tile = 0;
+
+    vector<pid_t> pids;
+    for (unsigned int i = 0; i < min(num_processes, static_cast<unsigned int>(queue_size)); ++i) {
+      pid_t pid = fork();
+      if (pid < 0) break; //out of processes, make do with the workers already started
+      if (pid == 0) _exit(render_worker(i)); //skip the parent's exit handlers and destructors
+      pids.push_back(pid);
+    }
+    if (pids.empty()) throw runtime_error("Could not start any render worker processes.");
+
+    //wait for the workers, reporting progress from this thread as tiles finish
+    int tiles_reported = -1;
+    while (!pids.empty()) {
+      for (auto it = pids.begin(); it != pids.end(); ) {
+	int status;
+	if (waitpid(*it, &status, WNOHANG) == *it) it = pids.erase(it);
+	else ++it;
+      }
+
+      int tiles_done = frame.tiles_finished(num_tiles);
+      if (tiles_done != tiles_reported) {
+	tiles_reported = tiles_done;
+	if (progress && !frame.head->cancelled && !progress(tiles_done, num_tiles)) frame.head->cancelled = 1;
+      }
+      
+      if (!pids.empty()) this_thread::sleep_for(chrono::milliseconds(5));
+    }
+  }
+
+  memcpy(out, frame.pixels, width*height*sizeof(float[4]));
+  if (frame.head->cancelled) return false;
+  if (frame.tiles_finished(num_tiles) < num_tiles) throw runtime_error("Render worker processes failed to render some tiles.");
+  return true;
+#else
+  throw runtime_error("Multi-process rendering isn't supported on this platform.");
+#endif
+}
+
+vector<render_context::tile> render_context::frame_tiles(int width, int height, int tile_size) const {
+  int num_x_tiles = (width + tile_size - 1) / tile_size;
+  int num_y_tiles = (height + tile_size - 1) / tile_size;
+  vector<int> sequence = tile_sequence(tiles_order, num_x_tiles, num_y_tiles);
+  vector<tile> tiles;
+
+  for (auto it = sequence.begin(); it != sequence.end(); ++it) {
+    int x0 = (*it % num_x_tiles) * tile_size;
+    int y0 = (*it / num_x_tiles) * tile_size;
+    tiles.push_back(tile{x0, y0, min(tile_size, width - x0), min(tile_size, height - y0), *it});
+  }
+  return tiles;
+}
+
+bool render_context::render_passes(const string &entry_name,
+				   int width, int height, int tile_size,
+				   unsigned int num_passes, bool accumulate, double publish_interval,
+				   /* out */ float (*out)[4],
+				   const progress_callback &progress, const publish_callback &publish,
+				   /* out */ unsigned int &passes_done) {
+  //look up the entry point up front, the kernel isn't safe to finalize from several threads
+  entry_func entry = reinterpret_cast<entry_func>(kernel->get_function_pointer(entry_name));
+  cancel_flag = 0;
+  if (!workers) {
+    workers.reset(new thread_pool(num_threads));
+
+    //give each worker its own random stream
+    for (unsigned int i = 0; i < workers->size(); ++i) worker_states.push_back(unique_ptr<thread_state>(new thread_state(i + 1)));
+  }
+  place_numa_data();
+  prepare_lights();
+
+  if (tile_size <= 0) tile_size = auto_tile_size(width, height, workers->size());
+  vector<tile> tiles = frame_tiles(width, height, tile_size);
+
+  vector<double> tile_seconds(tiles.size(), 0.0);
+  auto start = chrono::steady_clock::now();
+
+  passes_done = 0;
+  if (!accumulate) {
+    bool finished = render_tiles(entry, tiles, 0, width, tile_size, tile_seconds.data(), out, progress);
+    if (finished) passes_done = 1;
+    return finished;
+  }
+
+  accum.reset(new film(width, height, adaptive_threshold, adaptive_min_samples));
+  sd->frame = accum.get();
+
+  auto last_publish = start;
+  unsigned int published = 0;
+  bool finished = true;
+  vector<tile> pass_tiles;
+
+  try {
+    for (unsigned int pass = 0; pass < num_passes; ++pass) {
+      //only tiles with noisy pixels need another pass (every tile, unless adaptive sampling is on)
+      tiles.erase(remove_if(tiles.begin(), tiles.end(),
+			    [this] (const tile &t) { return accum->converged(t.x, t.y, t.w, t.h); }),
+		  tiles.end());
+      if (tiles.empty()) break;
+
+      pass_tiles = tiles;
+      if (time_budget > 0.0 && pass > 0) {
+	double time_left = time_budget - chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	select_budget_tiles(pass_tiles, tile_seconds, time_left);
+	if (pass_tiles.empty()) break;
+      }
+
+      accum->set_pass(pass);
+      finished = render_tiles(entry, pass_tiles, pass, width, tile_size, tile_seconds.data(), out, progress);
+      if (!finished) break;
+      ++passes_done;
+
+      auto now = chrono::steady_clock::now();
+      if (publish && chrono::duration<double>(now - last_publish).count() >= publish_interval) {
+	last_publish = now;
+	published = passes_done;
+	if (!publish(passes_done)) {
+	  finished = false;
+	  break;
+	}
+      }
+    }
+  }
+  catch (...) {
+    sd->frame = NULL;
+    throw;
+  }
+
+  sd->frame = NULL;
+
+  //always publish the final image
+  if (finished && publish && published != passes_done) publish(passes_done);
+  return finished;
+}
+
+void render_context::select_budget_tiles(/* inout */ vector<tile> &tiles, const vector<double> &tile_seconds,
+					 double time_left) const {
+  //visit the noisiest tiles first, so the remaining time evens out the noise across the frame
+  vector<pair<float, tile>> by_error;
+  for (auto it = tiles.begin(); it != tiles.end(); ++it) by_error.push_back(make_pair(accum->error(it->x, it->y, it->w, it->h), *it));
+  sort(by_error.begin(), by_error.end(),
+       [] (const pair<float, tile> &a, const pair<float, tile> &b) { return a.first > b.first; });
+
+  //tiles run in parallel, so each worker has 'time_left' seconds to spend
+  double thread_seconds = time_left * workers->size();
+  tiles.clear();
+  
+  for (auto it = by_error.begin(); it != by_error.end(); ++it) {
+    //stop at the first tile that won't fit, rather than spending the rest of the time on cleaner tiles
+    double cost = tile_seconds[it->second.id];
+    if (cost > time_left || cost > thread_seconds) break;
+
+    thread_seconds -= cost;
+    tiles.push_back(it->second);
+  }
+}
+
+bool render_context::render_tiles(entry_func entry, const vector<tile> &tiles, unsigned int pass,
+				  int width, int tile_size,
+				  /* out */ double *tile_seconds,
+				  /* out */ float (*out)[4],
+				  const progress_callback &progress) {
+  //each worker renders into its own tile buffer, which is then copied (or accumulated) into the frame
+  vector<vector<float>> tile_buffers(workers->size(), vector<float>(4*tile_size*tile_size));
+  mutex progress_lock;
+  int tiles_done = 0;
+  int total_tiles = static_cast<int>(tiles.size());
+
+  vector<thread_pool::task> tasks;
+  tasks.reserve(tiles.size());
+
+  for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+    tile t = *it;
+    tasks.push_back([&, t] (unsigned int worker_id) {
+	if (cancel_flag) return;
+
+	thread_state *state = worker_states[worker_id].get();
+	bind_thread_state(state);
+	state->samples.set_pass(pass);
+
+	float *buffer = tile_buffers[worker_id].data();
+	auto tile_start = chrono::steady_clock::now();
+	entry(t.x, t.y, t.w, t.h, buffer);
+	tile_seconds[t.id] = chrono::duration<double>(chrono::steady_clock::now() - tile_start).count();
+	if (geometry_failed()) cancel_flag = 1;
+	if (cancel_flag) return; //the kernel's loops may have stopped partway through the tile
+
+	if (sd->frame) {
+	  //add this pass to each pixel's estimate and write the result to the frame
+	  sd->frame->accumulate(t.x, t.y, t.w, t.h, buffer);
+	  sd->frame->resolve(t.x, t.y, t.w, t.h, out);
+	}
+	else {
+	  for (int y = 0; y < t.h; ++y) {
+	    memcpy(out[(t.y + y)*width + t.x], buffer + 4*y*t.w, 4*t.w*sizeof(float));
+	  }
+	}
+
+	lock_guard<mutex> lock(progress_lock);
+	++tiles_done;
+	if (progress && !progress(tiles_done, total_tiles)) cancel_flag = 1;
+      });
+  }
+
+  workers->run(tasks);
+  check_geometry();
+  return !cancel_flag;
+}
+
+void render_context::render_tile(const string &entry_name,
+				 int x, int y, int width, int height,
+				 /* out */ float (*out)[4]) {
+  entry_func entry = reinterpret_cast<entry_func>(kernel->get_function_pointer(entry_name));
+  
+  bind_main_thread();
+  prepare_lights();
+  cancel_flag = 0;
+  entry(x, y, width, height, reinterpret_cast<void*>(out));
+  check_geometry();
+}
+
+bool render_context::geometry_failed() const {
+  return scn->pager && scn->pager->failed();
+}
+
+void render_context::check_geometry() const {
+  if (geometry_failed()) throw runtime_error(scn->pager->error());
+}
+
+numa_stats render_context::numa_usage() const {
+  numa_stats stats;
+  stats.policy = static_cast<int32_t>(numa_mode);
+  stats.num_nodes = static_cast<int32_t>(topology.num_nodes());
+  stats.pinned_threads = static_cast<int32_t>(pinned_threads);
+  stats.bvh_replicas = static_cast<int32_t>(bvh_replicas.size());
+  stats.interleaved_bytes = interleaved_bytes;
+
+  stats.replicated_bytes = 0;
+  for (auto it = bvh_replicas.begin(); it != bvh_replicas.end(); ++it) {
+    stats.replicated_bytes += (*it)->node_memory() + (*it)->leaf_memory();
+  }
+  return stats;
+}
+
+memory_stats render_context::memory_usage() const {
+  memory_stats stats;
+  memset(&stats, 0, sizeof(memory_stats));
+
+  if (scn) {
+    stats.geometry = scn->geometry_memory();
+    stats.primitives = scn->primitive_memory();
+    stats.attributes = scn->attribute_memory();
+  }
+  if (light_hierarchy) stats.primitives += light_hierarchy->memory();
+  if (emitter_lights) stats.primitives += emitter_lights->memory();
+
+  if (accel) {
+    stats.bvh_nodes = accel->node_memory();
+    stats.bvh_leaves = accel->leaf_memory();
+  }
+
+  long long texture_bytes = 0;
+  if (sd->textures->getattribute("stat:cache_memory_used", TypeDesc::INT64, &texture_bytes)) {
+    stats.textures = static_cast<uint64_t>(texture_bytes);
+  }
+  if (scn) {
+    for (auto it = scn->environment_maps.begin(); it != scn->environment_maps.end(); ++it) stats.textures += (*it)->memory();
+  }
+
+  stats.shade_trees = static_cast<uint64_t>(max<int64_t>(raytrace::shade_tree::allocated_bytes(), 0));
+  if (kernel) stats.jit_code = kernel->code_size();
+  return stats;
 }
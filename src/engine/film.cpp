@@ -0,0 +1,123 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "engine/film.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace gideon;
+using namespace raytrace;
+
+constexpr float film::error_offset;
+
+film::film(int width, int height,
+	   float threshold, unsigned int min_samples) :
+  width(width), height(height),
+  threshold(threshold), min_samples(min_samples < 2 ? 2 : min_samples),
+  current_pass(0),
+  pixels(width*height, pixel{float4{0.0f, 0.0f, 0.0f, 0.0f}, 0.0f, 0.0f, 0, 0})
+{
+  
+}
+
+void film::add_sample(int x, int y, const float4 &color) {
+  pixel &p = pixels[y*width + x];
+  float lum = 0.2126f*color.x + 0.7152f*color.y + 0.0722f*color.z;
+  
+  ++p.n;
+  p.last_pass = current_pass;
+  float inv_n = 1.0f / p.n;
+  p.mean = p.mean + inv_n*(color - p.mean);
+
+  float delta = lum - p.lum_mean;
+  p.lum_mean += inv_n * delta;
+  p.lum_m2 += delta * (lum - p.lum_mean);
+}
+
+float film::error(int x, int y) const {
+  const pixel &p = pixels[y*width + x];
+  if (p.n < 2) return INFINITY;
+
+  float variance = p.lum_m2 / (p.n - 1);
+  return sqrtf(variance / p.n) / (fabsf(p.lum_mean) + error_offset);
+}
+
+void film::accumulate(int x0, int y0, int w, int h, const float *tile_buffer) {
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      const pixel &p = pixels[(y0 + y)*width + x0 + x];
+
+      //converged pixels are skipped by the kernel, so their part of the tile buffer is stale
+      if ((p.n > 0 && p.last_pass == current_pass) || converged(x0 + x, y0 + y)) continue;
+      
+      const float *color = tile_buffer + 4*(y*w + x);
+      add_sample(x0 + x, y0 + y, float4{color[0], color[1], color[2], color[3]});
+    }
+  }
+}
+
+float film::error(int x0, int y0, int w, int h, float max_error) const {
+  float total = 0.0f;
+  for (int y = y0; y < y0 + h; ++y) {
+    for (int x = x0; x < x0 + w; ++x) total += min(error(x, y), max_error);
+  }
+  return total / (w*h);
+}
+
+bool film::converged(int x, int y) const {
+  if (threshold <= 0.0f) return false;
+  if (pixels[y*width + x].n < min_samples) return false;
+  return error(x, y) <= threshold;
+}
+
+bool film::converged(int x0, int y0, int w, int h) const {
+  for (int y = y0; y < y0 + h; ++y) {
+    for (int x = x0; x < x0 + w; ++x) {
+      if (!converged(x, y)) return false;
+    }
+  }
+  return true;
+}
+
+unsigned long long film::total_samples() const {
+  unsigned long long total = 0;
+  for (auto it = pixels.begin(); it != pixels.end(); ++it) total += it->n;
+  return total;
+}
+
+void film::resolve(int x0, int y0, int w, int h,
+		   /* out */ float (*out)[4]) const {
+  for (int y = y0; y < y0 + h; ++y) {
+    for (int x = x0; x < x0 + w; ++x) {
+      const pixel &p = pixels[y*width + x];
+      if (p.n == 0) continue;
+
+      const float4 &m = p.mean;
+      float *pix = out[y*width + x];
+      pix[0] = m.x;
+      pix[1] = m.y;
+      pix[2] = m.z;
+      pix[3] = m.w;
+    }
+  }
+}
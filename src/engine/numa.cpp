@@ -0,0 +1,143 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "engine/numa.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#endif
+
+using namespace std;
+using namespace gideon;
+
+//Parses a sysfs CPU list like "0-7,16-23".
+static vector<unsigned int> parse_cpu_list(const string &list) {
+  vector<unsigned int> cpus;
+  stringstream ss(list);
+  string range;
+
+  while (getline(ss, range, ',')) {
+    size_t dash = range.find('-');
+    try {
+      unsigned int first = stoul(range.substr(0, dash));
+      unsigned int last = (dash == string::npos ? first : stoul(range.substr(dash + 1)));
+      for (unsigned int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    catch (exception &) { }
+  }
+
+  return cpus;
+}
+
+numa_topology numa_topology::detect() {
+  numa_topology topo;
+
+#ifdef __linux__
+  DIR *dir = opendir("/sys/devices/system/node");
+  if (dir) {
+    vector<unsigned int> ids;
+    while (dirent *entry = readdir(dir)) {
+      string name = entry->d_name;
+      if (name.compare(0, 4, "node") != 0 || name.size() == 4) continue;
+      if (!all_of(name.begin() + 4, name.end(), ::isdigit)) continue;
+      ids.push_back(stoul(name.substr(4)));
+    }
+    closedir(dir);
+    sort(ids.begin(), ids.end());
+    
+    for (auto it = ids.begin(); it != ids.end(); ++it) {
+      ifstream cpulist("/sys/devices/system/node/node" + to_string(*it) + "/cpulist");
+      string list;
+      getline(cpulist, list);
+
+      //memory-only nodes have no CPUs to run render threads on
+      vector<unsigned int> cpus = parse_cpu_list(list);
+      if (cpus.empty()) continue;
+
+      topo.node_cpus.push_back(cpus);
+      topo.node_ids.push_back(*it);
+    }
+  }
+#endif
+
+  if (topo.node_cpus.empty()) {
+    vector<unsigned int> all_cpus;
+    for (unsigned int cpu = 0; cpu < max(1u, thread::hardware_concurrency()); ++cpu) all_cpus.push_back(cpu);
+    topo.node_cpus.push_back(all_cpus);
+    topo.node_ids.push_back(0);
+  }
+  
+  return topo;
+}
+
+unsigned int numa_topology::worker_node(unsigned int worker, unsigned int num_workers) const {
+  if (num_workers == 0) return 0;
+  return min(num_nodes() - 1, worker * num_nodes() / num_workers);
+}
+
+bool numa_topology::interleave(const void *data, size_t bytes) const {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (num_nodes() < 2 || bytes == 0) return false;
+
+  //mbind works on whole pages, so cover every page the range touches
+  const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t start = reinterpret_cast<uintptr_t>(data) & ~(page_size - 1);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(data) + bytes + page_size - 1) & ~(page_size - 1);
+  
+  const unsigned long bits_per_word = 8 * sizeof(unsigned long);
+  unsigned long node_mask[16] = {0};
+  for (auto it = node_ids.begin(); it != node_ids.end(); ++it) {
+    if (*it < 16 * bits_per_word) node_mask[*it / bits_per_word] |= (1UL << (*it % bits_per_word));
+  }
+
+  const int mpol_interleave = 3;
+  const unsigned int mpol_mf_move = (1 << 1); //migrate pages that were already touched
+  long result = syscall(SYS_mbind, start, end - start, mpol_interleave,
+			node_mask, 16 * bits_per_word + 1, mpol_mf_move);
+  return (result == 0);
+#else
+  return false;
+#endif
+}
+
+bool gideon::set_thread_affinity(thread::native_handle_type thread, const vector<unsigned int> &cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto it = cpus.begin(); it != cpus.end(); ++it) {
+    if (*it < CPU_SETSIZE) CPU_SET(*it, &set);
+  }
+
+  return (pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set) == 0);
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,127 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "engine/thread_pool.hpp"
+#include "engine/numa.hpp"
+
+using namespace std;
+using namespace gideon;
+
+thread_pool::thread_pool(unsigned int num_threads) :
+  batch_id(0), num_pending(0), shutdown(false)
+{
+  if (num_threads == 0) num_threads = max(1u, thread::hardware_concurrency());
+
+  for (unsigned int i = 0; i < num_threads; ++i) queues.push_back(unique_ptr<worker_queue>(new worker_queue));
+  for (unsigned int i = 0; i < num_threads; ++i) workers.push_back(thread(&thread_pool::worker_loop, this, i));
+}
+
+thread_pool::~thread_pool() {
+  {
+    lock_guard<mutex> lock(batch_lock);
+    shutdown = true;
+  }
+  batch_start.notify_all();
+
+  for (auto it = workers.begin(); it != workers.end(); ++it) it->join();
+}
+
+bool thread_pool::pin_worker(unsigned int worker_id, const vector<unsigned int> &cpus) {
+  return set_thread_affinity(workers[worker_id].native_handle(), cpus);
+}
+
+void thread_pool::run(const vector<task> &tasks) {
+  if (tasks.empty()) return;
+
+  //set the count first, since workers still finishing the last batch may pick these up right away
+  {
+    lock_guard<mutex> lock(batch_lock);
+    num_pending = static_cast<unsigned int>(tasks.size());
+    error = nullptr;
+  }
+
+  //deal the tasks out round-robin, so each queue holds a spread of the batch
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    worker_queue &q = *queues[i % queues.size()];
+    lock_guard<mutex> lock(q.lock);
+    q.tasks.push_back(tasks[i]);
+  }
+
+  unique_lock<mutex> lock(batch_lock);
+  batch_id++;
+  batch_start.notify_all();
+
+  batch_done.wait(lock, [this] () { return num_pending == 0; });
+  if (error) rethrow_exception(error);
+}
+
+bool thread_pool::next_task(unsigned int worker_id, /* out */ task &t) {
+  //take from the front of our own queue
+  {
+    worker_queue &q = *queues[worker_id];
+    lock_guard<mutex> lock(q.lock);
+    if (!q.tasks.empty()) {
+      t = q.tasks.front();
+      q.tasks.pop_front();
+      return true;
+    }
+  }
+
+  //steal from the back of another worker's queue
+  for (size_t i = 1; i < queues.size(); ++i) {
+    worker_queue &q = *queues[(worker_id + i) % queues.size()];
+    lock_guard<mutex> lock(q.lock);
+    if (!q.tasks.empty()) {
+      t = q.tasks.back();
+      q.tasks.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void thread_pool::worker_loop(unsigned int worker_id) {
+  unsigned int last_batch = 0;
+
+  while (true) {
+    {
+      unique_lock<mutex> lock(batch_lock);
+      batch_start.wait(lock, [&] () { return shutdown || batch_id != last_batch; });
+      if (shutdown) return;
+      last_batch = batch_id;
+    }
+
+    task t;
+    while (next_task(worker_id, t)) {
+      try {
+	t(worker_id);
+      }
+      catch (...) {
+	lock_guard<mutex> lock(batch_lock);
+	if (!error) error = current_exception();
+      }
+
+      lock_guard<mutex> lock(batch_lock);
+      if (--num_pending == 0) batch_done.notify_all();
+    }
+  }
+}
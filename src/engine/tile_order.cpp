@@ -0,0 +1,120 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "engine/tile_order.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+using namespace std;
+using namespace gideon;
+
+uint32_t gideon::hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+  uint32_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) ? 1 : 0;
+    uint32_t ry = (y & s) ? 1 : 0;
+    d += s * s * ((3 * rx) ^ ry);
+
+    //rotate the quadrant so the curve stays continuous
+    if (ry == 0) {
+      if (rx == 1) {
+	x = s - 1 - x;
+	y = s - 1 - y;
+      }
+      swap(x, y);
+    }
+  }
+  return d;
+}
+
+//Spreads the lower 16 bits of x out to the even bits.
+static uint32_t spread_bits(uint32_t x) {
+  x &= 0x0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+uint32_t gideon::morton_index(uint32_t x, uint32_t y) {
+  return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+vector<int> gideon::tile_sequence(tile_order order, int num_x, int num_y) {
+  vector<int> tiles(num_x * num_y);
+  for (int i = 0; i < num_x * num_y; ++i) tiles[i] = i;
+
+  switch (order) {
+  case TILES_HILBERT:
+    {
+      uint32_t n = 1;
+      while (n < static_cast<uint32_t>(max(num_x, num_y))) n *= 2;
+
+      vector<uint32_t> key(tiles.size());
+      for (int i = 0; i < num_x * num_y; ++i) key[i] = hilbert_index(n, i % num_x, i / num_x);
+      sort(tiles.begin(), tiles.end(), [&key] (int a, int b) { return key[a] < key[b]; });
+    }
+    break;
+  case TILES_SPIRAL:
+    {
+      //visit rings of tiles around the center, going around each ring by angle
+      float cx = 0.5f * (num_x - 1), cy = 0.5f * (num_y - 1);
+      vector<pair<float, float>> key(tiles.size());
+      for (int i = 0; i < num_x * num_y; ++i) {
+	float dx = (i % num_x) - cx, dy = (i / num_x) - cy;
+	key[i] = make_pair(floorf(max(fabsf(dx), fabsf(dy))), atan2f(dy, dx));
+      }
+      sort(tiles.begin(), tiles.end(), [&key] (int a, int b) { return key[a] < key[b]; });
+    }
+    break;
+  default:
+    break;
+  }
+
+  return tiles;
+}
+
+void gideon::morton_pixel_order(int width, int height, /* out */ vector<uint32_t> &pixels) {
+  pixels.resize(width * height);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) pixels[y*width + x] = (static_cast<uint32_t>(y) << 16) | static_cast<uint32_t>(x);
+  }
+
+  sort(pixels.begin(), pixels.end(),
+       [] (uint32_t a, uint32_t b) { return morton_index(a & 0xffff, a >> 16) < morton_index(b & 0xffff, b >> 16); });
+}
+
+int gideon::auto_tile_size(int width, int height, unsigned int num_threads) {
+  //aim for at least 8 tiles per thread so the work stays balanced, without going below 8x8 pixels
+  const int max_size = 64, min_size = 8;
+  const int tiles_per_thread = 8;
+
+  int size = max_size;
+  while (size > min_size) {
+    int num_tiles = ((width + size - 1) / size) * ((height + size - 1) / size);
+    if (num_tiles >= tiles_per_thread * static_cast<int>(num_threads)) break;
+    size /= 2;
+  }
+  return size;
+}
@@ -0,0 +1,119 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "engine/wavefront.hpp"
+
+#include <algorithm>
+
+using namespace std;
+using namespace gideon;
+using namespace raytrace;
+
+void wavefront_queue::clear() {
+  paths.clear();
+  active.clear();
+  missed.clear();
+  shadow_rays.clear();
+}
+
+int wavefront_queue::add_path(const ray &r, int x, int y, int sample) {
+  int id = static_cast<int>(paths.size());
+  path p;
+  p.r = r;
+  p.throughput = float4{1.0f, 1.0f, 1.0f, 1.0f};
+  p.radiance = float4{0.0f, 0.0f, 0.0f, 0.0f};
+  p.bsdf_pdf = 0.0f;
+  p.light_normal = float3{0.0f, 0.0f, 0.0f};
+  p.x = x;
+  p.y = y;
+  p.sample = sample;
+  p.depth = 0;
+  p.active = true;
+
+  paths.push_back(p);
+  active.push_back(id);
+  return id;
+}
+
+int wavefront_queue::trace(const bvh &accel) {
+  //gather the rays of the active paths so the bvh can reorder them for coherent traversal
+  batch_rays.clear();
+  for (size_t i = 0; i < active.size(); ++i) {
+    if (paths[active[i]].active) batch_rays.push_back(paths[active[i]].r);
+  }
+  batch_hits.resize(batch_rays.size());
+  accel.trace_batch(batch_rays.data(), static_cast<int>(batch_rays.size()), batch_hits.data());
+
+  //paths keep their current order, so rays hitting the same material are shaded one after another
+  size_t num_active = 0, ray_idx = 0;
+  missed.clear();
+  for (size_t i = 0; i < active.size(); ++i) {
+    path &p = paths[active[i]];
+    if (!p.active) continue;
+
+    p.hit = batch_hits[ray_idx++];
+    if (p.hit.prim_idx >= 0) active[num_active++] = active[i];
+    else {
+      p.active = false;
+      missed.push_back(active[i]);
+    }
+  }
+
+  active.resize(num_active);
+  return static_cast<int>(num_active);
+}
+
+void wavefront_queue::sort_by_shader(const scene &s) {
+  //a stable sort keeps nearby pixels together within each material
+  stable_sort(active.begin(), active.end(),
+	      [this, &s] (int a, int b) {
+		const primitive &pa = s.primitives[paths[a].hit.prim_idx];
+		const primitive &pb = s.primitives[paths[b].hit.prim_idx];
+		if (pa.shader_id != pb.shader_id) return pa.shader_id < pb.shader_id;
+		return pa.volume_id < pb.volume_id;
+	      });
+}
+
+void wavefront_queue::continue_path(int id, const ray &r) {
+  path &p = paths[id];
+  p.r = r;
+  p.depth++;
+}
+
+void wavefront_queue::add_shadow_ray(int id, const ray &r, const float4 &L) {
+  shadow_rays.push_back(shadow_ray{r, L, id});
+}
+
+void wavefront_queue::trace_shadows(const bvh &accel) {
+  batch_rays.clear();
+  for (auto it = shadow_rays.begin(); it != shadow_rays.end(); ++it) batch_rays.push_back(it->r);
+  batch_occluded.resize(batch_rays.size());
+  accel.trace_any_batch(batch_rays.data(), static_cast<int>(batch_rays.size()), batch_occluded.data());
+
+  for (size_t i = 0; i < shadow_rays.size(); ++i) {
+    if (batch_occluded[i]) continue;
+    
+    path &p = paths[shadow_rays[i].path];
+    p.radiance = p.radiance + shadow_rays[i].L;
+  }
+
+  shadow_rays.clear();
+}
@@ -0,0 +1,118 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "geometry/strand.hpp"
+#include "math/util.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace raytrace;
+
+static const float strand_pi = 3.14159265359f;
+
+//a piece's box may be at most this many times the volume of the tube it bounds
+static const float strand_max_box_waste = 8.0f;
+static const int strand_max_splits = 8;
+
+static inline float3 strand_point(const float4 &p) { return float3{p.x, p.y, p.z}; }
+static inline float strand_radius(const float4 &p0, const float4 &p1, float t) { return (1.0f - t)*p0.w + t*p1.w; }
+
+bool raytrace::ray_strand_intersection(const float4 &p0, const float4 &p1, float t0, float t1,
+				       const ray &r, /* out */ intersection &isect) {
+  float3 a = strand_point(p0);
+  float3 ab = strand_point(p1) - a;
+  float3 w0 = r.o - a;
+
+  //find the closest point between the ray and the segment's axis
+  float dd = dot(r.d, r.d);
+  float d_ab = dot(r.d, ab);
+  float ab_ab = dot(ab, ab);
+  float d_w = dot(r.d, w0);
+  float ab_w = dot(ab, w0);
+  float denom = dd*ab_ab - d_ab*d_ab;
+
+  float s = (denom > epsilon*dd*ab_ab) ? (dd*ab_w - d_ab*d_w) / denom : t0; //ray parallel to the axis
+  s = std::min(std::max(s, t0), t1);
+
+  float3 Q = a + s*ab;
+  float radius = strand_radius(p0, p1, s);
+  float t = dot(Q - r.o, r.d) / dd;
+  
+  float3 offset = r.o + t*r.d - Q;
+  float dist2 = dot(offset, offset);
+  if (dist2 > radius*radius) return false;
+
+  //step back to where the ray enters the tube
+  t -= std::sqrt((radius*radius - dist2) / dd);
+  if (t < r.min_t || t > r.max_t) return false;
+
+  //build a frame facing the ray, perpendicular to the segment
+  float3 T = normalize(ab);
+  float3 front = dot(r.d, T)*T - r.d;
+  if (dot(front, front) < epsilon) return false;
+  front = normalize(front);
+  float3 side = cross(T, front);
+
+  float across = std::min(std::max(dot(offset, side) / radius, -1.0f), 1.0f);
+  
+  isect.t = t;
+  isect.u = s;
+  isect.v = 0.5f*(across + 1.0f);
+  isect.N = std::sqrt(1.0f - across*across)*front + across*side;
+  return true;
+}
+
+aabb raytrace::compute_strand_bbox(const float4 &p0, const float4 &p1, float t0, float t1) {
+  float3 a = strand_point(p0);
+  float3 ab = strand_point(p1) - a;
+  float3 q0 = a + t0*ab;
+  float3 q1 = a + t1*ab;
+  float radius = std::max(strand_radius(p0, p1, t0), strand_radius(p0, p1, t1));
+
+  aabb result;
+  result.pmin = float3{std::min(q0.x, q1.x) - radius, std::min(q0.y, q1.y) - radius, std::min(q0.z, q1.z) - radius};
+  result.pmax = float3{std::max(q0.x, q1.x) + radius, std::max(q0.y, q1.y) + radius, std::max(q0.z, q1.z) + radius};
+  return result;
+}
+
+int raytrace::strand_split_count(const float4 &p0, const float4 &p1) {
+  float len = length(strand_point(p1) - strand_point(p0));
+  float radius = std::max(p0.w, p1.w);
+  if (len < epsilon || radius < epsilon) return 1;
+
+  //keep halving the pieces until their boxes are close to the volume of the tube they contain
+  //(boxes of axis-aligned segments are already tight, so those are never split)
+  int n = 1;
+  while (n < strand_max_splits) {
+    float piece_len = len / n;
+    float tube_volume = strand_pi * radius*radius * (piece_len + 2.0f*radius);
+    if (compute_strand_bbox(p0, p1, 0.0f, 1.0f / n).volume() <= strand_max_box_waste * tube_volume) break;
+    n *= 2;
+  }
+  return n;
+}
+
+void raytrace::compute_strand_dP(const float4 &p0, const float4 &p1, float u, const float3 &N,
+				 /* out */ float3 &dPdu, /* out */ float3 &dPdv) {
+  dPdu = strand_point(p1) - strand_point(p0);
+  dPdv = (2.0f * strand_radius(p0, p1, u)) * normalize(cross(dPdu, N));
+}
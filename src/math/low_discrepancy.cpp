@@ -0,0 +1,331 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "math/low_discrepancy.hpp"
+#include "math/random.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+using namespace std;
+using namespace raytrace;
+
+namespace {
+
+  /* Primitive polynomials and initial direction numbers for dimensions 1 and up (from new-joe-kuo-6.21201). */
+  struct sobol_polynomial {
+    unsigned int degree, coefficients;
+    uint32_t m[8];
+  };
+
+  const sobol_polynomial sobol_polynomials[sobol_dimensions - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},
+    {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},
+    {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+    {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+    {7, 7, {1, 1, 3, 13, 7, 35, 63}},
+    {7, 8, {1, 3, 5, 9, 1, 25, 53}},
+    {7, 14, {1, 3, 1, 13, 9, 35, 107}},
+    {7, 19, {1, 3, 1, 5, 27, 61, 31}},
+    {7, 21, {1, 1, 5, 11, 19, 41, 61}},
+    {7, 28, {1, 3, 5, 3, 3, 13, 69}},
+    {7, 31, {1, 1, 7, 13, 1, 19, 1}},
+    {7, 32, {1, 3, 7, 5, 13, 19, 59}},
+    {7, 37, {1, 1, 3, 9, 25, 29, 41}},
+    {7, 41, {1, 3, 5, 13, 23, 1, 55}},
+    {7, 42, {1, 3, 7, 3, 13, 59, 17}},
+    {7, 50, {1, 3, 1, 3, 5, 53, 69}},
+    {7, 55, {1, 1, 5, 5, 23, 33, 13}},
+    {7, 56, {1, 1, 7, 7, 1, 61, 123}},
+    {7, 59, {1, 1, 7, 9, 13, 61, 49}},
+    {7, 62, {1, 3, 3, 5, 3, 55, 33}},
+    {8, 14, {1, 3, 1, 15, 31, 13, 49, 245}},
+    {8, 21, {1, 3, 5, 15, 31, 59, 63, 97}},
+    {8, 22, {1, 3, 1, 11, 11, 11, 77, 249}},
+    {8, 38, {1, 3, 1, 11, 27, 43, 71, 9}},
+    {8, 47, {1, 1, 7, 15, 21, 11, 81, 45}},
+    {8, 49, {1, 3, 7, 3, 25, 31, 65, 79}},
+    {8, 50, {1, 3, 1, 1, 19, 11, 3, 205}},
+    {8, 52, {1, 1, 5, 9, 19, 21, 29, 157}},
+    {8, 56, {1, 3, 7, 11, 1, 33, 89, 185}},
+    {8, 67, {1, 3, 3, 3, 15, 9, 79, 71}},
+    {8, 70, {1, 3, 7, 11, 15, 39, 119, 27}},
+    {8, 84, {1, 1, 3, 1, 11, 31, 97, 225}},
+    {8, 97, {1, 1, 1, 3, 23, 43, 57, 177}},
+    {8, 103, {1, 3, 7, 7, 17, 17, 37, 71}},
+    {8, 115, {1, 3, 1, 5, 27, 63, 123, 213}},
+    {8, 122, {1, 1, 3, 5, 11, 43, 53, 133}}
+  };
+
+  /* Direction numbers for every bit of the index, expanded from the polynomials above. */
+  struct sobol_matrices {
+    uint32_t v[sobol_dimensions][32];
+
+    sobol_matrices() {
+      //the first dimension is the van der Corput sequence
+      for (unsigned int k = 0; k < 32; ++k) v[0][k] = 1u << (31 - k);
+
+      for (unsigned int d = 1; d < sobol_dimensions; ++d) {
+	const sobol_polynomial &poly = sobol_polynomials[d - 1];
+	const unsigned int s = poly.degree;
+	uint32_t m[32];
+	
+	for (unsigned int k = 0; k < s; ++k) m[k] = poly.m[k];
+	for (unsigned int k = s; k < 32; ++k) {
+	  m[k] = m[k - s] ^ (m[k - s] << s);
+	  for (unsigned int j = 1; j < s; ++j) {
+	    if ((poly.coefficients >> (s - 1 - j)) & 1) m[k] ^= m[k - j] << j;
+	  }
+	}
+
+	for (unsigned int k = 0; k < 32; ++k) v[d][k] = m[k] << (31 - k);
+      }
+    }
+  };
+
+  const sobol_matrices &get_sobol_matrices() {
+    static const sobol_matrices matrices;
+    return matrices;
+  }
+
+  const uint32_t halton_primes[halton_dimensions] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+    59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+    227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+  };
+
+  inline uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+  }
+
+  //Dimensions past the end of a table repeat it with a different scramble.
+  inline uint32_t wrapped_seed(uint32_t seed, unsigned int dim, unsigned int table_size) {
+    return (dim < table_size) ? seed : pcg_hash(seed ^ pcg_hash(dim / table_size));
+  }
+
+  /* A blue-noise rank mask, from "The void-and-cluster method for dither array generation" (Ulichney 1993). */
+  class blue_noise_mask {
+  public:
+
+    uint32_t bits[blue_noise_size * blue_noise_size];
+
+    blue_noise_mask() : energy(num_pixels, 0.0f), kernel(num_pixels), ones(num_pixels, false) {
+      //toroidal gaussian energy kernel
+      for (unsigned int y = 0; y < blue_noise_size; ++y) {
+	for (unsigned int x = 0; x < blue_noise_size; ++x) {
+	  float dx = static_cast<float>(min(x, blue_noise_size - x));
+	  float dy = static_cast<float>(min(y, blue_noise_size - y));
+	  kernel[y*blue_noise_size + x] = expf(-(dx*dx + dy*dy) / (2.0f * sigma * sigma));
+	}
+      }
+
+      //random initial pattern covering a tenth of the pixels
+      counter_rng rng;
+      rng.seed(pcg_hash(0xb10e));
+      unsigned int num_initial = num_pixels / 10;
+      for (unsigned int placed = 0; placed < num_initial; ) {
+	unsigned int p = rng.next_uint() % num_pixels;
+	if (!ones[p]) {
+	  set(p, true);
+	  ++placed;
+	}
+      }
+
+      //move the tightest cluster into the largest void until the pattern is stable
+      while (true) {
+	unsigned int cluster = find(true);
+	set(cluster, false);
+	unsigned int void_pixel = find(false);
+	if (void_pixel == cluster) {
+	  set(cluster, true);
+	  break;
+	}
+	set(void_pixel, true);
+      }
+      
+      vector<bool> initial = ones;
+      vector<float> initial_energy = energy;
+      vector<unsigned int> rank(num_pixels);
+
+      //ranks below the initial pattern: remove the tightest clusters
+      for (unsigned int r = num_initial; r > 0; --r) {
+	unsigned int cluster = find(true);
+	set(cluster, false);
+	rank[cluster] = r - 1;
+      }
+
+      //ranks above it: fill the largest voids
+      ones = initial;
+      energy = initial_energy;
+      for (unsigned int r = num_initial; r < num_pixels; ++r) {
+	unsigned int void_pixel = find(false);
+	set(void_pixel, true);
+	rank[void_pixel] = r;
+      }
+
+      //each rank maps to the center of its own interval of [0, 1)
+      for (unsigned int p = 0; p < num_pixels; ++p) {
+	bits[p] = static_cast<uint32_t>(((static_cast<uint64_t>(rank[p]) << 33) + (1ull << 32)) / (2 * num_pixels));
+      }
+    }
+
+  private:
+
+    static const unsigned int num_pixels = blue_noise_size * blue_noise_size;
+    static constexpr float sigma = 1.5f;
+    
+    vector<float> energy, kernel;
+    vector<bool> ones;
+
+    //Adds or removes a pixel from the pattern, updating the energy of every pixel.
+    void set(unsigned int p, bool value) {
+      ones[p] = value;
+      float sign = value ? 1.0f : -1.0f;
+      unsigned int px = p % blue_noise_size, py = p / blue_noise_size;
+      
+      for (unsigned int y = 0; y < blue_noise_size; ++y) {
+	const float *row = &kernel[((y + blue_noise_size - py) % blue_noise_size) * blue_noise_size];
+	float *out = &energy[y * blue_noise_size];
+	for (unsigned int x = 0; x < blue_noise_size; ++x) out[x] += sign * row[(x + blue_noise_size - px) % blue_noise_size];
+      }
+    }
+
+    //Finds the tightest cluster (the one with the most energy) or the largest void (the zero with the least).
+    unsigned int find(bool cluster) const {
+      unsigned int best = num_pixels;
+      for (unsigned int p = 0; p < num_pixels; ++p) {
+	if (ones[p] != cluster) continue;
+	if (best == num_pixels || (cluster ? energy[p] > energy[best] : energy[p] < energy[best])) best = p;
+      }
+      return best;
+    }
+    
+  };
+
+  const blue_noise_mask &get_blue_noise_mask() {
+    static const blue_noise_mask mask;
+    return mask;
+  }
+
+  /* Steps of the R_d lattices of up to max_lattice_dims dimensions ("The Unreasonable Effectiveness of Quasirandom Sequences", Roberts 2018). */
+  const unsigned int max_lattice_dims = 8;
+  
+  struct lattice_steps {
+    uint32_t step[max_lattice_dims][max_lattice_dims];
+
+    lattice_steps() {
+      for (unsigned int d = 1; d <= max_lattice_dims; ++d) {
+	//phi is the positive root of x^(d+1) = x + 1
+	double phi = 2.0;
+	for (int i = 0; i < 64; ++i) phi = pow(1.0 + phi, 1.0 / (d + 1));
+
+	double alpha = 1.0;
+	for (unsigned int j = 0; j < d; ++j) {
+	  alpha /= phi;
+	  step[d - 1][j] = static_cast<uint32_t>(alpha * 4294967296.0);
+	}
+      }
+    }
+  };
+
+  const float one_minus_epsilon = 0.99999994f; //largest float below 1
+  
+}
+
+uint32_t raytrace::sobol_bits(uint32_t index, unsigned int dim) {
+  const uint32_t *v = get_sobol_matrices().v[dim % sobol_dimensions];
+  uint32_t bits = 0;
+  for (unsigned int k = 0; index != 0; index >>= 1, ++k) {
+    bits ^= v[k] & (0u - (index & 1)); //branch-free, since the index's bits are unpredictable
+  }
+  return bits;
+}
+
+uint32_t raytrace::owen_scramble(uint32_t v, uint32_t seed) {
+  //each bit of the reversed value may only be affected by the bits below it
+  v = reverse_bits(v);
+  v += seed;
+  v ^= v * 0x6c50b47cu;
+  v ^= v * 0xb82f1e52u;
+  v ^= v * 0xc7afe638u;
+  v ^= v * 0x8d22f6e6u;
+  return reverse_bits(v);
+}
+
+float raytrace::sobol_owen(uint32_t index, unsigned int dim, uint32_t seed) {
+  return sobol_owen_bits(sobol_bits(index, dim), dim, seed);
+}
+
+float raytrace::sobol_owen_bits(uint32_t bits, unsigned int dim, uint32_t seed) {
+  return random_unit_float(owen_scramble(bits, wrapped_seed(seed, dim, sobol_dimensions)));
+}
+
+float raytrace::halton_owen(uint32_t index, unsigned int dim, uint32_t seed) {
+  const uint32_t base = halton_primes[dim % halton_dimensions];
+  const double inv_base = 1.0 / base;
+  uint32_t node = wrapped_seed(seed, dim, halton_dimensions);
+  
+  double value = 0.0, scale = inv_base;
+  while (index != 0) {
+    uint32_t digit = index % base;
+    index /= base;
+
+    value += ((digit + pcg_hash(node)) % base) * scale;
+    node = pcg_hash(node ^ (digit + 1) * 0x9e3779b9u);
+    scale *= inv_base;
+  }
+
+  //the scrambled zeros past the index's last digit are independent random digits, which add up to a uniform offset
+  value += random_unit_float(pcg_hash(node)) * scale * base;
+  return min(static_cast<float>(value), one_minus_epsilon);
+}
+
+uint32_t raytrace::blue_noise_bits(unsigned int x, unsigned int y) {
+  return get_blue_noise_mask().bits[(y % blue_noise_size) * blue_noise_size + (x % blue_noise_size)];
+}
+
+uint32_t raytrace::lattice_step_bits(unsigned int dims, unsigned int j) {
+  static const lattice_steps steps;
+  dims = min(dims, max_lattice_dims);
+  return steps.step[dims - 1][j % dims];
+}
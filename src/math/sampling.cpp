@@ -20,6 +20,7 @@
 */
 
 #include "math/sampling.hpp"
+#include "math/low_discrepancy.hpp"
 
 #include <algorithm>
 #include <iostream>
@@ -84,121 +85,271 @@ float3 raytrace::cosine_sample_hemisphere(const float3 &N, float rand_u, float r
 }
 
 float3 raytrace::uniform_sample_sphere(float rand_u, float rand_v) {
-  float z = 2.0f * (rand_u - 1.0f);
+  float z = 1.0f - 2.0f * rand_u;
   float t = rand_v * 2.0f * pi;
   
   float r = sqrtf(1.0f - (z*z));
   return {r*cosf(t), r*sinf(t), z};
 }
 
+float2 raytrace::uniform_sample_triangle(float rand_u, float rand_v) {
+  float su = sqrtf(rand_u);
+  return {rand_v * su, 1.0f - su};
+}
+
+/* Alias Table */
+
+alias_table::alias_table(const vector<float> &item_weights) :
+  prob(item_weights.size(), 1.0f), weights(item_weights), alias(item_weights.size()), total_weight(0.0f)
+{
+  double total = 0.0;
+  for (auto it = weights.begin(); it != weights.end(); ++it) {
+    *it = max(0.0f, *it);
+    total += *it;
+  }
+  total_weight = static_cast<float>(total);
+  if (total <= 0.0) return;
+
+  //scale the weights so they average 1, then let each item under 1 be topped up by one over 1
+  size_t N = weights.size();
+  vector<double> scaled(N);
+  vector<int> small, large;
+  for (size_t i = 0; i < N; ++i) {
+    alias[i] = static_cast<int>(i);
+    scaled[i] = weights[i] * N / total;
+    if (scaled[i] < 1.0) small.push_back(static_cast<int>(i));
+    else large.push_back(static_cast<int>(i));
+  }
+
+  while (!small.empty() && !large.empty()) {
+    int s = small.back(), l = large.back();
+    small.pop_back();
+    
+    prob[s] = static_cast<float>(scaled[s]);
+    alias[s] = l;
+    scaled[l] -= 1.0 - scaled[s];
+    if (scaled[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+
+  //whatever is left is (up to rounding) exactly 1
+  for (auto it = small.begin(); it != small.end(); ++it) prob[*it] = 1.0f;
+  for (auto it = large.begin(); it != large.end(); ++it) prob[*it] = 1.0f;
+}
+
+int alias_table::sample(float rand_u, /* out */ float &pmf) const {
+  if (total_weight <= 0.0f) {
+    pmf = 0.0f;
+    return -1;
+  }
+
+  //the integer part of u*N picks a column, the fraction picks between the item and its alias
+  float x = rand_u * prob.size();
+  int i = min(static_cast<int>(x), static_cast<int>(prob.size()) - 1);
+  int picked = ((x - i) < prob[i]) ? i : alias[i];
+
+  pmf = weights[picked] / total_weight;
+  return picked;
+}
+
 /* Sampler Implementation */
 
-sampler::sampler() :
-  rng(bind(uniform_real_distribution<float>(0.0f, 1.0f),
-	   mt19937(current_pixel_sample))),
+namespace {
+
+  //Key of a dimension's random numbers (dimension 0 of each sample keys the sampler's random() stream).
+  inline uint32_t dimension_key(unsigned int px, unsigned int py, unsigned int index, unsigned int dim) {
+    return random_key(px, py, index, dim + 1);
+  }
+
+  //Fills N points of a set, writing dimension d of point i to out[i*stride + d].
+  void generate_points(sampler::sample_generator generator,
+		       unsigned int px, unsigned int py, unsigned int index, unsigned int first_dim,
+		       unsigned int dim, unsigned int N, unsigned int stride,
+		       /* out */ float *out) {
+    switch (generator) {
+    case sampler::GENERATOR_UNIFORM:
+      for (unsigned int d = 0; d < dim; ++d) {
+	counter_rng rng;
+	rng.seed(dimension_key(px, py, index, first_dim + d));
+	for (unsigned int i = 0; i < N; ++i) out[i*stride + d] = rng.next();
+      }
+      break;
+
+    case sampler::GENERATOR_LHS:
+      {
+	float delta = 1.0f / N;
+	for (unsigned int d = 0; d < dim; ++d) {
+	  counter_rng rng;
+	  rng.seed(dimension_key(px, py, index, first_dim + d));
+
+	  //one sample per stratum, shuffled independently in each dimension
+	  for (unsigned int i = 0; i < N; ++i) out[i*stride + d] = (i + rng.next()) * delta;
+	  for (unsigned int i = N; i > 1; --i) {
+	    unsigned int other = rng.next_uint() % i;
+	    swap(out[(i - 1)*stride + d], out[other*stride + d]);
+	  }
+	}
+      }
+      break;
+
+    case sampler::GENERATOR_SOBOL:
+      for (unsigned int d = 0; d < dim; ++d) {
+	uint32_t seed = random_key(px, py, first_dim + d, 0x50b01u);
+	if ((N & (N - 1)) == 0) {
+	  //the sequence is linear (over XOR) in the index's bits, so the points of an aligned power-of-two block
+	  //only differ by the first N points
+	  uint32_t block = sobol_bits(index*N, first_dim + d);
+	  for (unsigned int i = 0; i < N; ++i) {
+	    out[i*stride + d] = sobol_owen_bits(block ^ sobol_bits(i, first_dim + d), first_dim + d, seed);
+	  }
+	}
+	else {
+	  for (unsigned int i = 0; i < N; ++i) out[i*stride + d] = sobol_owen(index*N + i, first_dim + d, seed);
+	}
+      }
+      break;
+
+    case sampler::GENERATOR_BLUENOISE:
+      //Cranley-Patterson rotation of a rank-1 lattice by blue noise, so neighbouring pixels' errors cancel out
+      for (unsigned int d = 0; d < dim; ++d) {
+	uint32_t shift = pcg_hash(first_dim + d);
+	uint32_t offset = blue_noise_bits(px + (shift & 0xffff), py + (shift >> 16));
+	uint32_t step = lattice_step_bits(dim, d);
+	for (unsigned int i = 0; i < N; ++i) out[i*stride + d] = random_unit_float(offset + (index*N + i) * step);
+      }
+      break;
+      
+    case sampler::GENERATOR_HALTON:
+      for (unsigned int d = 0; d < dim; ++d) {
+	uint32_t seed = random_key(px, py, first_dim + d, 0x4a170u);
+	for (unsigned int i = 0; i < N; ++i) out[i*stride + d] = halton_owen(index*N + i, first_dim + d, seed);
+      }
+      break;
+    }
+  }
+
+}
+
+const size_t sampler::max_table_size;
+
+sampler::sampler(unsigned int seed) :
+  x0(0), y0(0),
   width(0), height(0), samples_per_pixel(0),
   current_x(0), current_y(0),
-  current_pixel_sample(0)
-{}
+  current_pixel_sample(0), current_pass(0),
+  image_sample_generator(GENERATOR_UNIFORM),
+  sample_stride(2), next_dim(2),
+  table_first_pixel(0), table_pixels(0),
+  current_values(NULL)
+{
+  stream.seed(pcg_hash(seed));
+}
 
-void sampler::setup(unsigned int width, unsigned int height, unsigned int samples_per_pixel,
-		    const sample_generator &generator) {
+void sampler::setup(unsigned int x0, unsigned int y0,
+		    unsigned int width, unsigned int height, unsigned int samples_per_pixel,
+		    sample_generator generator) {
   sample_offset.clear();
   sample_dimensions.clear();
+  sample_count.clear();
+  sample_first_dim.clear();
   sample_generators.clear();
-  sample_values.clear();
 
-  image_samples.resize(2*samples_per_pixel);
+  //the image sample takes the first two values (and dimensions) of each sample
+  sample_stride = 2;
+  next_dim = 2;
+  table_pixels = 0;
 
+  this->x0 = x0;
+  this->y0 = y0;
   this->width = width;
   this->height = height;
   this->samples_per_pixel = samples_per_pixel;
   image_sample_generator = generator;
 
   current_x = current_y = 0;
-  current_pixel_sample = 0;
+  current_pixel_sample = samples_per_pixel; //generate new image samples on the first call to next_sample
 }
 
-sampler::sample_id sampler::add(unsigned int dim, unsigned int N, const sample_generator &generator) {
-  unsigned int offset = sample_values.size();
+sampler::sample_id sampler::add(unsigned int dim, unsigned int N, sample_generator generator) {
   sample_id id = static_cast<sample_id>(sample_offset.size());
   
-  sample_values.resize(sample_values.size() + dim*N);
-  sample_offset.push_back(offset);
+  sample_offset.push_back(sample_stride);
   sample_dimensions.push_back(dim);
+  sample_count.push_back(N);
+  sample_first_dim.push_back(next_dim);
   sample_generators.push_back(generator);
+
+  sample_stride += dim*N;
+  next_dim += dim;
+  table_pixels = 0;
   
   return id;
 }
 
 unsigned int sampler::get_offset(sample_id s) const { return sample_offset[static_cast<unsigned int>(s)]; }
 
-float sampler::access_1d(unsigned int idx) const { return sample_values[idx]; }
-float2 sampler::access_2d(unsigned int idx) const { return float2{sample_values[idx], sample_values[idx+1]}; }
-
 void sampler::next_sample(unsigned int x, unsigned int y,
 			  /* out */ float2 *image_sample) {
-  if (current_pixel_sample == samples_per_pixel) {
-    //generate samples for current pixel
-    image_sample_generator(x, y, 2, samples_per_pixel, &image_samples[0]);
+  if (current_pixel_sample >= samples_per_pixel || x != current_x || y != current_y) {
+    current_x = x;
+    current_y = y;
     current_pixel_sample = 0;
-    *image_sample = float2{image_samples[0], image_samples[1]};
-  }
-  else {
-    *image_sample = float2{image_samples[current_pixel_sample], image_samples[current_pixel_sample+1]};
-    ++current_pixel_sample;
   }
 
-
-  prepare_samples(x, y);
-}
-
-void sampler::prepare_samples(unsigned int x, unsigned int y) {
-  unsigned int sample_idx = 0;
-  for (auto gen_it = sample_generators.begin(); gen_it != sample_generators.end(); ++gen_it, ++sample_idx) {
-    unsigned int start = sample_offset[sample_idx];
-    unsigned int end = (sample_idx == sample_offset.size() - 1) ? sample_values.size() : sample_offset[sample_idx + 1];
-
-    (*gen_it)(x, y, sample_dimensions[sample_idx], end - start, &sample_values[start]);
+  //make sure this pixel's samples have been generated (for the whole tile, if it fits)
+  unsigned int pixel = y*width + x;
+  if (pixel < table_first_pixel || pixel >= table_first_pixel + table_pixels) {
+    size_t tile_size = static_cast<size_t>(width) * height * samples_per_pixel * sample_stride;
+    if (tile_size <= max_table_size) fill_table(0, width*height);
+    else fill_table(pixel, 1);
   }
-}
-
-float sampler::random() { return rng(); }
 
-unsigned int sampler::random_uint() { return static_cast<unsigned int>(rand()); }
+  unsigned int index = current_pass*samples_per_pixel + current_pixel_sample;
+  current_values = &table[((pixel - table_first_pixel)*samples_per_pixel + current_pixel_sample) * sample_stride];
+  *image_sample = float2{current_values[0], current_values[1]};
 
-sampler::sample_generator sampler::uniform() {
-  return [this] (unsigned int x, unsigned int y,
-		 unsigned int dim, unsigned int N,
-		 /* out */ float *samples) -> void {
-    for (unsigned int i = 0; i < dim*N; ++i) samples[i] = random();
-  };
+  stream.seed(random_key(x0 + x, y0 + y, index, 0));
+  ++current_pixel_sample;
 }
 
-sampler::sample_generator sampler::latin_hypercube() {
-  return [this] (unsigned int x, unsigned int y,
-		 unsigned int dim, unsigned int N,
-		 /* out */ float *samples) -> void {
-    float delta = 1.0 / N;
-    //generate samples along diagonal
-    for (unsigned int i = 0; i < N; ++i) {
-      for (unsigned int d = 0; d < dim; ++d) {
-	samples[dim*i + d] = (i + random()) * delta;
+void sampler::fill_table(unsigned int first_pixel, unsigned int num_pixels) {
+  table.resize(static_cast<size_t>(num_pixels) * samples_per_pixel * sample_stride);
+  table_first_pixel = first_pixel;
+  table_pixels = num_pixels;
+
+  unsigned int num_sets = sample_offset.size();
+  for (unsigned int p = 0; p < num_pixels; ++p) {
+    unsigned int px = x0 + (first_pixel + p) % width;
+    unsigned int py = y0 + (first_pixel + p) / width;
+    float *pixel_values = &table[static_cast<size_t>(p) * samples_per_pixel * sample_stride];
+
+    //image samples are stratified across all of the pixel's samples in this pass
+    generate_points(image_sample_generator, px, py, current_pass, 0, 2, samples_per_pixel, sample_stride, pixel_values);
+
+    for (unsigned int k = 0; k < samples_per_pixel; ++k) {
+      unsigned int index = current_pass*samples_per_pixel + k;
+      float *values = pixel_values + k*sample_stride;
+      
+      for (unsigned int set = 0; set < num_sets; ++set) {
+	generate_points(sample_generators[set], px, py, index, sample_first_dim[set],
+			sample_dimensions[set], sample_count[set], sample_dimensions[set],
+			values + sample_offset[set]);
       }
     }
-
-    //permute samples in each dimension
-    for (unsigned int d = 0; d < dim; ++d) {
-      for (unsigned int j = 0; j < N; ++j) {
-	unsigned int other = random_uint() % N;
-	swap(samples[dim*j + d], samples[dim*other + d]);	     
-      }
-    }
-  };
+  }
 }
 
+float sampler::random() { return stream.next(); }
+
+unsigned int sampler::random_uint() { return stream.next_uint(); }
+
 sampler::sample_generator sampler::select_generator(const string &name) {
-  if (name == "uniform") return uniform();
-  if (name == "lhs") return latin_hypercube();
+  if (name == "uniform") return GENERATOR_UNIFORM;
+  if (name == "lhs") return GENERATOR_LHS;
+  if (name == "sobol") return GENERATOR_SOBOL;
+  if (name == "halton") return GENERATOR_HALTON;
+  if (name == "bluenoise") return GENERATOR_BLUENOISE;
   throw runtime_error("Unsupport sample generation strategy.");
 }
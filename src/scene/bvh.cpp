@@ -20,7 +20,11 @@
 */
 
 #include "scene/bvh.hpp"
+#include "geometry/triangle.hpp"
+
 #include <iostream>
+#include <algorithm>
+#include <cstdint>
 
 using namespace std;
 using namespace raytrace;
@@ -32,6 +36,7 @@ raytrace::bvh::bvh(const scene &s,
 		   const vector<int> &leaf_prim_list) :
   active_scene(&s),
   num_nodes(node_list.size()),
+  num_leaf_entries(leaf_prim_list.size()),
   nodes(new node[node_list.size()]),
   leaf_array(new int[leaf_prim_list.size()])
 {
@@ -39,6 +44,17 @@ raytrace::bvh::bvh(const scene &s,
   copy(leaf_prim_list.begin(), leaf_prim_list.end(), leaf_array);
 }
 
+raytrace::bvh::bvh(const bvh &other) :
+  active_scene(other.active_scene),
+  num_nodes(other.num_nodes),
+  num_leaf_entries(other.num_leaf_entries),
+  nodes(new node[other.num_nodes]),
+  leaf_array(new int[other.num_leaf_entries])
+{
+  copy(other.nodes, other.nodes + num_nodes, nodes);
+  copy(other.leaf_array, other.leaf_array + num_leaf_entries, leaf_array);
+}
+
 raytrace::bvh::~bvh() {
   delete[] nodes;
   delete[] leaf_array;
@@ -66,6 +82,25 @@ void raytrace::bvh::debug_print() const {
   }
 }
 
+void raytrace::bvh::foreach_leaf(const boost::function<void (const int *, int)> &on_leaf) const {
+  if (num_nodes == 0) return;
+
+  vector<int> stack;
+  stack.push_back(0);
+
+  while (!stack.empty()) {
+    const node &n = nodes[stack.back()];
+    stack.pop_back();
+
+    if (n.type == node::LEAF) on_leaf(leaf_array + n.indices.x, n.indices.y - n.indices.x);
+    else {
+      //push the right child first so the left subtree is visited first
+      stack.push_back(n.indices.y);
+      stack.push_back(n.indices.x);
+    }
+  }
+}
+
 bool raytrace::bvh::trace(const ray &r,
 			  /* out */ intersection &isect,
 			  /* out */ unsigned int &aabb_checked,
@@ -82,9 +117,11 @@ bool raytrace::bvh::trace(const ray &r,
 
   float t0, t1;
   if (!ray_aabb_intersection(root.bounds, r, t0, t1)) return false;
+
+  geometry_pager::page_ptr page;
   
   //if the root is also a leaf, check its primitives and return
-  if (root.type == node::LEAF) return intersect_leaf(root, r, closest_t, isect, prim_checked);
+  if (root.type == node::LEAF) return intersect_leaf(root, r, closest_t, isect, prim_checked, page);
 
   //traverse the hierarchy
   bool hit_prim = false;
@@ -124,21 +161,21 @@ bool raytrace::bvh::trace(const ray &r,
     
     if (!check_left) {
       //check only the right child
-      check_node(right_child, curr_node.indices.y, r, closest_t, isect, prim_checked, hit_prim, stack_size);
+      check_node(right_child, curr_node.indices.y, r, closest_t, isect, prim_checked, hit_prim, stack_size, page);
     }
     else if (!check_right) {
       //check only the left child
-      check_node(left_child, curr_node.indices.x, r, closest_t, isect, prim_checked, hit_prim, stack_size);
+      check_node(left_child, curr_node.indices.x, r, closest_t, isect, prim_checked, hit_prim, stack_size, page);
     }
     else {
       //check the closest child first
       if (left_range.x < right_range.x) {
-	check_node(left_child, curr_node.indices.x, r, closest_t, isect, prim_checked, hit_prim, stack_size);
-	if (!hit_prim || (right_range.x < closest_t)) check_node(right_child, curr_node.indices.y, r, closest_t, isect, prim_checked, hit_prim, stack_size);
+	check_node(left_child, curr_node.indices.x, r, closest_t, isect, prim_checked, hit_prim, stack_size, page);
+	if (!hit_prim || (right_range.x < closest_t)) check_node(right_child, curr_node.indices.y, r, closest_t, isect, prim_checked, hit_prim, stack_size, page);
       }
       else {
-	check_node(right_child, curr_node.indices.y, r, closest_t, isect, prim_checked, hit_prim, stack_size);
-	if (!hit_prim || (left_range.x < closest_t)) check_node(left_child, curr_node.indices.x, r, closest_t, isect, prim_checked, hit_prim, stack_size);
+	check_node(right_child, curr_node.indices.y, r, closest_t, isect, prim_checked, hit_prim, stack_size, page);
+	if (!hit_prim || (left_range.x < closest_t)) check_node(left_child, curr_node.indices.x, r, closest_t, isect, prim_checked, hit_prim, stack_size, page);
       }
     }
 
@@ -148,32 +185,201 @@ bool raytrace::bvh::trace(const ray &r,
   return hit_prim;
 }
 
+bool raytrace::bvh::trace_any(const ray &r) const {
+  if (num_nodes == 0) return false;
+
+  float t0, t1;
+  if (!ray_aabb_intersection(nodes[0].bounds, r, t0, t1)) return false;
+
+  geometry_pager::page_ptr page;
+
+  //any hit will do, so there's no need to visit the children in order
+  traversal_stack[0] = 0;
+  size_t stack_size = 1;
+
+  while (stack_size > 0) {
+    node &curr_node = nodes[traversal_stack[--stack_size]];
+
+    if (curr_node.type == node::LEAF) {
+      if (occluded_by_leaf(curr_node, r, page)) return true;
+      continue;
+    }
+
+    for (int child : {curr_node.indices.x, curr_node.indices.y}) {
+      if (!ray_aabb_intersection(nodes[child].bounds, r, t0, t1)) continue;
+      if (stack_size < max_stack_depth) traversal_stack[stack_size++] = child;
+      else if (occluded_by_subtree(child, r, page)) return true;
+    }
+  }
+
+  return false;
+}
+
+//Spreads the low 10 bits of x out to every third bit.
+static uint32_t expand_bits_3d(uint32_t x) {
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+//Sorts the indices of n rays by direction octant (top 3 bits) and the Morton code of the ray's origin within the scene
+//bounds, so rays traveling through the same part of the tree are traced one after another.
+void raytrace::bvh::batch_order(const ray *rays, int n, /* out */ vector<uint64_t> &order) const {
+  const aabb &bounds = nodes[0].bounds;
+  float3 extent = bounds.pmax - bounds.pmin;
+  float3 scale{extent.x > 0.0f ? 1023.0f / extent.x : 0.0f,
+      extent.y > 0.0f ? 1023.0f / extent.y : 0.0f,
+      extent.z > 0.0f ? 1023.0f / extent.z : 0.0f};
+  
+  auto quantize = [] (float v) -> uint32_t { return static_cast<uint32_t>(max(0.0f, min(v, 1023.0f))); };
+
+  //the ray's index is kept in the low half, so the results can be written back in the original order
+  order.resize(n);
+  for (int i = 0; i < n; i++) {
+    const ray &r = rays[i];
+    uint32_t octant = (r.d.x < 0.0f ? 1 : 0) | (r.d.y < 0.0f ? 2 : 0) | (r.d.z < 0.0f ? 4 : 0);
+    uint32_t cell = ((expand_bits_3d(quantize((r.o.x - bounds.pmin.x) * scale.x)) << 2) |
+		     (expand_bits_3d(quantize((r.o.y - bounds.pmin.y) * scale.y)) << 1) |
+		     expand_bits_3d(quantize((r.o.z - bounds.pmin.z) * scale.z)));
+    
+    uint64_t key = (octant << 29) | (cell >> 1);
+    order[i] = (key << 32) | static_cast<uint32_t>(i);
+  }
+  sort(order.begin(), order.end());
+}
+
+int raytrace::bvh::trace_batch(const ray *rays, int n, /* out */ intersection *hits) const {
+  if (n <= 0) return 0;
+  if (num_nodes == 0) {
+    for (int i = 0; i < n; i++) hits[i].prim_idx = -1;
+    return 0;
+  }
+
+  vector<uint64_t> order;
+  batch_order(rays, n, order);
+
+  int num_hits = 0;
+  unsigned int aabb_checked, prim_checked;
+  
+  for (int i = 0; i < n; i++) {
+    int idx = static_cast<int>(order[i] & 0xffffffff);
+    if (trace(rays[idx], hits[idx], aabb_checked, prim_checked)) num_hits++;
+    else hits[idx].prim_idx = -1;
+  }
+
+  return num_hits;
+}
+
+int raytrace::bvh::trace_any_batch(const ray *rays, int n, /* out */ char *occluded) const {
+  if (n <= 0) return 0;
+  if (num_nodes == 0) {
+    for (int i = 0; i < n; i++) occluded[i] = 0;
+    return 0;
+  }
+
+  vector<uint64_t> order;
+  batch_order(rays, n, order);
+
+  int num_occluded = 0;
+  for (int i = 0; i < n; i++) {
+    int idx = static_cast<int>(order[i] & 0xffffffff);
+    occluded[idx] = trace_any(rays[idx]) ? 1 : 0;
+    num_occluded += occluded[idx];
+  }
+
+  return num_occluded;
+}
+
+bool raytrace::bvh::occluded_by_leaf(const node &leaf, const ray &r,
+				     /* inout */ geometry_pager::page_ptr &page) const {
+  intersection tmp;
+  const geometry_pager *pager = active_scene->pager.get();
+  
+  for (int i = leaf.indices.x; i < leaf.indices.y; i++) {
+    const primitive &prim = active_scene->primitives[leaf_array[i]];
+
+    if (pager && prim.type == primitive::PRIM_TRIANGLE) {
+      triangle_geometry tri = pager->get(prim.data_id, page);
+      if (ray_triangle_intersection(tri.P[0], tri.P[1], tri.P[2], r, tmp)) return true;
+    }
+    else if (ray_primitive_intersection(prim, *active_scene, r, tmp)) return true;
+  }
+
+  return false;
+}
+
 void raytrace::bvh::check_node(const node &n, int n_idx,
 			       const ray &r,
 			       /* inout */ float &closest_t, /* inout */ intersection &isect,
 			       /* inout */ unsigned int &prim_checked,
 			       /* inout */ bool &hit_prim,
-			       /* inout */ size_t &stack_size) const {
+			       /* inout */ size_t &stack_size,
+			       /* inout */ geometry_pager::page_ptr &page) const {
+  if (n.type == node::LEAF) {
+    bool hit = intersect_leaf(n, r, closest_t, isect, prim_checked, page);
+    hit_prim = hit || hit_prim;
+  }
+  else if (stack_size < max_stack_depth) traversal_stack[stack_size++] = n_idx;
+  else trace_subtree(n_idx, r, closest_t, isect, prim_checked, hit_prim, page);
+}
+
+void raytrace::bvh::trace_subtree(int n_idx, const ray &r,
+				  /* inout */ float &closest_t, /* inout */ intersection &isect,
+				  /* inout */ unsigned int &prim_checked,
+				  /* inout */ bool &hit_prim,
+				  /* inout */ geometry_pager::page_ptr &page) const {
+  const node &n = nodes[n_idx];
   if (n.type == node::LEAF) {
-    bool hit = intersect_leaf(n, r, closest_t, isect, prim_checked);
+    bool hit = intersect_leaf(n, r, closest_t, isect, prim_checked, page);
     hit_prim = hit || hit_prim;
+    return;
   }
-  else {
-    traversal_stack[stack_size++] = n_idx;
+
+  for (int child : {n.indices.x, n.indices.y}) {
+    float2 range;
+    if (!ray_aabb_intersection(nodes[child].bounds, r, range.x, range.y)) continue;
+    if (hit_prim && range.x >= closest_t) continue;
+    trace_subtree(child, r, closest_t, isect, prim_checked, hit_prim, page);
   }
 }
 
+bool raytrace::bvh::occluded_by_subtree(int n_idx, const ray &r,
+					/* inout */ geometry_pager::page_ptr &page) const {
+  const node &n = nodes[n_idx];
+  if (n.type == node::LEAF) return occluded_by_leaf(n, r, page);
+
+  float t0, t1;
+  for (int child : {n.indices.x, n.indices.y}) {
+    if (ray_aabb_intersection(nodes[child].bounds, r, t0, t1) && occluded_by_subtree(child, r, page)) return true;
+  }
+  return false;
+}
+
 bool raytrace::bvh::intersect_leaf(const node &leaf,
 				   const ray &r,
 				   /* inout */ float &closest_t, /* out */ intersection &isect,
-				   /* inout */ unsigned int &prim_checked) const {
+				   /* inout */ unsigned int &prim_checked,
+				   /* inout */ geometry_pager::page_ptr &page) const {
   bool found_hit = false;
   intersection tmp;
+  const geometry_pager *pager = active_scene->pager.get();
   
   for (int i = leaf.indices.x; i < leaf.indices.y; i++) {
     int prim_idx = leaf_array[i];
     const primitive &prim = active_scene->primitives[prim_idx];
-    if (ray_primitive_intersection(prim, *active_scene, r, tmp)) {
+
+    bool hit;
+    if (pager && prim.type == primitive::PRIM_TRIANGLE) {
+      //pages are built so leaves don't straddle them, so this faults at most once per leaf
+      triangle_geometry tri = pager->get(prim.data_id, page);
+      hit = ray_triangle_intersection(tri.P[0], tri.P[1], tri.P[2], r, tmp);
+    }
+    else hit = ray_primitive_intersection(prim, *active_scene, r, tmp);
+    
+    if (hit) {
       if (tmp.t < closest_t) {
 	tmp.prim_idx = prim_idx;
 	isect = tmp;
@@ -0,0 +1,144 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "scene/emitters.hpp"
+
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+using namespace raytrace;
+
+emitter_table::emitter_table(const scene &s) :
+  building(false), built(false)
+{
+  boost::unordered_map<void*, int> shader_ids;
+  for (auto it = s.primitives.begin(); it != s.primitives.end(); ++it) {
+    if (it->type != primitive::PRIM_TRIANGLE || !it->shader_id) continue;
+    if (shader_ids.find(it->shader_id) != shader_ids.end()) continue;
+
+    shader_ids[it->shader_id] = static_cast<int>(shaders.size());
+    shaders.push_back(it->shader_id);
+    shader_prims.push_back(it->id);
+  }
+
+  shader_power.resize(shaders.size(), 0.0f);
+  shader_reported.resize(shaders.size(), 0);
+}
+
+void emitter_table::set_shader_emission(int i, const float4 &Le) {
+  lock_guard<mutex> lock(build_lock);
+  shader_power[i] = max(0.0f, (Le.x + Le.y + Le.z) / 3.0f);
+  shader_reported[i] = 1;
+}
+
+bool emitter_table::begin_build(const scene &s) {
+  unique_lock<mutex> lock(build_lock);
+  if (built.load(memory_order_relaxed)) return false;
+
+  if (shaders.empty()) {
+    build_locked(s);
+    return false;
+  }
+  
+  build_done.wait(lock, [this] () { return !building || built.load(memory_order_relaxed); });
+  if (built.load(memory_order_relaxed)) return false;
+  
+  building = true;
+  return true;
+}
+
+void emitter_table::build(const scene &s) {
+  {
+    lock_guard<mutex> lock(build_lock);
+    if (built.load(memory_order_relaxed)) return;
+    
+    if (find(shader_reported.begin(), shader_reported.end(), 0) != shader_reported.end()) building = false;
+    else build_locked(s);
+  }
+  build_done.notify_all();
+}
+
+void emitter_table::build_locked(const scene &s) {
+
+  boost::unordered_map<void*, float> power;
+  for (unsigned int i = 0; i < shaders.size(); ++i) {
+    if (shader_power[i] > 0.0f) power[shaders[i]] = shader_power[i];
+  }
+
+  prim_emitters.assign(s.primitives.size(), -1);
+  vector<float> weights;
+  
+  if (!power.empty()) {
+    for (auto it = s.primitives.begin(); it != s.primitives.end(); ++it) {
+      if (it->type != primitive::PRIM_TRIANGLE) continue;
+      auto power_it = power.find(it->shader_id);
+      if (power_it == power.end()) continue;
+
+      triangle_geometry tri;
+      s.get_triangle(it->data_id, tri);
+
+      emitter e;
+      for (int k = 0; k < 3; ++k) e.P[k] = tri.P[k];
+      e.prim_id = it->id;
+      e.area = 0.5f * length(cross(tri.P[1] - tri.P[0], tri.P[2] - tri.P[0]));
+      if (e.area <= 0.0f) continue;
+
+      prim_emitters[it->id] = static_cast<int>(emitters.size());
+      emitters.push_back(e);
+      weights.push_back(e.area * power_it->second);
+    }
+  }
+
+  table = alias_table(weights);
+  built.store(true, memory_order_release);
+}
+
+int emitter_table::sample(float rand_u, float rand_v, float rand_w,
+			  /* out */ float3 &P, /* out */ float3 &N, /* out */ float &pdf) const {
+  pdf = 0.0f;
+  if (!is_built()) return -1;
+
+  float pmf;
+  int i = table.sample(rand_u, pmf);
+  if (i < 0) return -1;
+  
+  const emitter &e = emitters[i];
+  float2 b = uniform_sample_triangle(rand_v, rand_w);
+  P = (1.0f - b.x - b.y)*e.P[0] + b.x*e.P[1] + b.y*e.P[2];
+  N = normalize(cross(e.P[1] - e.P[0], e.P[2] - e.P[0]));
+  pdf = pmf / e.area;
+  return e.prim_id;
+}
+
+float emitter_table::pdf(int prim_id) const {
+  if (!is_built() || prim_id < 0 || prim_id >= static_cast<int>(prim_emitters.size())) return 0.0f;
+
+  int i = prim_emitters[prim_id];
+  if (i < 0) return 0.0f;
+  return table.pmf(i) / emitters[i].area;
+}
+
+size_t emitter_table::memory() const {
+  return shaders.capacity()*sizeof(void*) + (shader_prims.capacity() + prim_emitters.capacity())*sizeof(int) +
+    shader_power.capacity()*sizeof(float) + emitters.capacity()*sizeof(emitter) + table.memory();
+}
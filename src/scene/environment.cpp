@@ -0,0 +1,149 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "scene/environment.hpp"
+#include "math/sampling.hpp"
+
+#include <OpenImageIO/imageio.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <math.h>
+
+using namespace std;
+using namespace raytrace;
+
+namespace {
+
+  inline float luminance(const float3 &c) { return 0.2126f*c.x + 0.7152f*c.y + 0.0722f*c.z; }
+  
+}
+
+environment_map::environment_map(int width, int height, vector<float3> &&map_pixels, const string &path) :
+  width(width), height(height), pixels(move(map_pixels)), path(path),
+  row_cdf(height * (width + 1)), row_sums(height), marginal_cdf(height + 1), total(0.0f)
+{
+  //each row's CDF only depends on that row, so they're split between threads
+  auto build_rows = [this] (int y0, int y1) {
+    for (int y = y0; y < y1; ++y) {
+      float sin_theta = sinf(pi * (y + 0.5f) / this->height);
+      float *cdf = &row_cdf[y * (this->width + 1)];
+      
+      cdf[0] = 0.0f;
+      for (int x = 0; x < this->width; ++x) cdf[x + 1] = cdf[x] + max(0.0f, luminance(pixels[y*this->width + x])) * sin_theta;
+      row_sums[y] = cdf[this->width];
+    }
+  };
+
+  int num_threads = max(1, min(static_cast<int>(thread::hardware_concurrency()), height / 64));
+  vector<thread> threads;
+  for (int i = 1; i < num_threads; ++i) threads.push_back(thread(build_rows, (i * height) / num_threads, ((i + 1) * height) / num_threads));
+  build_rows(0, height / num_threads);
+  for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+
+  marginal_cdf[0] = 0.0f;
+  for (int y = 0; y < height; ++y) marginal_cdf[y + 1] = marginal_cdf[y] + row_sums[y];
+  total = marginal_cdf[height];
+}
+
+shared_ptr<environment_map> environment_map::load(const string &path) {
+  OpenImageIO::ImageInput *in = OpenImageIO::ImageInput::open(path);
+  if (!in) throw runtime_error("Unable to open environment map '" + path + "': " + OpenImageIO::geterror());
+
+  const OpenImageIO::ImageSpec &spec = in->spec();
+  int width = spec.width, height = spec.height, channels = spec.nchannels;
+  vector<float> data(static_cast<size_t>(width) * height * channels);
+  bool read = in->read_image(OpenImageIO::TypeDesc::FLOAT, &data[0]);
+  in->close();
+  delete in;
+  
+  if (!read || channels < 1) throw runtime_error("Unable to read environment map '" + path + "'");
+
+  vector<float3> pixels(static_cast<size_t>(width) * height);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    const float *px = &data[i * channels];
+    pixels[i] = (channels >= 3) ? float3{px[0], px[1], px[2]} : float3{px[0], px[0], px[0]};
+  }
+  
+  return make_shared<environment_map>(width, height, move(pixels), path);
+}
+
+void environment_map::direction_texel(const float3 &D, /* out */ int &x, /* out */ int &y) const {
+  float theta = acosf(min(1.0f, max(-1.0f, D.z)));
+  float phi = atan2f(D.y, D.x);
+  if (phi < 0.0f) phi += 2.0f * pi;
+
+  //written so a NaN direction still lands on a texel
+  float u = phi * (0.5f / pi) * width, v = theta * (1.0f / pi) * height;
+  x = (u > 0.0f) ? min(static_cast<int>(u), width - 1) : 0;
+  y = (v > 0.0f) ? min(static_cast<int>(v), height - 1) : 0;
+}
+
+float3 environment_map::eval(const float3 &D) const {
+  int x, y;
+  direction_texel(D, x, y);
+  return pixels[y*width + x];
+}
+
+float3 environment_map::sample(float rand_u, float rand_v, /* out */ float &pdf) const {
+  pdf = 0.0f;
+  if (total <= 0.0f) return float3{0.0f, 0.0f, 1.0f};
+
+  //pick a row, then a column within it (binary searches over the CDFs), keeping the offset within the texel
+  float t = rand_u * total;
+  int y = static_cast<int>(upper_bound(marginal_cdf.begin() + 1, marginal_cdf.end(), t) - (marginal_cdf.begin() + 1));
+  y = min(y, height - 1);
+  float fy = min(1.0f, max(0.0f, (t - marginal_cdf[y]) / row_sums[y]));
+
+  const float *cdf = &row_cdf[y * (width + 1)];
+  float s = rand_v * row_sums[y];
+  int x = static_cast<int>(upper_bound(cdf + 1, cdf + width + 1, s) - (cdf + 1));
+  x = min(x, width - 1);
+  float fx = min(1.0f, max(0.0f, (s - cdf[x]) / (cdf[x + 1] - cdf[x])));
+
+  float theta = pi * (y + fy) / height;
+  float phi = 2.0f * pi * (x + fx) / width;
+  float sin_theta = sinf(theta);
+  if (sin_theta <= 0.0f) return float3{0.0f, 0.0f, 1.0f};
+
+  //the texel's share of the total, spread over its area in (u, v) and then over the sphere
+  float pdf_uv = (cdf[x + 1] - cdf[x]) / total * width * height;
+  pdf = pdf_uv / (2.0f * pi * pi * sin_theta);
+  return float3{sin_theta * cosf(phi), sin_theta * sinf(phi), cosf(theta)};
+}
+
+float environment_map::pdf(const float3 &D) const {
+  if (total <= 0.0f) return 0.0f;
+  
+  float sin_theta = sqrtf(D.x*D.x + D.y*D.y); //more precise than from D.z near the poles
+  if (sin_theta <= 0.0f) return 0.0f;
+  
+  int x, y;
+  direction_texel(D, x, y);
+  const float *cdf = &row_cdf[y * (width + 1)];
+  float pdf_uv = (cdf[x + 1] - cdf[x]) / total * width * height;
+  return pdf_uv / (2.0f * pi * pi * sin_theta);
+}
+
+size_t environment_map::memory() const {
+  return pixels.capacity()*sizeof(float3) + (row_cdf.capacity() + row_sums.capacity() + marginal_cdf.capacity())*sizeof(float);
+}
@@ -0,0 +1,318 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "scene/geometry_pager.hpp"
+#include "scene/scene.hpp"
+#include "scene/bvh.hpp"
+
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <boost/unordered_map.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace raytrace;
+
+size_t geometry_pager::page::bytes() const {
+  return (verts.size() + local_verts.size())*sizeof(int3) + (P.size() + N.size())*sizeof(float3);
+}
+
+static atomic<uint64_t> next_pager_serial(1);
+
+geometry_pager::geometry_pager(const string &path, size_t budget_bytes) :
+  path(path), fd(-1), budget(budget_bytes),
+  serial(next_pager_serial++),
+  clock_hand(0),
+  resident_bytes(0), resident_pages(0), num_faults(0),
+  read_failed(false)
+{
+  
+}
+
+geometry_pager::~geometry_pager() {
+  if (fd >= 0) {
+    close(fd);
+    unlink(path.c_str());
+  }
+}
+
+shared_ptr<geometry_pager> geometry_pager::build(const scene &s, const bvh &accel,
+						 const string &path,
+						 size_t budget_bytes, size_t page_bytes) {
+  shared_ptr<geometry_pager> pager(new geometry_pager(path, budget_bytes));
+
+  int num_triangles = static_cast<int>(s.triangle_verts.size());
+  int page_size = static_cast<int>(max<size_t>(1, page_bytes / sizeof(triangle_geometry)));
+  pager->locations.assign(num_triangles, int2{-1, -1});
+
+  //assign triangles to pages in leaf order, starting a new page rather than splitting a leaf
+  vector<int> order;
+  order.reserve(num_triangles);
+  int page_count = 0;
+
+  auto add_triangle = [&] (int tri_id) {
+    if (pager->locations[tri_id].x >= 0) return;
+    
+    if (pager->pages.empty()) pager->pages.push_back({0, 0, 0});
+    pager->locations[tri_id] = {static_cast<int>(pager->pages.size()) - 1, page_count++};
+    pager->pages.back().count = page_count;
+    order.push_back(tri_id);
+  };
+
+  auto start_page = [&] () {
+    pager->pages.push_back({0, 0, 0});
+    page_count = 0;
+  };
+
+  accel.foreach_leaf([&] (const int *prims, int count) {
+      if (page_count > 0 && page_count + count > page_size) start_page();
+
+      for (int i = 0; i < count; ++i) {
+	const primitive &prim = s.primitives[prims[i]];
+	if (prim.type == primitive::PRIM_TRIANGLE) add_triangle(prim.data_id);
+      }
+    });
+
+  //any triangles the BVH doesn't reference go at the end
+  for (int tri_id = 0; tri_id < num_triangles; ++tri_id) {
+    if (pager->locations[tri_id].x < 0 && page_count >= page_size) start_page();
+    add_triangle(tri_id);
+  }
+
+  //write each page out: the triangles' scene vertex indices, their indices into the page's vertices, then the vertices
+  FILE *out = fopen(path.c_str(), "wb");
+  if (!out) throw runtime_error("Unable to create geometry page file '" + path + "': " + strerror(errno));
+
+  page buffer;
+  boost::unordered_map<int, int> local_ids;
+  int64_t offset = 0;
+  size_t next = 0;
+
+  auto write_array = [&] (const void *data, size_t bytes) {
+    if (fwrite(data, 1, bytes, out) == bytes) return;
+    
+    fclose(out);
+    unlink(path.c_str());
+    throw runtime_error("Unable to write geometry page file '" + path + "'");
+  };
+
+  for (auto page_it = pager->pages.begin(); page_it != pager->pages.end(); ++page_it) {
+    buffer.verts.resize(page_it->count);
+    buffer.local_verts.resize(page_it->count);
+    buffer.P.clear();
+    buffer.N.clear();
+    local_ids.clear();
+    
+    for (int i = 0; i < page_it->count; ++i) {
+      triangle_geometry tri;
+      s.get_triangle(order[next++], tri);
+      buffer.verts[i] = tri.verts;
+
+      for (int k = 0; k < 3; ++k) {
+	auto ins = local_ids.insert(make_pair(tri.verts[k], static_cast<int>(buffer.P.size())));
+	if (ins.second) {
+	  buffer.P.push_back(tri.P[k]);
+	  buffer.N.push_back(tri.N[k]);
+	}
+	buffer.local_verts[i][k] = ins.first->second;
+      }
+    }
+    page_it->num_vertices = static_cast<int>(buffer.P.size());
+
+    write_array(buffer.verts.data(), buffer.verts.size()*sizeof(int3));
+    write_array(buffer.local_verts.data(), buffer.local_verts.size()*sizeof(int3));
+    write_array(buffer.P.data(), buffer.P.size()*sizeof(float3));
+    write_array(buffer.N.data(), buffer.N.size()*sizeof(float3));
+
+    page_it->offset = offset;
+    offset += buffer.bytes();
+  }
+
+  fclose(out);
+
+  pager->slots.resize(pager->pages.size());
+  pager->fd = open(path.c_str(), O_RDONLY);
+  if (pager->fd < 0) throw runtime_error("Unable to open geometry page file '" + path + "': " + strerror(errno));
+  return pager;
+}
+
+//Reads exactly 'bytes' bytes at 'offset', setting errno if it can't.
+static bool read_fully(int fd, void *dest, size_t bytes, int64_t offset) {
+  char *ptr = reinterpret_cast<char*>(dest);
+  size_t done = 0;
+
+  while (done < bytes) {
+    ssize_t n = pread(fd, ptr + done, bytes - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n == 0) errno = EIO; //the file is shorter than it should be
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+bool geometry_pager::read_page(const page_info &info, /* out */ page &p) const {
+  p.verts.resize(info.count);
+  p.local_verts.resize(info.count);
+  p.P.resize(info.num_vertices);
+  p.N.resize(info.num_vertices);
+
+  int64_t offset = info.offset;
+  if (!read_fully(fd, p.verts.data(), p.verts.size()*sizeof(int3), offset)) return false;
+  offset += p.verts.size()*sizeof(int3);
+  if (!read_fully(fd, p.local_verts.data(), p.local_verts.size()*sizeof(int3), offset)) return false;
+  offset += p.local_verts.size()*sizeof(int3);
+  if (!read_fully(fd, p.P.data(), p.P.size()*sizeof(float3), offset)) return false;
+  offset += p.P.size()*sizeof(float3);
+  return read_fully(fd, p.N.data(), p.N.size()*sizeof(float3), offset);
+}
+
+geometry_pager::page_ptr geometry_pager::acquire(int page_id) const {
+  {
+    lock_guard<mutex> lock(slot_lock(page_id));
+    page_slot &slot = slots[page_id];
+    if (slot.resident) {
+      slot.referenced = true;
+      return slot.resident;
+    }
+  }
+
+  //read outside the lock, so other threads can keep using resident pages
+  const page_info &info = pages[page_id];
+  shared_ptr<page> p(new page);
+  p->id = page_id;
+
+  if (!read_page(info, *p)) {
+    string reason = strerror(errno);
+    
+    //stand in triangles that rays can't hit and leave the error for the render to report (the page isn't cached,
+    //so the next lookup tries to read it again)
+    p->verts.assign(info.count, int3{0, 0, 0});
+    p->local_verts.assign(info.count, int3{0, 0, 0});
+    p->P.assign(1, float3{0.0f, 0.0f, 0.0f});
+    p->N.assign(1, float3{0.0f, 0.0f, 0.0f});
+
+    lock_guard<mutex> lock(error_lock);
+    if (!read_failed.load(memory_order_relaxed)) {
+      read_error = "Unable to read geometry page file '" + path + "': " + reason;
+      read_failed.store(true, memory_order_release);
+    }
+    return p;
+  }
+
+  {
+    lock_guard<mutex> lock(slot_lock(page_id));
+    page_slot &slot = slots[page_id];
+    
+    //another thread may have loaded this page while we were reading it
+    if (slot.resident) {
+      slot.referenced = true;
+      return slot.resident;
+    }
+
+    slot.resident = p;
+    slot.referenced = true;
+  }
+  
+  resident_bytes += p->bytes();
+  resident_pages++;
+  num_faults++;
+
+  if (resident_bytes.load() > budget) evict();
+  return p;
+}
+
+void geometry_pager::evict() const {
+  //one sweep at a time is enough, other threads go on without waiting for it
+  unique_lock<mutex> lock(evict_lock, try_to_lock);
+  if (!lock.owns_lock()) return;
+
+  //two passes over the slots, since the first may only unmark pages (threads still using a page keep their own reference)
+  size_t num_slots = slots.size();
+  for (size_t i = 0; i < 2*num_slots && resident_bytes.load() > budget && resident_pages.load() > 1; ++i) {
+    int page_id = static_cast<int>(clock_hand);
+    clock_hand = (clock_hand + 1) % num_slots;
+    
+    page_ptr victim; //released after the slot's lock
+    lock_guard<mutex> slot_guard(slot_lock(page_id));
+    page_slot &slot = slots[page_id];
+    if (!slot.resident) continue;
+
+    if (slot.referenced) {
+      slot.referenced = false;
+      continue;
+    }
+
+    victim.swap(slot.resident);
+    resident_bytes -= victim->bytes();
+    resident_pages--;
+  }
+}
+
+triangle_geometry geometry_pager::get(int tri_id, /* inout */ page_ptr &pinned) const {
+  const int2 &loc = locations[tri_id];
+  if (!pinned || pinned->id != loc.x) pinned = acquire(loc.x);
+
+  triangle_geometry tri;
+  tri.verts = pinned->verts[loc.y];
+  const int3 &local = pinned->local_verts[loc.y];
+  for (int k = 0; k < 3; ++k) {
+    tri.P[k] = pinned->P[local[k]];
+    tri.N[k] = pinned->N[local[k]];
+  }
+  return tri;
+}
+
+//The last page each thread read through geometry_pager::read, with the serial number of its pager
+//(which, unlike its address, is never reused).
+struct pinned_read_page {
+  uint64_t pager;
+  geometry_pager::page_ptr page;
+};
+
+static thread_local pinned_read_page last_read_page;
+
+void geometry_pager::read(int tri_id, /* out */ triangle_geometry &tri) const {
+  if (last_read_page.pager != serial) {
+    last_read_page.pager = serial;
+    last_read_page.page.reset();
+  }
+  tri = get(tri_id, last_read_page.page);
+}
+
+size_t geometry_pager::memory_usage() const {
+  return resident_bytes.load() + pages.capacity()*sizeof(page_info) + locations.capacity()*sizeof(int2) +
+    slots.capacity()*sizeof(page_slot);
+}
+
+uint64_t geometry_pager::page_faults() const {
+  return num_faults.load();
+}
+
+string geometry_pager::error() const {
+  lock_guard<mutex> lock(error_lock);
+  return read_error;
+}
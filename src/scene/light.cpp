@@ -20,6 +20,7 @@
 */
 
 #include "scene/light.hpp"
+#include "scene/environment.hpp"
 #include "math/sampling.hpp"
 
 using namespace raytrace;
@@ -38,6 +39,10 @@ float4 raytrace::light::sample_position(const float3 &P, float rand_u, float ran
     float3 LP = point.position + disk_sample.x*T + disk_sample.y*B;
     return float4{LP.x, LP.y, LP.z, 1.0f};
   }
+  else if (type == ENVIRONMENT) {
+    float3 D = environment.map->sample(rand_u, rand_v, pdf);
+    return float4{D.x, D.y, D.z, 0.0f};
+  }
 
   return {0.0f, 0.0f, 0.0f, 1.0f};
 }
@@ -48,6 +53,10 @@ float4 raytrace::light::eval_radiance(const float3 &P, const float3 &I) const {
     float3 R = (energy / area)*color;
     return {R.x, R.y, R.z, 1.0f};
   }
+  else if (type == ENVIRONMENT) {
+    float3 R = energy * (color * environment.map->eval(I));
+    return {R.x, R.y, R.z, 1.0f};
+  }
 
   return {0.0f, 0.0f, 0.0f};
 }
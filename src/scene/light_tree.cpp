@@ -0,0 +1,272 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "scene/light_tree.hpp"
+#include "math/sampling.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+using namespace raytrace;
+
+namespace {
+
+  inline float safe_acos(float x) { return acosf(min(1.0f, max(-1.0f, x))); }
+
+  inline float3 unit_normal(const float3 &N) {
+    float len2 = dot(N, N);
+    return (len2 > 0.0f) ? (1.0f / sqrtf(len2)) * N : float3{0.0f, 0.0f, 0.0f};
+  }
+
+  //Given cos(a) and the sine and cosine of b, returns cos(max(0, a - b)).
+  inline float min_angle_cos(float cos_a, float cos_b, float sin_b) {
+    if (cos_a >= cos_b) return 1.0f;
+    float sin_a = sqrtf(max(0.0f, 1.0f - cos_a*cos_a));
+    return cos_a*cos_b + sin_a*sin_b;
+  }
+
+  //Rotates v by 'angle' about the given unit axis.
+  float3 rotate(const float3 &v, const float3 &axis, float angle) {
+    float c = cosf(angle), s = sinf(angle);
+    return c*v + s*cross(axis, v) + ((1.0f - c) * dot(axis, v))*axis;
+  }
+
+  float light_power(const light &lt) {
+    return lt.energy * (lt.color.x + lt.color.y + lt.color.z) / 3.0f;
+  }
+
+  light_tree::node light_leaf(const light &lt, int light_id) {
+    light_tree::node n;
+    n.cone = light_tree::direction_cone::sphere(); //point lights emit in every direction
+    n.power = light_power(lt);
+    n.parent = -1;
+    n.light_id = light_id;
+    n.right = -1;
+    return n;
+  }
+
+  const float one_minus_epsilon = 0.99999994f;
+  
+}
+
+/* Direction Cones */
+
+light_tree::direction_cone light_tree::direction_cone::sphere() {
+  return direction_cone{float3{0.0f, 0.0f, 1.0f}, -1.0f, 0.0f};
+}
+
+light_tree::direction_cone light_tree::direction_cone::merge(const direction_cone &rhs) const {
+  float theta_e = max(safe_acos(cos_theta_e), safe_acos(rhs.cos_theta_e));
+  if (cos_theta_o <= -1.0f || rhs.cos_theta_o <= -1.0f) return direction_cone{axis, -1.0f, cosf(theta_e)};
+  
+  float theta_a = safe_acos(cos_theta_o), theta_b = safe_acos(rhs.cos_theta_o);
+  float theta_d = safe_acos(dot(axis, rhs.axis));
+
+  //one cone may already contain the other
+  if (min(theta_d + theta_b, pi) <= theta_a) return direction_cone{axis, cos_theta_o, cosf(theta_e)};
+  if (min(theta_d + theta_a, pi) <= theta_b) return direction_cone{rhs.axis, rhs.cos_theta_o, cosf(theta_e)};
+
+  float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+  if (theta_o >= pi) return direction_cone{axis, -1.0f, cosf(theta_e)};
+
+  //rotate this cone's axis towards the other's, so the new cone just covers both
+  float3 w = cross(axis, rhs.axis);
+  if (dot(w, w) < 1e-12f) return direction_cone{axis, -1.0f, cosf(theta_e)};
+  float3 new_axis = rotate(axis, normalize(w), theta_o - theta_a);
+  return direction_cone{new_axis, cosf(theta_o), cosf(theta_e)};
+}
+
+/* Light Tree */
+
+light_tree::light_tree(const vector<light> &lights) :
+  light_leaves(lights.size(), -1)
+{
+  if (lights.empty()) return;
+
+  vector<node> leaves(lights.size());
+  vector<int> light_ids;
+  for (unsigned int i = 0; i < lights.size(); ++i) {
+    if (lights[i].type == light::ENVIRONMENT) {
+      infinite_lights.push_back(static_cast<int>(i));
+      continue;
+    }
+    
+    leaves[i] = light_leaf(lights[i], static_cast<int>(i));
+    float3 r{lights[i].point.radius, lights[i].point.radius, lights[i].point.radius};
+    set_bounds(leaves[i], aabb{lights[i].point.position - r, lights[i].point.position + r});
+    light_ids.push_back(static_cast<int>(i));
+  }
+  if (light_ids.empty()) return;
+
+  nodes.reserve(2*light_ids.size() - 1);
+  build(light_ids, 0, static_cast<int>(light_ids.size()), -1, leaves);
+}
+
+int light_tree::build(vector<int> &light_ids, int begin, int end, int parent,
+		      const vector<node> &leaves) {
+  int idx = static_cast<int>(nodes.size());
+  
+  if (end - begin == 1) {
+    node n = leaves[light_ids[begin]];
+    n.parent = parent;
+    nodes.push_back(n);
+    light_leaves[n.light_id] = idx;
+    return idx;
+  }
+
+  //split at the median of the light centers, along the axis they're most spread out on
+  aabb centers = aabb::empty_box();
+  for (int i = begin; i < end; ++i) {
+    const float3 &c = leaves[light_ids[i]].center;
+    centers = centers.merge(aabb{c, c});
+  }
+
+  float3 extent = centers.pmax - centers.pmin;
+  int axis = (extent.x > extent.y) ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  int mid = (begin + end) / 2;
+  nth_element(light_ids.begin() + begin, light_ids.begin() + mid, light_ids.begin() + end,
+	      [&] (int a, int b) { return leaves[a].center[axis] < leaves[b].center[axis]; });
+
+  nodes.push_back(node());
+  int left = build(light_ids, begin, mid, idx, leaves);
+  int right = build(light_ids, mid, end, idx, leaves);
+
+  node &n = nodes[idx];
+  set_bounds(n, nodes[left].bounds.merge(nodes[right].bounds));
+  n.cone = nodes[left].cone.merge(nodes[right].cone);
+  n.power = nodes[left].power + nodes[right].power;
+  n.parent = parent;
+  n.light_id = -1;
+  n.right = right;
+  return idx;
+}
+
+void light_tree::set_bounds(node &n, const aabb &bounds) {
+  n.bounds = bounds;
+  n.center = bounds.center();
+  
+  float3 half_extent = 0.5f * (bounds.pmax - bounds.pmin);
+  n.radius2 = dot(half_extent, half_extent);
+}
+
+float light_tree::importance(const node &n, const float3 &P, const float3 &N) const {
+  if (n.power <= 0.0f) return 0.0f;
+  
+  float3 to_center = n.center - P;
+  float dist2 = dot(to_center, to_center);
+  float radius2 = n.radius2;
+
+  //clamp the distance to the node's size, so points inside a cluster don't favour it without bound
+  float result = n.power / max(dist2, radius2);
+  if (dist2 <= radius2) return result; //P may be inside the node, no angular bounds apply
+
+  //angle subtended by the node's bounding sphere (kept as sin/cos to avoid the inverse trig functions)
+  float sin2_b = radius2 / dist2;
+  float sin_b = sqrtf(sin2_b), cos_b = sqrtf(1.0f - sin2_b);
+  float3 w = (1.0f / sqrtf(dist2)) * to_center;
+
+  //can any of them be above the surface?
+  if (N.x != 0.0f || N.y != 0.0f || N.z != 0.0f) {
+    float cos_i = dot(N, w);
+    float cos_t = min_angle_cos(cos_i, cos_b, sin_b); //cos(max(0, theta_i - theta_b))
+    if (cos_t <= 0.0f) return 0.0f;
+    result *= cos_t;
+  }
+  
+  //can any of the node's lights emit towards P?
+  if (n.cone.cos_theta_o > -1.0f) {
+    float cos_o = n.cone.cos_theta_o, sin_o = sqrtf(max(0.0f, 1.0f - cos_o*cos_o));
+    float cos_w = -dot(n.cone.axis, w);
+    float cos_t = min_angle_cos(min_angle_cos(cos_w, cos_o, sin_o), cos_b, sin_b); //cos(max(0, theta_w - theta_o - theta_b))
+    if (cos_t <= n.cone.cos_theta_e) return 0.0f;
+    result *= cos_t;
+  }
+  
+  return result;
+}
+
+float light_tree::tree_probability(const float3 &P, const float3 &N) const {
+  if (nodes.empty() || importance(nodes[0], P, N) <= 0.0f) return 0.0f;
+  return 1.0f / (infinite_lights.size() + 1);
+}
+
+int light_tree::sample(const float3 &P, const float3 &N_in, float u,
+		       /* out */ float &pdf) const {
+  pdf = 0.0f;
+  float3 N = unit_normal(N_in);
+  float p_tree = tree_probability(P, N);
+
+  if (u >= p_tree) {
+    if (infinite_lights.empty()) return -1;
+    
+    float p_inf = (1.0f - p_tree) / infinite_lights.size();
+    int i = min(static_cast<int>((u - p_tree) / p_inf), static_cast<int>(infinite_lights.size()) - 1);
+    pdf = p_inf;
+    return infinite_lights[i];
+  }
+  u = min(u / p_tree, one_minus_epsilon);
+
+  int idx = 0;
+  float prob = p_tree;
+  while (nodes[idx].light_id < 0) {
+    int left = idx + 1, right = nodes[idx].right;
+    float i_left = importance(nodes[left], P, N);
+    float i_right = importance(nodes[right], P, N);
+    if (i_left + i_right <= 0.0f) return -1;
+    
+    //pick a child, rescaling u so it can be reused further down
+    float p_left = i_left / (i_left + i_right);
+    if (u < p_left) {
+      idx = left;
+      u = min(u / p_left, one_minus_epsilon);
+      prob *= p_left;
+    }
+    else {
+      idx = right;
+      u = min((u - p_left) / (1.0f - p_left), one_minus_epsilon);
+      prob *= 1.0f - p_left;
+    }
+  }
+
+  pdf = prob;
+  return nodes[idx].light_id;
+}
+
+float light_tree::pdf(const float3 &P, const float3 &N_in, int light_id) const {
+  if (light_id < 0 || light_id >= static_cast<int>(light_leaves.size())) return 0.0f;
+  float3 N = unit_normal(N_in);
+  float p_tree = tree_probability(P, N);
+  if (light_leaves[light_id] < 0) return infinite_lights.empty() ? 0.0f : (1.0f - p_tree) / infinite_lights.size();
+  if (p_tree <= 0.0f) return 0.0f;
+
+  //multiply the probabilities of each choice on the way from the root to the light's leaf
+  float prob = p_tree;
+  for (int idx = light_leaves[light_id]; nodes[idx].parent >= 0; idx = nodes[idx].parent) {
+    const node &parent = nodes[nodes[idx].parent];
+    float i_left = importance(nodes[nodes[idx].parent + 1], P, N);
+    float i_right = importance(nodes[parent.right], P, N);
+    if (i_left + i_right <= 0.0f) return 0.0f;
+
+    prob *= ((idx == parent.right) ? i_right : i_left) / (i_left + i_right);
+  }
+  return prob;
+}
@@ -29,3 +29,12 @@ raytrace::object::~object() {
     delete it->second;
   }
 }
+
+void raytrace::object::set_attribute(const string &name, int handle, attribute *attr) {
+  auto it = attributes.find(name);
+  if (it != attributes.end()) delete it->second;
+  attributes[name] = attr;
+
+  if (handle >= static_cast<int>(attribute_table.size())) attribute_table.resize(handle + 1, NULL);
+  attribute_table[handle] = attr;
+}
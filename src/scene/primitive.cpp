@@ -23,6 +23,7 @@
 #include "scene/scene.hpp"
 #include "geometry/ray.hpp"
 #include "geometry/triangle.hpp"
+#include "geometry/strand.hpp"
 #include "geometry/aabb.hpp"
 
 using namespace std;
@@ -31,29 +32,57 @@ using namespace raytrace;
 bool raytrace::ray_primitive_intersection(const primitive &prim, const scene &active_scene,
 					  const ray &r, /* out */ intersection &isect) {
   if (prim.type == primitive::PRIM_TRIANGLE) {
+    if (active_scene.pager) {
+      triangle_geometry tri;
+      active_scene.get_triangle(prim.data_id, tri);
+      return ray_triangle_intersection(tri.P[0], tri.P[1], tri.P[2], r, isect);
+    }
+    
     const int3 &tri_verts = active_scene.triangle_verts[prim.data_id];
     return ray_triangle_intersection(active_scene.vertices[tri_verts.x],
 				     active_scene.vertices[tri_verts.y],
 				     active_scene.vertices[tri_verts.z],
 				     r, isect);
   }
+  else if (prim.type == primitive::PRIM_STRAND) {
+    const strand_segment &seg = active_scene.strand_segments[prim.data_id];
+    return ray_strand_intersection(active_scene.strand_points[seg.point], active_scene.strand_points[seg.point + 1],
+				   seg.t0, seg.t1, r, isect);
+  }
   
   return false;
 }
 
 aabb raytrace::primitive_bbox(const primitive &prim, const scene &active_scene) {
   if (prim.type == primitive::PRIM_TRIANGLE) {
+    if (active_scene.pager) {
+      triangle_geometry tri;
+      active_scene.get_triangle(prim.data_id, tri);
+      return compute_triangle_bbox(tri.P[0], tri.P[1], tri.P[2]);
+    }
+    
     const int3 &tri_verts = active_scene.triangle_verts[prim.data_id];
     return compute_triangle_bbox(active_scene.vertices[tri_verts.x],
 				 active_scene.vertices[tri_verts.y],
 				 active_scene.vertices[tri_verts.z]);
   }
+  else if (prim.type == primitive::PRIM_STRAND) {
+    const strand_segment &seg = active_scene.strand_segments[prim.data_id];
+    return compute_strand_bbox(active_scene.strand_points[seg.point], active_scene.strand_points[seg.point + 1],
+			       seg.t0, seg.t1);
+  }
   
   return aabb();
 }
 
 float3 raytrace::primitive_geometry_normal(const primitive &prim, const scene &active_scene) {
   if (prim.type == primitive::PRIM_TRIANGLE) {
+    if (active_scene.pager) {
+      triangle_geometry tri;
+      active_scene.get_triangle(prim.data_id, tri);
+      return compute_triangle_normal(tri.P[0], tri.P[1], tri.P[2]);
+    }
+    
     const int3 &tri_verts = active_scene.triangle_verts[prim.data_id];
     return compute_triangle_normal(active_scene.vertices[tri_verts.x],
 				   active_scene.vertices[tri_verts.y],
@@ -63,25 +92,31 @@ float3 raytrace::primitive_geometry_normal(const primitive &prim, const scene &a
 }
 
 int3 raytrace::primitive_get_attribute_id_per_vertex(const primitive &prim, const scene &active_scene) {
-  object_ptr obj = active_scene.objects[prim.object_id];
+  const object &obj = active_scene.get_object(prim.object_id);
   
   if (prim.type == primitive::PRIM_TRIANGLE) {
-    int3 verts = active_scene.triangle_verts[prim.data_id];
-    int offset = obj->vert_range.x;
+    int3 verts = active_scene.triangle_vertex_ids(prim.data_id);
+    int offset = obj.vert_range.x;
     
     return { verts.x - offset, verts.y - offset, verts.z - offset};	
   }
+  else if (prim.type == primitive::PRIM_STRAND) {
+    int point = active_scene.strand_segments[prim.data_id].point - obj.vert_range.x;
+    return {point, point + 1, point + 1};
+  }
   else return {0, 0, 0};
 }
 
 int raytrace::primitive_get_attribute_id_per_primitive(const primitive &prim, const scene &active_scene) {
-  object_ptr obj = active_scene.objects[prim.object_id]; 
-  return prim.id - obj->prim_range.x;
+  if (prim.type == primitive::PRIM_STRAND) return active_scene.strand_segments[prim.data_id].strand;
+  
+  const object &obj = active_scene.get_object(prim.object_id);
+  return prim.id - obj.prim_range.x;
 }
 
 int raytrace::primitive_get_attribute_id_per_corner(const primitive &prim, const scene &active_scene) {
-  object_ptr obj = active_scene.objects[prim.object_id]; 
+  const object &obj = active_scene.get_object(prim.object_id);
   
-  if (prim.type == primitive::PRIM_TRIANGLE) return prim.data_id - obj->tri_range.x;
+  if (prim.type == primitive::PRIM_TRIANGLE) return prim.data_id - obj.tri_range.x;
   else return 0;
 }
@@ -20,17 +20,241 @@
 */
 
 #include "scene/scene.hpp"
+#include "geometry/strand.hpp"
+
+#include <cstring>
 
 using namespace std;
 using namespace raytrace;
 
+namespace {
+
+  /*
+    FNV-1a style hash, taking a word at a time so large geometry arrays hash quickly. Each word goes through
+    murmur3's finalizer first: the FNV multiply alone never carries a difference into lower bits, so differences
+    in the top bits of two words (e.g. the sign bits of two floats) could cancel out.
+  */
+  class content_hash {
+  public:
+
+    content_hash() : h(14695981039346656037ULL) { }
+
+    void add(const void *data, size_t bytes) {
+      const unsigned char *ptr = reinterpret_cast<const unsigned char*>(data);
+      for ( ; bytes >= sizeof(uint64_t); bytes -= sizeof(uint64_t), ptr += sizeof(uint64_t)) {
+	uint64_t word;
+	memcpy(&word, ptr, sizeof(uint64_t));
+	mix(word);
+      }
+      for ( ; bytes > 0; --bytes, ++ptr) mix(*ptr);
+    }
+
+    //only for types without padding bytes
+    template<typename T>
+    void add(const T &value) { add(&value, sizeof(T)); }
+
+    template<typename T>
+    void add_array(const vector<T> &values) {
+      add(values.size());
+      add(values.data(), values.size() * sizeof(T));
+    }
+
+    uint64_t value() const { return fmix64(h); }
+
+  private:
+
+    uint64_t h;
+
+    static uint64_t fmix64(uint64_t k) {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      k *= 0xc4ceb9fe1a85ec53ULL;
+      k ^= k >> 33;
+      return k;
+    }
+
+    void mix(uint64_t v) {
+      h ^= fmix64(v);
+      h *= 1099511628211ULL;
+    }
+    
+  };
+
+}
+
 void raytrace::scene::clear() {
   vertices.clear();
   vertex_normals.clear();
   triangle_verts.clear();
+  pager.reset();
+  strand_points.clear();
+  strand_segments.clear();
 
   primitives.clear();
   objects.clear();
 
   lights.clear();
+  environment_maps.clear();
+
+  attribute_handles.clear();
+}
+
+size_t raytrace::attribute_name_hash::operator()(const char *name) const {
+  //FNV-1a
+  size_t h = 2166136261u;
+  for (const char *c = name; *c; ++c) {
+    h ^= static_cast<unsigned char>(*c);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+int raytrace::scene::get_attribute_handle(const string &name) {
+  auto it = attribute_handles.find(name);
+  if (it != attribute_handles.end()) return it->second;
+
+  int handle = static_cast<int>(attribute_handles.size());
+  attribute_handles[name] = handle;
+  return handle;
+}
+
+int raytrace::scene::find_attribute_handle(const char *name) const {
+  auto it = attribute_handles.find(name, attribute_name_hash(), attribute_name_equal());
+  if (it == attribute_handles.end()) return -1;
+  return it->second;
+}
+
+void raytrace::scene::add_attribute(int object_id, const string &name, attribute *attr) {
+  int handle = get_attribute_handle(name);
+  objects[object_id]->set_attribute(name, handle, attr);
+}
+
+void raytrace::scene::add_strand_segments(int object_id, int strand, int first_point, int num_points,
+					  void *shader_id, void *volume_id, bool split) {
+  for (int p = first_point; p < first_point + num_points - 1; ++p) {
+    int num_pieces = split ? strand_split_count(strand_points[p], strand_points[p+1]) : 1;
+
+    for (int piece = 0; piece < num_pieces; ++piece) {
+      int seg_idx = static_cast<int>(strand_segments.size());
+      float t0 = static_cast<float>(piece) / num_pieces;
+      float t1 = static_cast<float>(piece + 1) / num_pieces;
+      strand_segments.push_back(strand_segment{p, strand, t0, t1});
+
+      primitive prim{primitive::PRIM_STRAND, static_cast<int>(primitives.size()), seg_idx, object_id, -1, shader_id, volume_id};
+      primitives.push_back(prim);
+    }
+  }
+}
+
+uint64_t raytrace::scene::geometry_hash() const {
+  content_hash h;
+  h.add_array(vertices);
+  h.add_array(triangle_verts);
+  h.add_array(strand_points);
+  h.add_array(strand_segments);
+  h.add(pager.get());
+
+  //primitives have padding before their shader pointers, so hash them field by field
+  h.add(primitives.size());
+  for (auto it = primitives.begin(); it != primitives.end(); ++it) {
+    h.add(static_cast<int>(it->type));
+    h.add(it->data_id);
+    h.add(it->object_id);
+  }
+  return h.value();
+}
+
+uint64_t raytrace::scene::lights_hash() const {
+  content_hash h;
+  h.add(lights.size());
+  for (auto it = lights.begin(); it != lights.end(); ++it) {
+    h.add(static_cast<int>(it->type));
+    if (it->type == light::ENVIRONMENT) h.add(it->environment.map); //maps don't change once loaded
+    else {
+      h.add(it->point.position);
+      h.add(it->point.radius);
+    }
+    h.add(it->energy);
+    h.add(it->color);
+  }
+  return h.value();
+}
+
+scene_hashes raytrace::scene::content_hashes() const {
+  scene_hashes hashes;
+  hashes.geometry = geometry_hash();
+
+  content_hash cam;
+  cam.add(main_camera.clip_start);
+  cam.add(main_camera.clip_end);
+  cam.add(main_camera.raster_to_camera);
+  cam.add(main_camera.camera_to_world);
+  cam.add(resolution);
+  hashes.camera = cam.value();
+
+  hashes.lights = lights_hash();
+
+  hashes.materials = materials_hash();
+  
+  return hashes;
+}
+
+uint64_t raytrace::scene::materials_hash() const {
+  content_hash h;
+  h.add(primitives.size());
+  for (auto it = primitives.begin(); it != primitives.end(); ++it) {
+    h.add(it->shader_id);
+    h.add(it->volume_id);
+  }
+  return h.value();
+}
+
+size_t raytrace::scene::geometry_memory() const {
+  size_t bytes = vertices.capacity()*sizeof(float3) + vertex_normals.capacity()*sizeof(float3)
+    + triangle_verts.capacity()*sizeof(int3)
+    + strand_points.capacity()*sizeof(float4) + strand_segments.capacity()*sizeof(strand_segment);
+  if (pager) bytes += pager->memory_usage();
+  return bytes;
+}
+
+size_t raytrace::scene::primitive_memory() const {
+  size_t bytes = primitives.capacity()*sizeof(primitive) + objects.capacity()*sizeof(object_ptr);
+  for (auto it = objects.begin(); it != objects.end(); ++it) {
+    bytes += sizeof(object) + (*it)->attribute_table.capacity()*sizeof(attribute*);
+  }
+  return bytes + lights.capacity()*sizeof(light);
+}
+
+size_t raytrace::scene::attribute_memory() const {
+  size_t bytes = 0;
+  for (auto obj_it = objects.begin(); obj_it != objects.end(); ++obj_it) {
+    const object &obj = **obj_it;
+    for (auto it = obj.attributes.begin(); it != obj.attributes.end(); ++it) {
+      bytes += it->first.capacity() + it->second->memory_usage();
+    }
+  }
+  return bytes;
+}
+
+void raytrace::scene::set_geometry_pager(const shared_ptr<geometry_pager> &p) {
+  pager = p;
+
+  //swap with empty arrays to actually release the memory
+  vector<float3>().swap(vertices);
+  vector<float3>().swap(vertex_normals);
+  vector<int3>().swap(triangle_verts);
+}
+
+void raytrace::scene::get_triangle(int tri_id, /* out */ triangle_geometry &tri) const {
+  if (pager) {
+    pager->read(tri_id, tri);
+    return;
+  }
+
+  tri.verts = triangle_verts[tri_id];
+  for (int k = 0; k < 3; ++k) {
+    tri.P[k] = vertices[tri.verts[k]];
+    tri.N[k] = vertex_normals[tri.verts[k]];
+  }
 }
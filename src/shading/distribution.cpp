@@ -25,25 +25,173 @@
 #include "math/sampling.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 using namespace std;
 using namespace raytrace;
 
-/* Lead Node */
+/* Allocation Tracking */
 
-shade_tree::leaf::leaf(char *p, shader_flags flags,
+//Each thread counts its own allocations (so there's no contention), the totals are summed on request.
+//Counters of threads that have exited are folded into retired_allocation_bytes.
+static mutex allocation_counters_lock;
+static vector<atomic<int64_t>*> allocation_counters;
+static int64_t retired_allocation_bytes = 0;
+
+struct local_allocation_counter_holder {
+  atomic<int64_t> *ptr;
+
+  local_allocation_counter_holder() : ptr(NULL) { }
+  ~local_allocation_counter_holder() {
+    if (!ptr) return;
+
+    lock_guard<mutex> lock(allocation_counters_lock);
+    retired_allocation_bytes += ptr->load(memory_order_relaxed);
+    allocation_counters.erase(find(allocation_counters.begin(), allocation_counters.end(), ptr));
+    delete ptr;
+  }
+};
+
+static thread_local local_allocation_counter_holder local_allocation_counter;
+
+static void track_allocation(int64_t bytes) {
+  atomic<int64_t> *&counter = local_allocation_counter.ptr;
+  if (!counter) {
+    counter = new atomic<int64_t>(0);
+
+    lock_guard<mutex> lock(allocation_counters_lock);
+    allocation_counters.push_back(counter);
+  }
+
+  //only this thread writes the counter, so a relaxed load/store is enough
+  counter->store(counter->load(memory_order_relaxed) + bytes, memory_order_relaxed);
+}
+
+int64_t shade_tree::allocated_bytes() {
+  lock_guard<mutex> lock(allocation_counters_lock);
+  int64_t total = retired_allocation_bytes;
+  for (auto it = allocation_counters.begin(); it != allocation_counters.end(); ++it) {
+    total += (*it)->load(memory_order_relaxed);
+  }
+  return total;
+}
+
+/* Node Arena */
+
+//Created the first time a thread builds a shade tree and freed when the thread exits. If a tree outlives its
+//thread the arena is left to its remaining nodes, and the last one to be released frees it.
+struct shade_tree::local_arena_holder {
+  arena *ptr;
+
+  local_arena_holder() : ptr(NULL) { }
+  ~local_arena_holder() {
+    if (!ptr) return;
+    if (ptr->live == 0) delete ptr;
+    else ptr->orphaned = true;
+  }
+};
+
+static thread_local shade_tree::local_arena_holder local_arena;
+
+const size_t shade_tree::arena::chunk_size;
+const size_t shade_tree::arena::max_capacity;
+
+shade_tree::arena &shade_tree::arena::local() {
+  if (!local_arena.ptr) local_arena.ptr = new arena();
+  return *local_arena.ptr;
+}
+
+bool shade_tree::arena::releasable_here() const {
+  return orphaned || this == local_arena.ptr;
+}
+
+void *shade_tree::arena::allocate(size_t bytes) {
+  bytes = (bytes + 15) & ~static_cast<size_t>(15);
+  if (chunks.empty() || offset + bytes > chunks[current].size) {
+    if (!next_chunk(bytes)) return NULL;
+  }
+
+  void *ptr = chunks[current].data.get() + offset;
+  offset += bytes;
+  ++live;
+  return ptr;
+}
+
+bool shade_tree::arena::next_chunk(size_t bytes) {
+  //move to the next chunk, adding one if it doesn't exist (or can't fit an unusually large allocation)
+  size_t next = chunks.empty() ? 0 : current + 1;
+  if (next >= chunks.size() || chunks[next].size < bytes) {
+    size_t size = max(chunk_size, bytes);
+    if (capacity() + size > max_capacity) return false;
+    chunks.insert(chunks.begin() + next, chunk{unique_ptr<char[]>(new char[size]), size});
+  }
+  
+  current = next;
+  offset = 0;
+  return true;
+}
+
+size_t shade_tree::arena::capacity() const {
+  size_t total = 0;
+  for (auto it = chunks.begin(); it != chunks.end(); ++it) total += it->size;
+  return total;
+}
+
+//Constructs a node in the calling thread's arena (or on the heap, if it's full), with 'extra' bytes of space after it.
+template<typename T, typename... Args>
+static T *create_node(size_t extra, Args&&... args) {
+  shade_tree::arena *owner = &shade_tree::arena::local();
+  size_t node_size = (sizeof(T) + 15) & ~static_cast<size_t>(15);
+
+  void *mem = owner->allocate(node_size + extra);
+  if (!mem) {
+    mem = ::operator new(node_size + extra);
+    owner = NULL;
+  }
+  
+  T *n = new (mem) T(std::forward<Args>(args)...);
+  n->owner = owner;
+  return n;
+}
+
+shade_tree::leaf_ptr shade_tree::make_leaf(size_t param_size, shader_flags flags,
+					   leaf::eval_func_type eval, leaf::sample_func_type sample,
+					   leaf::pdf_func_type pdf, leaf::emission_func_type emit,
+					   leaf::dtor_func_type dtor,
+					   /* out */ char *&params) {
+  leaf *n = create_node<leaf>(param_size, param_size, flags, eval, sample, pdf, emit, dtor);
+  params = n->param_data();
+  return leaf_ptr(n);
+}
+
+shade_tree::scale_ptr shade_tree::make_scale(const float4 &k, const node_ptr &node) {
+  return scale_ptr(create_node<scale>(0, k, node));
+}
+
+shade_tree::sum_ptr shade_tree::make_sum(const node_ptr &lhs, const node_ptr &rhs) {
+  return sum_ptr(create_node<sum>(0, lhs, rhs));
+}
+
+/* Leaf Node */
+
+shade_tree::leaf::leaf(size_t param_size, shader_flags flags,
 		       eval_func_type eval, sample_func_type sample,
 		       pdf_func_type pdf, emission_func_type(emit),
 		       dtor_func_type dtor) : 
-  params(p), evaluate_fn(eval), sample_fn(sample), pdf_fn(pdf), emit_fn(emit), destructor(dtor),
+  params(reinterpret_cast<char*>(this) + ((sizeof(leaf) + 15) & ~static_cast<size_t>(15))),
+  param_size(param_size),
+  evaluate_fn(eval), sample_fn(sample), pdf_fn(pdf), emit_fn(emit), destructor(dtor),
   flags(flags)
 {
-  
+  track_allocation(sizeof(leaf) + param_size);
 }
 
 shade_tree::leaf::~leaf() {
   destructor(params);
-  delete[] params;
+  track_allocation(-static_cast<int64_t>(sizeof(leaf) + param_size));
 }
 
 void shade_tree::leaf::evaluate(float3 *P_in, float3 *w_in,
@@ -151,7 +299,11 @@ float shade_tree::get_weight(shade_tree::shader_flags flags, const node_ptr &nod
 shade_tree::scale::scale(const float4 &k, const node_ptr &node) :
   k(k), node(node), weight(length(k)*get_weight(node)), flags(get_flags(node))
 {
-  
+  track_allocation(sizeof(scale));
+}
+
+shade_tree::scale::~scale() {
+  track_allocation(-static_cast<int64_t>(sizeof(scale)));
 }
 
 shade_tree::sum::sum(const node_ptr &lhs, const node_ptr &rhs) :
@@ -159,7 +311,11 @@ shade_tree::sum::sum(const node_ptr &lhs, const node_ptr &rhs) :
   weight(get_weight(lhs) + get_weight(rhs)),
   flags(get_flags(lhs) | get_flags(rhs))
 {
-  
+  track_allocation(sizeof(sum));
+}
+
+shade_tree::sum::~sum() {
+  track_allocation(-static_cast<int64_t>(sizeof(sum)));
 }
 
 /* Helper class that evaluates a shade_tree */
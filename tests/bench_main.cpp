@@ -0,0 +1,917 @@
+/*
+
+  Copyright 2013 Curtis Andrus
+
+  This file is part of Gideon.
+
+  Gideon is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Gideon is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Gideon.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "scene/scene.hpp"
+#include "scene/attribute_reader.hpp"
+#include "scene/bvh.hpp"
+#include "scene/bvh_builder.hpp"
+#include "scene/light_tree.hpp"
+#include "scene/emitters.hpp"
+#include "scene/environment.hpp"
+#include "shading/distribution.hpp"
+#include "geometry/ray.hpp"
+#include "engine/thread_pool.hpp"
+#include "engine/film.hpp"
+#include "engine/tile_order.hpp"
+#include "engine/wavefront.hpp"
+#include "math/random.hpp"
+#include "math/sampling.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <functional>
+#include <random>
+#include <cmath>
+#include <boost/function.hpp>
+
+using namespace std;
+using namespace raytrace;
+
+/* Micro-benchmarks for engine code that runs on the rendering hot path. */
+
+typedef function<void (unsigned int thread_id, unsigned int iterations)> bench_func;
+
+//Runs the benchmark on the given number of threads, returning the average time per iteration (ns).
+static double run_threads(unsigned int num_threads, unsigned int iterations, const bench_func &f) {
+  auto start = chrono::high_resolution_clock::now();
+
+  vector<thread> threads;
+  for (unsigned int t = 0; t < num_threads; ++t) threads.push_back(thread(f, t, iterations));
+  for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+
+  auto end = chrono::high_resolution_clock::now();
+  double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+  return ns / iterations;
+}
+
+static void report(const string &name, const bench_func &f, unsigned int iterations) {
+  unsigned int max_threads = max(1u, thread::hardware_concurrency());
+  double base = 0.0;
+
+  cout << name << endl;
+  for (unsigned int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    double ns = run_threads(num_threads, iterations, f);
+    if (num_threads == 1) base = ns;
+
+    //with perfect scaling, the time per iteration stays constant as threads are added
+    cout << "  " << num_threads << " threads: " << ns << " ns / call (scaling efficiency "
+	 << (100.0 * base / ns) << "%)" << endl;
+  }
+}
+
+//Builds a scene with a number of single-triangle objects, each with a texture coordinate attribute.
+static void build_attribute_scene(scene &s, int num_objects) {
+  for (int i = 0; i < num_objects; ++i) {
+    int vert_offset = static_cast<int>(s.vertices.size());
+    int tri_offset = static_cast<int>(s.triangle_verts.size());
+    int prim_offset = static_cast<int>(s.primitives.size());
+
+    s.vertices.push_back({0.0f, 0.0f, static_cast<float>(i)});
+    s.vertices.push_back({1.0f, 0.0f, static_cast<float>(i)});
+    s.vertices.push_back({0.0f, 1.0f, static_cast<float>(i)});
+    s.triangle_verts.push_back({vert_offset, vert_offset + 1, vert_offset + 2});
+
+    primitive p{primitive::PRIM_TRIANGLE, prim_offset, tri_offset, i, -1, NULL, NULL};
+    s.primitives.push_back(p);
+
+    object_ptr o(new object);
+    o->vert_range = {vert_offset, vert_offset + 3};
+    o->prim_range = {prim_offset, prim_offset + 1};
+    o->tri_range = {tri_offset, tri_offset + 1};
+    s.objects.push_back(o);
+
+    attribute *attr = new attribute(attribute::PER_CORNER, get_attribute_type<float2>());
+    attr->resize(1);
+    float2 *uv = attr->data<float2>(0);
+    uv[0] = {0.0f, 0.0f};
+    uv[1] = {1.0f, 0.0f};
+    uv[2] = {0.0f, 1.0f};
+    s.add_attribute(i, "uv:UVMap", attr);
+  }
+}
+
+static void bench_attributes(unsigned int iterations) {
+  scene s;
+  build_attribute_scene(s, 64);
+  int handle = s.find_attribute_handle("uv:UVMap");
+  float4 coords{0.25f, 0.25f, 0.0f, 0.0f};
+
+  //all threads read the same few objects, as they would when rendering neighboring pixels
+  bench_func shared_copy = [&] (unsigned int thread_id, unsigned int N) {
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < N; ++i) {
+      const primitive &prim = s.primitives[i % 4];
+      object_ptr obj = s.objects[prim.object_id]; //copying the shared pointer, as the old lookup did
+      attribute *attr = obj->get_attribute(handle);
+      sum += attr->data<float2>(prim.data_id - obj->tri_range.x)->x;
+    }
+    if (sum < 0.0f) cout << sum << endl;
+  };
+
+  bench_func by_name = [&] (unsigned int thread_id, unsigned int N) {
+    float2 uv;
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < N; ++i) {
+      if (primitive_get_attribute<float2>(s.primitives[i % 4], s, "uv:UVMap", coords, uv)) sum += uv.x;
+    }
+    if (sum < 0.0f) cout << sum << endl;
+  };
+
+  bench_func by_handle = [&] (unsigned int thread_id, unsigned int N) {
+    float2 uv;
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < N; ++i) {
+      if (primitive_get_attribute<float2>(s.primitives[i % 4], s, handle, coords, uv)) sum += uv.x;
+    }
+    if (sum < 0.0f) cout << sum << endl;
+  };
+
+  report("Attribute access, copying object_ptr:", shared_copy, iterations);
+  report("primitive_get_attribute by name:", by_name, iterations);
+  report("primitive_get_attribute by handle:", by_handle, iterations);
+}
+
+//Builds a single object made of a (size x size) grid of quads in the XY plane.
+static void build_grid_scene(scene &s, int size) {
+  for (int y = 0; y <= size; ++y) {
+    for (int x = 0; x <= size; ++x) {
+      s.vertices.push_back({static_cast<float>(x), static_cast<float>(y), 0.0f});
+      s.vertex_normals.push_back({0.0f, 0.0f, 1.0f});
+    }
+  }
+
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      int v = y*(size + 1) + x;
+      int3 tris[2] = {{v, v + 1, v + size + 2}, {v, v + size + 2, v + size + 1}};
+
+      for (int i = 0; i < 2; ++i) {
+	int tri_id = static_cast<int>(s.triangle_verts.size());
+	s.triangle_verts.push_back(tris[i]);
+	s.primitives.push_back({primitive::PRIM_TRIANGLE, static_cast<int>(s.primitives.size()), tri_id, 0, -1, NULL, NULL});
+      }
+    }
+  }
+
+  object_ptr o(new object);
+  o->vert_range = {0, static_cast<int>(s.vertices.size())};
+  o->prim_range = {0, static_cast<int>(s.primitives.size())};
+  o->tri_range = {0, static_cast<int>(s.triangle_verts.size())};
+  s.objects.push_back(o);
+}
+
+static void bench_geometry_paging(unsigned int iterations) {
+  const int grid_size = 256;
+  const unsigned int num_rays = 4096;
+  
+  scene s;
+  build_grid_scene(s, grid_size);
+  bvh accel = build_bvh_centroid_sah(&s);
+
+  //rays pointing straight down at random points on the grid
+  mt19937 gen;
+  uniform_real_distribution<float> dist(0.0f, static_cast<float>(grid_size));
+  vector<ray> rays;
+  for (unsigned int i = 0; i < num_rays; ++i) rays.push_back(ray{{dist(gen), dist(gen), 1.0f}, {0.0f, 0.0f, -1.0f}, 0.0f, 10.0f});
+
+  vector<int> resident_hits(num_rays, -1);
+  bench_func trace_rays = [&] (unsigned int thread_id, unsigned int N) {
+    intersection isect;
+    unsigned int aabb_checked, prim_checked;
+    for (unsigned int i = 0; i < N; ++i) {
+      const ray &r = rays[i % num_rays];
+      int hit = accel.trace(r, isect, aabb_checked, prim_checked) ? isect.prim_idx : -1;
+      
+      if (!s.pager) resident_hits[i % num_rays] = hit;
+      else if (hit != resident_hits[i % num_rays]) cout << "Paged trace mismatch on ray " << (i % num_rays) << endl;
+    }
+  };
+
+  report("BVH trace, resident geometry:", trace_rays, iterations / 10);
+
+  //keep a quarter of the geometry in memory
+  size_t budget = s.triangle_verts.size() * sizeof(triangle_geometry) / 4;
+  string page_file = "gideon_bench.pages";
+  s.set_geometry_pager(geometry_pager::build(s, accel, page_file, budget, 16*1024));
+
+  report("BVH trace, paged geometry (25% resident):", trace_rays, iterations / 10);
+  cout << "  page faults: " << s.pager->page_faults() << ", resident bytes: " << s.geometry_memory() << endl;
+}
+
+//Builds a patch of long, diagonal strands (the worst case for axis-aligned boxes).
+static void build_strand_scene(scene &s, int num_strands, int segments, bool split) {
+  mt19937 gen;
+  uniform_real_distribution<float> dist(0.0f, 10.0f);
+  
+  for (int i = 0; i < num_strands; ++i) {
+    int first_point = static_cast<int>(s.strand_points.size());
+    float3 root{dist(gen), dist(gen), 0.0f};
+
+    for (int p = 0; p <= segments; ++p) {
+      float k = static_cast<float>(p) / segments;
+      s.strand_points.push_back({root.x + 4.0f*k, root.y + 4.0f*k, 4.0f*k, 0.02f*(1.0f - 0.5f*k)});
+    }
+    s.add_strand_segments(0, i, first_point, segments + 1, NULL, NULL, split);
+  }
+
+  object_ptr o(new object);
+  o->vert_range = {0, static_cast<int>(s.strand_points.size())};
+  o->prim_range = {0, static_cast<int>(s.primitives.size())};
+  o->tri_range = {0, 0};
+  s.objects.push_back(o);
+}
+
+static void bench_strands(unsigned int iterations) {
+  const unsigned int num_rays = 4096;
+  
+  mt19937 gen;
+  uniform_real_distribution<float> dist(0.0f, 14.0f);
+  vector<ray> rays;
+  for (unsigned int i = 0; i < num_rays; ++i) rays.push_back(ray{{dist(gen), dist(gen), 5.0f}, {0.0f, 0.0f, -1.0f}, 0.0f, 10.0f});
+
+  for (int split = 0; split < 2; ++split) {
+    scene s;
+    build_strand_scene(s, 1024, 2, split != 0);
+    bvh accel = build_bvh_centroid_sah(&s);
+
+    unsigned int hits = 0;
+    bench_func trace_rays = [&] (unsigned int thread_id, unsigned int N) {
+      intersection isect;
+      unsigned int aabb_checked, prim_checked, num_hits = 0;
+      for (unsigned int i = 0; i < N; ++i) {
+	if (accel.trace(rays[i % num_rays], isect, aabb_checked, prim_checked)) num_hits++;
+      }
+      if (thread_id == 0) hits = num_hits;
+    };
+
+    report(split ? "BVH trace, strands split into tight pieces:" : "BVH trace, unsplit strand segments:", trace_rays, iterations / 10);
+    cout << "  " << s.primitives.size() << " primitives, " << hits << " hits" << endl;
+  }
+}
+
+static void bench_thread_pool(unsigned int iterations) {
+  gideon::thread_pool pool;
+  const unsigned int num_tasks = 1024;
+
+  //tasks of uneven length, like tiles covering both empty sky and dense geometry
+  vector<unsigned int> task_work(num_tasks);
+  mt19937 gen;
+  for (unsigned int i = 0; i < num_tasks; ++i) task_work[i] = (gen() % 8 == 0) ? 20000 : 500;
+
+  vector<float> results(num_tasks, 0.0f);
+  vector<gideon::thread_pool::task> tasks;
+  for (unsigned int i = 0; i < num_tasks; ++i) {
+    tasks.push_back([&, i] (unsigned int worker_id) {
+	float sum = 0.0f;
+	for (unsigned int k = 0; k < task_work[i]; ++k) sum += sqrtf(static_cast<float>(k + worker_id));
+	results[i] = sum;
+      });
+  }
+
+  unsigned int num_batches = max(1u, iterations / 1000000);
+  auto start = chrono::high_resolution_clock::now();
+  for (unsigned int b = 0; b < num_batches; ++b) pool.run(tasks);
+  auto end = chrono::high_resolution_clock::now();
+
+  double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+  cout << "Thread pool (" << pool.size() << " workers, " << num_tasks << " uneven tasks):" << endl;
+  cout << "  " << (ns / (num_batches * num_tasks)) << " ns / task" << endl;
+}
+
+static void bench_random(unsigned int iterations) {
+  //the old generator: a boost::function wrapping mt19937, one per thread
+  bench_func mt = [] (unsigned int thread_id, unsigned int N) {
+    boost::function<float ()> rng = bind(uniform_real_distribution<float>(0.0f, 1.0f), mt19937(thread_id));
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < N; ++i) sum += rng();
+    if (sum < 0.0f) cout << sum << endl;
+  };
+
+  bench_func counter = [] (unsigned int thread_id, unsigned int N) {
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < N; ++i) sum += counter_random(i & 255, i >> 8, thread_id, i & 7);
+    if (sum < 0.0f) cout << sum << endl;
+  };
+
+  report("Random numbers, boost::function + mt19937:", mt, iterations);
+  report("Random numbers, counter-based (pixel, sample, dim):", counter, iterations);
+}
+
+//Stand-in for a path tracer: a flat, nearly noise-free background with a small region of very noisy pixels.
+static float4 synthetic_sample(int x, int y, int sample, int size) {
+  float u = counter_random(x, y, sample, 0);
+  int dx = x - size/2, dy = y - size/2;
+  
+  float L = 0.5f + 0.01f*(u - 0.5f);
+  if (dx*dx + dy*dy < (size*size)/64) L = 0.5f*powf(u, 8.0f) * 9.0f; //mean 0.5, heavy tail
+  return float4{L, L, L, 1.0f};
+}
+
+//Largest error (relative to the true mean of 0.5) of any pixel in the film.
+static float max_pixel_error(const gideon::film &f, int size) {
+  vector<float> out(4*size*size, 0.0f);
+  f.resolve(0, 0, size, size, reinterpret_cast<float (*)[4]>(&out[0]));
+
+  float max_error = 0.0f;
+  for (int i = 0; i < size*size; ++i) max_error = max(max_error, fabsf(out[4*i] - 0.5f) / 0.5f);
+  return max_error;
+}
+
+static void bench_adaptive_sampling(unsigned int iterations) {
+  const int size = 128, tile_size = 16;
+  const int samples_per_pass = 4, max_passes = max(2u, min(256u, iterations / 100000));
+
+  //fixed sampling: every pixel gets the full budget
+  gideon::film fixed(size, size, 0.0f, 2);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      for (int k = 0; k < samples_per_pass*max_passes; ++k) fixed.add_sample(x, y, synthetic_sample(x, y, k, size));
+    }
+  }
+
+  //adaptive sampling, scheduled like render_context::render_frame: later passes skip converged tiles and pixels
+  gideon::film adaptive(size, size, 0.02f, 2*samples_per_pass);
+  for (int pass = 0; pass < max_passes; ++pass) {
+    for (int y0 = 0; y0 < size; y0 += tile_size) {
+      for (int x0 = 0; x0 < size; x0 += tile_size) {
+	if (adaptive.converged(x0, y0, tile_size, tile_size)) continue;
+
+	for (int y = y0; y < y0 + tile_size; ++y) {
+	  for (int x = x0; x < x0 + tile_size; ++x) {
+	    if (adaptive.converged(x, y)) continue;
+	    for (int k = 0; k < samples_per_pass; ++k) {
+	      adaptive.add_sample(x, y, synthetic_sample(x, y, pass*samples_per_pass + k, size));
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  cout << "Adaptive sampling (" << size << "x" << size << ", up to " << samples_per_pass*max_passes << " spp):" << endl;
+  cout << "  fixed:    " << fixed.total_samples() << " samples, max pixel error " << max_pixel_error(fixed, size) << endl;
+  cout << "  adaptive: " << adaptive.total_samples() << " samples (" 
+       << (100.0 * adaptive.total_samples() / fixed.total_samples()) << "%), max pixel error "
+       << max_pixel_error(adaptive, size) << endl;
+}
+
+//Estimates a 4D integral (a pixel footprint times a hard-edged "light") in every pixel of an image,
+//comparing each sample generator's RMS error, the correlation of neighbouring pixels' errors
+//(negative when the error is spread as blue noise) and cost.
+static void bench_sample_generators(unsigned int iterations) {
+  const unsigned int size = 64;
+  const double expected = pi / 16.0;
+
+  for (unsigned int spp : {4u, 16u}) {
+    cout << "Sample generators (" << size << "x" << size << ", " << spp << " spp, 4D integrand):" << endl;
+    for (const string &name : {"uniform", "lhs", "sobol", "halton", "bluenoise"}) {
+      sampler samples;
+      samples.setup(0, 0, size, size, spp, samples.select_generator(name));
+      sampler::sample_id light_id = samples.add(2, 1, samples.select_generator(name));
+      unsigned int light_offset = samples.get_offset(light_id);
+
+      unsigned int rounds = max(1u, iterations / (size*size*spp*8));
+      double sq_error = 0.0, neighbour_error = 0.0;
+      vector<double> errors(size*size);
+      
+      auto start = chrono::high_resolution_clock::now();
+      for (unsigned int round = 0; round < rounds; ++round) {
+	samples.set_pass(round);
+	for (unsigned int y = 0; y < size; ++y) {
+	  for (unsigned int x = 0; x < size; ++x) {
+	    double sum = 0.0;
+	    for (unsigned int k = 0; k < spp; ++k) {
+	      float2 image_sample;
+	      samples.next_sample(x, y, &image_sample);
+	      float2 light = samples.access_2d(light_offset);
+	      
+	      if (light.x*light.x + light.y*light.y < 1.0f) sum += image_sample.x * image_sample.y;
+	    }
+	    errors[y*size + x] = sum / spp - expected;
+	  }
+	}
+
+	for (unsigned int i = 0; i < size*size; ++i) {
+	  sq_error += errors[i]*errors[i];
+	  if ((i % size) + 1 < size) neighbour_error += errors[i]*errors[i + 1];
+	}
+      }
+      auto end = chrono::high_resolution_clock::now();
+      
+      double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+      cout << "  " << name << ": RMS error " << sqrt(sq_error / (rounds*size*size))
+	   << ", neighbour correlation " << (neighbour_error / sq_error)
+	   << ", " << (ns / (rounds*size*size*spp)) << " ns / sample" << endl;
+    }
+  }
+}
+
+//Per-sample cost of the sampler with the path tracer's sample sets (4 bounces of light and BSDF samples).
+static void bench_sampler_sets(unsigned int iterations) {
+  const unsigned int tile_size = 32, num_light_samples = 8;
+  
+  cout << "Sampler with path tracer sets (" << tile_size << "x" << tile_size << " tiles, 1 spp per pass):" << endl;
+  for (const string &name : {"lhs", "sobol"}) {
+    sampler samples;
+    unsigned int passes = max(1u, iterations / (tile_size*tile_size*200));
+    float sum = 0.0f;
+    
+    auto start = chrono::high_resolution_clock::now();
+    for (unsigned int pass = 0; pass < passes; ++pass) {
+      samples.set_pass(pass);
+      samples.setup(0, 0, tile_size, tile_size, 1, samples.select_generator(name));
+
+      vector<unsigned int> offsets;
+      for (int depth = 0; depth < 4; ++depth) {
+	offsets.push_back(samples.get_offset(samples.add(1, num_light_samples, samples.select_generator(name))));
+	offsets.push_back(samples.get_offset(samples.add(2, num_light_samples, samples.select_generator(name))));
+	offsets.push_back(samples.get_offset(samples.add(2, 1, samples.select_generator(name))));
+	offsets.push_back(samples.get_offset(samples.add(1, 1, samples.select_generator(name))));
+      }
+
+      for (unsigned int y = 0; y < tile_size; ++y) {
+	for (unsigned int x = 0; x < tile_size; ++x) {
+	  float2 image_sample;
+	  samples.next_sample(x, y, &image_sample);
+	  for (auto it = offsets.begin(); it != offsets.end(); ++it) sum += samples.access_1d(*it);
+	}
+      }
+    }
+    auto end = chrono::high_resolution_clock::now();
+    
+    double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    cout << "  " << name << ": " << (ns / (passes*tile_size*tile_size)) << " ns / pixel sample";
+    if (sum < 0.0f) cout << sum;
+    cout << endl;
+  }
+}
+
+//Estimates the direct lighting of points on a floor under many small lights of varying power, picking one light per
+//sample either uniformly or with a light tree. Reports the relative RMS error of a single-sample estimate.
+static void bench_light_tree(unsigned int iterations) {
+  const unsigned int num_lights = 4096, num_points = 256;
+  const float floor_size = 100.0f;
+
+  vector<light> lights(num_lights);
+  for (unsigned int i = 0; i < num_lights; ++i) {
+    light &lt = lights[i];
+    lt.type = light::POINT;
+    lt.point.position = float3{floor_size * counter_random(i, 0, 0, 0), floor_size * counter_random(i, 1, 0, 0),
+			       0.5f + 10.0f * counter_random(i, 2, 0, 0)};
+    if (counter_random(i, 4, 0, 0) < 0.2f) lt.point.position.z *= -1.0f; //some are below the floor
+    lt.point.radius = 0.01f;
+    lt.energy = 1.0f + 99.0f * counter_random(i, 3, 0, 0) * counter_random(i, 3, 1, 0);
+    lt.color = float3{1.0f, 1.0f, 1.0f};
+  }
+
+  auto build_start = chrono::high_resolution_clock::now();
+  light_tree tree(lights);
+  auto build_end = chrono::high_resolution_clock::now();
+  cout << "Light tree (" << num_lights << " point lights): built in "
+       << chrono::duration_cast<chrono::microseconds>(build_end - build_start).count() << " us, "
+       << tree.memory() << " bytes" << endl;
+
+  //irradiance at P (with normal N) due to one light
+  auto contribution = [] (const light &lt, const float3 &P, const float3 &N) -> float {
+    float3 D = lt.point.position - P;
+    float d2 = dot(D, D);
+    return lt.energy * max(0.0f, dot(N, D)) / (d2 * sqrtf(d2));
+  };
+
+  const float3 N{0.0f, 0.0f, 1.0f};
+  unsigned int samples_per_point = max(1u, iterations / (num_points * 20));
+  
+  for (int use_tree = 0; use_tree < 2; ++use_tree) {
+    double sum_sq_error = 0.0;
+    float checksum = 0.0f;
+    double ns = 0.0;
+
+    for (unsigned int p = 0; p < num_points; ++p) {
+      float3 P{floor_size * counter_random(p, 0, 1, 0), floor_size * counter_random(p, 1, 1, 0), 0.0f};
+      double exact = 0.0;
+      for (unsigned int i = 0; i < num_lights; ++i) exact += contribution(lights[i], P, N);
+
+      double sq_error = 0.0;
+      auto start = chrono::high_resolution_clock::now();
+      for (unsigned int k = 0; k < samples_per_point; ++k) {
+	float u = counter_random(p, k, 2, 0);
+	float pdf = 1.0f / num_lights;
+	int id = use_tree ? tree.sample(P, N, u, pdf) : min(static_cast<int>(u * num_lights), static_cast<int>(num_lights) - 1);
+	float estimate = (id < 0) ? 0.0f : contribution(lights[id], P, N) / pdf;
+	sq_error += (estimate - exact) * (estimate - exact);
+	checksum += estimate;
+      }
+      auto end = chrono::high_resolution_clock::now();
+      
+      ns += chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+      sum_sq_error += sq_error / (samples_per_point * exact * exact);
+    }
+
+    cout << "  " << (use_tree ? "light tree:" : "uniform:   ") << " relative RMS error " << sqrt(sum_sq_error / num_points)
+	 << ", " << (ns / (num_points * samples_per_point)) << " ns / sample";
+    if (checksum < 0.0f) cout << checksum;
+    cout << endl;
+  }
+}
+
+//Samples points on the emissive triangles of a grid whose triangles use one of eight shaders, four of them emitting
+//with different brightness. Reports how often each emitting shader's triangles were picked, against their share of the power.
+static void bench_emitters(unsigned int iterations) {
+  const int grid_size = 128, num_shaders = 8;
+  
+  scene s;
+  build_grid_scene(s, grid_size);
+  static char shaders[num_shaders]; //only their addresses are used
+  for (size_t i = 0; i < s.primitives.size(); ++i) s.primitives[i].shader_id = &shaders[(i * 7) % num_shaders];
+
+  auto build_start = chrono::high_resolution_clock::now();
+  emitter_table emitters(s);
+  for (int i = 0; i < emitters.num_shaders(); ++i) {
+    int k = static_cast<char*>(emitters.shader(i)) - shaders;
+    float Le = (k < 4) ? static_cast<float>(1 << k) : 0.0f;
+    emitters.set_shader_emission(i, float4{Le, Le, Le, 1.0f});
+  }
+  emitters.build(s);
+  auto build_end = chrono::high_resolution_clock::now();
+  
+  cout << "Emitter table (" << emitters.num_emitters() << " of " << s.primitives.size() << " triangles emit): built in "
+       << chrono::duration_cast<chrono::microseconds>(build_end - build_start).count() << " us" << endl;
+
+  vector<unsigned int> picks(num_shaders, 0);
+  float checksum = 0.0f;
+  auto start = chrono::high_resolution_clock::now();
+  for (unsigned int i = 0; i < iterations; ++i) {
+    float3 P, N;
+    float pdf;
+    int prim_id = emitters.sample(counter_random(i, 0, 0, 0), counter_random(i, 1, 0, 0), counter_random(i, 2, 0, 0), P, N, pdf);
+    picks[static_cast<char*>(s.primitives[prim_id].shader_id) - shaders]++;
+    checksum += P.x * pdf;
+  }
+  auto end = chrono::high_resolution_clock::now();
+
+  //every shader has about the same number of (equally sized) triangles, so shader k should get 2^k / 15 of the samples
+  cout << "  " << (chrono::duration_cast<chrono::nanoseconds>(end - start).count() / static_cast<double>(iterations))
+       << " ns / sample, picked / expected:";
+  for (int k = 0; k < 4; ++k) cout << " " << (picks[k] / (iterations * (1 << k) / 15.0));
+  if (checksum < 0.0f) cout << checksum;
+  cout << endl;
+}
+
+//Estimates the irradiance from a sky with a small, bright sun, sampling directions uniformly or from the map's CDF.
+static void bench_environment(unsigned int iterations) {
+  const int width = 2048, height = 1024, num_normals = 16;
+
+  vector<float3> pixels(width * height);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      float sky = 0.2f + 0.8f * max(0.0f, cosf(pi * (y + 0.5f) / height));
+      bool sun = (abs(x - width / 8) < 4 && abs(y - height / 4) < 4);
+      pixels[y*width + x] = sun ? float3{20000.0f, 19000.0f, 17000.0f} : float3{0.5f*sky, 0.7f*sky, sky};
+    }
+  }
+
+  auto build_start = chrono::high_resolution_clock::now();
+  environment_map map(width, height, move(pixels));
+  auto build_end = chrono::high_resolution_clock::now();
+  cout << "Environment map (" << width << "x" << height << "): CDF built in "
+       << chrono::duration_cast<chrono::microseconds>(build_end - build_start).count() << " us, "
+       << map.memory() << " bytes" << endl;
+
+  auto luminance = [] (const float3 &c) { return 0.2126f*c.x + 0.7152f*c.y + 0.0722f*c.z; };
+  unsigned int samples_per_normal = max(1u, iterations / (num_normals * 20));
+
+  //sum over the texels, each covering (2 pi / width) * (pi / height) * sin(theta) steradians
+  vector<float3> normals(num_normals);
+  vector<double> exact(num_normals, 0.0);
+  for (int n = 0; n < num_normals; ++n) normals[n] = uniform_sample_sphere(counter_random(n, 0, 1, 0), counter_random(n, 1, 1, 0));
+  for (int y = 0; y < height; ++y) {
+    float theta = pi * (y + 0.5f) / height;
+    for (int x = 0; x < width; ++x) {
+      float phi = 2.0f * pi * (x + 0.5f) / width;
+      float3 D{sinf(theta)*cosf(phi), sinf(theta)*sinf(phi), cosf(theta)};
+      float E = luminance(map.eval(D)) * (2.0f * pi * pi * sinf(theta) / (width * height));
+      for (int n = 0; n < num_normals; ++n) exact[n] += E * max(0.0f, dot(normals[n], D));
+    }
+  }
+  
+  for (int use_map = 0; use_map < 2; ++use_map) {
+    double sum_sq_error = 0.0;
+    float checksum = 0.0f;
+    double ns = 0.0;
+
+    for (int n = 0; n < num_normals; ++n) {
+      const float3 &N = normals[n];
+      double sq_error = 0.0;
+      auto start = chrono::high_resolution_clock::now();
+      for (unsigned int k = 0; k < samples_per_normal; ++k) {
+	float u = counter_random(n, k, 2, 0), v = counter_random(n, k, 3, 0);
+	float pdf = 1.0f / (4.0f * pi);
+	float3 D = use_map ? map.sample(u, v, pdf) : uniform_sample_sphere(u, v);
+	float estimate = (pdf <= 0.0f) ? 0.0f : luminance(map.eval(D)) * max(0.0f, dot(N, D)) / pdf;
+	sq_error += (estimate - exact[n]) * (estimate - exact[n]);
+	checksum += estimate;
+      }
+      auto end = chrono::high_resolution_clock::now();
+      
+      ns += chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+      sum_sq_error += sq_error / (samples_per_normal * exact[n] * exact[n]);
+    }
+
+    cout << "  " << (use_map ? "map CDF:" : "uniform:") << " relative RMS error " << sqrt(sum_sq_error / num_normals)
+	 << ", " << (ns / (num_normals * samples_per_normal)) << " ns / sample";
+    if (checksum < 0.0f) cout << checksum;
+    cout << endl;
+  }
+}
+
+//Traces one ray per pixel of an image covering a grid, visiting tiles and pixels in the given orders.
+//Paged geometry with a small budget stands in for the caches, so page faults count the cache misses.
+static void bench_tile_order(unsigned int iterations) {
+  const int grid_size = 512, image_size = 1024, tile_size = 32;
+  const int num_tiles = image_size / tile_size;
+
+  //a slightly bumpy grid (the centroid SAH builder makes very large leaves for a perfectly flat one)
+  scene s;
+  build_grid_scene(s, grid_size);
+  for (size_t i = 0; i < s.vertices.size(); ++i) s.vertices[i].z = 0.25f * counter_random(i, 0, 0, 0);
+  bvh accel = build_bvh_centroid_sah(&s);
+
+  size_t budget = s.triangle_verts.size() * sizeof(triangle_geometry) / 64;
+  s.set_geometry_pager(geometry_pager::build(s, accel, "gideon_bench.pages", budget, 16*1024));
+
+  vector<uint32_t> scanline(tile_size*tile_size), morton;
+  for (int i = 0; i < tile_size*tile_size; ++i) scanline[i] = ((i / tile_size) << 16) | (i % tile_size);
+  gideon::morton_pixel_order(tile_size, tile_size, morton);
+
+  struct order_config { const char *name; gideon::tile_order tiles; const vector<uint32_t> *pixels; };
+  order_config configs[] = {{"row-major tiles, scanline pixels:", gideon::TILES_ROW_MAJOR, &scanline},
+			    {"Hilbert tiles, Morton pixels:", gideon::TILES_HILBERT, &morton},
+			    {"spiral tiles, Morton pixels:", gideon::TILES_SPIRAL, &morton}};
+
+  cout << "Tile order (" << image_size << "x" << image_size << " image, " << tile_size << "px tiles, "
+       << (budget >> 10) << " KB of geometry resident):" << endl;
+  
+  unsigned int num_frames = max(1u, iterations / 10000000);
+  for (auto cfg = begin(configs); cfg != end(configs); ++cfg) {
+    vector<int> sequence = gideon::tile_sequence(cfg->tiles, num_tiles, num_tiles);
+    uint64_t faults_before = s.pager->page_faults();
+    int hits = 0;
+    
+    auto start = chrono::high_resolution_clock::now();
+    for (unsigned int frame = 0; frame < num_frames; ++frame) {
+      for (auto t = sequence.begin(); t != sequence.end(); ++t) {
+	int x0 = (*t % num_tiles) * tile_size, y0 = (*t / num_tiles) * tile_size;
+
+	for (auto p = cfg->pixels->begin(); p != cfg->pixels->end(); ++p) {
+	  float x = (x0 + (*p & 0xffff) + 0.5f) * grid_size / image_size;
+	  float y = (y0 + (*p >> 16) + 0.5f) * grid_size / image_size;
+	  
+	  ray r{{x, y, 1.0f}, {0.0f, 0.0f, -1.0f}, 0.0f, 10.0f};
+	  intersection isect;
+	  unsigned int aabb_checked, prim_checked;
+	  if (accel.trace(r, isect, aabb_checked, prim_checked)) ++hits;
+	}
+      }
+    }
+    auto end = chrono::high_resolution_clock::now();
+
+    double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    cout << "  " << cfg->name << " " << (ns / (num_frames * image_size * image_size)) << " ns / ray, "
+	 << (s.pager->page_faults() - faults_before) / num_frames << " page faults / frame (" << hits << " hits)" << endl;
+  }
+}
+
+static void bench_noop_dtor(void *) { }
+
+//Builds and evaluates a small shade tree (two scaled BSDFs plus an emitter) over and over, as a kernel does at
+//every shading point, on one thread and then on every core at once.
+static void bench_shade_tree(unsigned int iterations) {
+  const size_t param_size = 48;
+  
+  auto shade = [] (unsigned int n) -> float {
+    float checksum = 0.0f;
+    for (unsigned int i = 0; i < n; ++i) {
+      char *params;
+      shade_tree::node_ptr diffuse(shade_tree::make_leaf(param_size, 1, NULL, NULL, NULL, NULL, bench_noop_dtor, params));
+      shade_tree::node_ptr glossy(shade_tree::make_leaf(param_size, 2, NULL, NULL, NULL, NULL, bench_noop_dtor, params));
+      shade_tree::node_ptr emit(shade_tree::make_leaf(param_size, 4, NULL, NULL, NULL, NULL, bench_noop_dtor, params));
+      params[0] = static_cast<char>(i);
+
+      shade_tree::node_ptr surface(shade_tree::make_sum(shade_tree::make_scale(float4{0.8f, 0.8f, 0.8f, 1.0f}, diffuse),
+							shade_tree::make_scale(float4{0.2f, 0.2f, 0.2f, 1.0f}, glossy)));
+      shade_tree::node_ptr root(shade_tree::make_sum(surface, emit));
+
+      float3 P{0.0f, 0.0f, 0.0f}, w{0.0f, 0.0f, 1.0f};
+      float pdf;
+      float4 f;
+      shade_tree::evaluate(root, 3, &P, &w, &P, &w, &pdf, &f);
+      checksum += f.x + shade_tree::get_weight(root);
+    }
+    return checksum;
+  };
+
+  unsigned int num_trees = max(1u, iterations / 10);
+  auto start = chrono::high_resolution_clock::now();
+  float checksum = shade(num_trees);
+  auto end = chrono::high_resolution_clock::now();
+  
+  cout << "Shade trees (3 leaves, 2 scales, 2 sums): "
+       << (chrono::duration_cast<chrono::nanoseconds>(end - start).count() / static_cast<double>(num_trees)) << " ns / tree";
+
+  unsigned int num_threads = max(1u, thread::hardware_concurrency());
+  vector<thread> threads;
+  start = chrono::high_resolution_clock::now();
+  for (unsigned int t = 0; t < num_threads; ++t) threads.push_back(thread([&] () { shade(num_trees); }));
+  for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+  end = chrono::high_resolution_clock::now();
+
+  cout << ", " << (chrono::duration_cast<chrono::nanoseconds>(end - start).count() / static_cast<double>(num_trees))
+       << " ns / tree on " << num_threads << " threads at once, " << shade_tree::arena::local().capacity() << " bytes of arena";
+  if (checksum < 0.0f) cout << checksum;
+  cout << endl;
+}
+
+//Diffuse paths over a bumpy grid lit by a point light, traced one path at a time or a tile at a time.
+static void bench_wavefront(unsigned int iterations) {
+  const int grid_size = 256, tile_size = 32, max_depth = 3;
+  const float3 light_P{0.5f*grid_size, 0.5f*grid_size, 50.0f};
+  
+  scene s;
+  build_grid_scene(s, grid_size);
+  for (size_t i = 0; i < s.vertices.size(); ++i) s.vertices[i].z = 0.25f * counter_random(i, 0, 0, 0);
+  bvh accel = build_bvh_centroid_sah(&s);
+
+  auto camera_ray = [&] (int x, int y) {
+    float3 O{x + 0.5f, y + 0.5f, 20.0f};
+    return ray{O, normalize(float3{0.3f, 0.2f, -1.0f}), 0.0f, 1000.0f};
+  };
+  auto shadow_ray = [&] (const float3 &P) {
+    float3 D = light_P - P;
+    return ray{P, normalize(D), 1e-3f, length(D)};
+  };
+  auto bounce_ray = [&] (const float3 &P, int x, int y, int depth) {
+    float3 w = cosine_sample_hemisphere(float3{0.0f, 0.0f, 1.0f}, counter_random(x, y, depth, 0), counter_random(x, y, depth, 1));
+    return ray{P, w, 1e-3f, 1000.0f};
+  };
+
+  unsigned int num_tiles = max(1u, iterations / 1000000);
+  unsigned int num_paths = num_tiles * tile_size * tile_size;
+  
+  //depth-first: each path bounces to the end, with closest-hit shadow rays (the old path tracer)
+  unsigned int lit = 0;
+  auto start = chrono::high_resolution_clock::now();
+  for (unsigned int t = 0; t < num_tiles; ++t) {
+    int x0 = (t * tile_size) % (grid_size - tile_size), y0 = (t / 8) * tile_size % (grid_size - tile_size);
+    for (int y = y0; y < y0 + tile_size; ++y) {
+      for (int x = x0; x < x0 + tile_size; ++x) {
+	ray r = camera_ray(x, y);
+	for (int depth = 0; depth < max_depth; ++depth) {
+	  intersection isect, shadow_isect;
+	  unsigned int aabb_checked, prim_checked;
+	  if (!accel.trace(r, isect, aabb_checked, prim_checked)) break;
+
+	  float3 P = r.o + isect.t * r.d;
+	  if (!accel.trace(shadow_ray(P), shadow_isect, aabb_checked, prim_checked)) ++lit;
+	  r = bounce_ray(P, x, y, depth);
+	}
+      }
+    }
+  }
+  auto end = chrono::high_resolution_clock::now();
+  double depth_first_ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+
+  //wavefront: a tile's paths advance one bounce at a time, with shadow rays traced as an any-hit stream
+  gideon::wavefront_queue paths;
+  const float4 one{1.0f, 1.0f, 1.0f, 1.0f};
+  float lit_paths = 0.0f;
+  
+  start = chrono::high_resolution_clock::now();
+  for (unsigned int t = 0; t < num_tiles; ++t) {
+    int x0 = (t * tile_size) % (grid_size - tile_size), y0 = (t / 8) * tile_size % (grid_size - tile_size);
+    paths.clear();
+    for (int y = y0; y < y0 + tile_size; ++y) {
+      for (int x = x0; x < x0 + tile_size; ++x) paths.add_path(camera_ray(x, y), x, y, 0);
+    }
+
+    for (int depth = 0; depth < max_depth; ++depth) {
+      if (paths.trace(accel) == 0) break;
+      paths.sort_by_shader(s);
+      
+      for (int i = 0; i < paths.num_active(); ++i) {
+	int id = paths.active_path(i);
+	gideon::wavefront_queue::path &p = paths.get(id);
+	float3 P = p.r.o + p.hit.t * p.r.d;
+	
+	paths.add_shadow_ray(id, shadow_ray(P), one);
+	paths.continue_path(id, bounce_ray(P, p.x, p.y, depth));
+      }
+      paths.trace_shadows(accel);
+    }
+
+    for (int id = 0; id < paths.num_paths(); ++id) lit_paths += paths.get(id).radiance.x;
+  }
+  end = chrono::high_resolution_clock::now();
+  double wavefront_ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+
+  cout << "Wavefront path tracing (" << num_paths << " paths, " << max_depth << " bounces):" << endl;
+  cout << "  depth-first: " << (depth_first_ns / num_paths) << " ns / path (" << lit << " lit vertices)" << endl;
+  cout << "  wavefront:   " << (wavefront_ns / num_paths) << " ns / path (" << lit_paths << " lit vertices)" << endl;
+}
+
+//Diffuse bounce rays from random points on a bumpy grid, traced one at a time (in the order generated) or as sorted batches.
+static void bench_trace_batch(unsigned int iterations) {
+  const int grid_size = 256, batch_size = 4096;
+  
+  scene s;
+  build_grid_scene(s, grid_size);
+  for (size_t i = 0; i < s.vertices.size(); ++i) s.vertices[i].z = 0.25f * counter_random(i, 0, 0, 0);
+  bvh accel = build_bvh_centroid_sah(&s);
+
+  unsigned int num_rays = max(static_cast<unsigned int>(batch_size), (iterations / 20) / batch_size * batch_size);
+  vector<ray> rays(num_rays);
+  for (unsigned int i = 0; i < num_rays; ++i) {
+    float3 P{grid_size * counter_random(i, 0, 0, 1), grid_size * counter_random(i, 0, 0, 2), 0.5f};
+    float3 w = cosine_sample_hemisphere(float3{0.0f, 0.0f, 1.0f}, counter_random(i, 0, 0, 3), counter_random(i, 0, 0, 4));
+    w.z = -w.z; //aim down at the grid so most rays hit something
+    rays[i] = ray{P, w, 1e-3f, 1000.0f};
+  }
+  vector<intersection> hits(num_rays);
+
+  unsigned int num_hits = 0;
+  auto start = chrono::high_resolution_clock::now();
+  for (unsigned int i = 0; i < num_rays; ++i) {
+    unsigned int aabb_checked, prim_checked;
+    if (accel.trace(rays[i], hits[i], aabb_checked, prim_checked)) ++num_hits;
+  }
+  auto end = chrono::high_resolution_clock::now();
+  double single_ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+
+  unsigned int num_batch_hits = 0;
+  start = chrono::high_resolution_clock::now();
+  for (unsigned int i = 0; i < num_rays; i += batch_size) num_batch_hits += accel.trace_batch(&rays[i], batch_size, &hits[i]);
+  end = chrono::high_resolution_clock::now();
+  double batch_ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+
+  cout << "Batch tracing (" << num_rays << " diffuse rays, batches of " << batch_size << "):" << endl;
+  cout << "  one at a time: " << (1000.0 * num_rays / single_ns) << " Mrays/s (" << num_hits << " hits)" << endl;
+  cout << "  batched:       " << (1000.0 * num_rays / batch_ns) << " Mrays/s (" << num_batch_hits << " hits)" << endl;
+}
+
+//Regression check: flipping the signs of two coordinates used to leave the geometry hash unchanged, so an edited
+//scene kept its stale BVH.
+static bool check_geometry_hash() {
+  scene a, b;
+  a.vertices = {float3{1.0f, 2.0f, 3.0f}, float3{4.0f, 5.0f, 6.0f}, float3{7.0f, 8.0f, 9.0f}, float3{1.5f, 2.5f, 3.5f}};
+  b.vertices = a.vertices;
+  b.vertices[0].y = -b.vertices[0].y;
+  b.vertices[2].y = -b.vertices[2].y;
+
+  if (a.geometry_hash() != b.geometry_hash()) return true;
+  cout << "FAILED: scenes with different vertices have the same geometry hash" << endl;
+  return false;
+}
+
+int main(int argc, char **argv) {
+  unsigned int iterations = 10000000;
+  if (argc >= 2) iterations = static_cast<unsigned int>(stoul(argv[1]));
+
+  if (!check_geometry_hash()) return 1;
+
+  bench_attributes(iterations);
+  bench_geometry_paging(iterations);
+  bench_strands(iterations);
+  bench_thread_pool(iterations);
+  bench_random(iterations);
+  bench_adaptive_sampling(iterations);
+  bench_sample_generators(iterations);
+  bench_sampler_sets(iterations);
+  bench_light_tree(iterations);
+  bench_emitters(iterations);
+  bench_environment(iterations);
+  bench_shade_tree(iterations);
+  bench_tile_order(iterations);
+  bench_wavefront(iterations);
+  bench_trace_batch(iterations);
+  return 0;
+}
@@ -31,6 +31,7 @@
 #include "math/vector.hpp"
 
 #include "compiler/rendermodule.hpp"
+#include "engine/context.hpp"
 
 #include <fstream>
 #include <iostream>
@@ -77,8 +78,12 @@ int main(int argc, char **argv) {
       func->viewCFG();
     }
     else {
-      compiled_renderer kernel(module);
-      void *entry_ptr = kernel.get_function_pointer(argv[2]);
+      gideon::render_context ctx;
+      ctx.set_kernel(unique_ptr<render_kernel>(new compiled_renderer(module)));
+      ctx.set_scene(unique_ptr<scene>(new scene));
+      ctx.bind_main_thread();
+
+      void *entry_ptr = ctx.get_kernel()->get_function_pointer(argv[2]);
       void (*entry_func)() = (void (*)())(entry_ptr);
       entry_func();
     }